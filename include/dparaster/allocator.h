@@ -0,0 +1,78 @@
+#ifndef DPARASTER_ALLOCATOR_H
+#define DPARASTER_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// All heap memory of the library comes from here. Every allocation belongs to a category, which
+// can have its own allocator and limit, and is counted separately. Memory the library hands out,
+// like the meshlets of geometry_build_meshlets, has to be freed with dparaster_free.
+//
+// Memory mapped files, like the ones textures are loaded from, aren't allocations and don't count.
+enum dparaster_memory_category {
+  DPM_TEXTURE,     // Decoded images, mip levels, and the state of loaders and caches
+  DPM_FRAMEBUFFER, // Color, depth and HiZ buffers, and the renderers and queues drawing into them
+  DPM_GEOMETRY,    // Meshes, meshlets, and scenes
+  DPM_SCRATCH,     // Only used during a call, freed before it returns, like processed triangles
+  DPM_COUNT
+};
+
+// Memory returned by alloc has to be suitably aligned for any type, like the one of malloc.
+// free gets the size the memory was allocated with, so allocators with size classes don't need
+// to look it up. realloc is optional, and only used for memory alloc or realloc returned as is.
+// All functions can be called from several threads at once.
+struct dparaster_allocator {
+  void* (*alloc)(void* user, size_t size);
+  void* (*realloc)(void* user, void* memory, size_t old_size, size_t size);
+  void (*free)(void* user, void* memory, size_t size);
+  void* user;
+};
+
+// The allocator must stay valid until everything allocated with it was freed. Memory is always
+// freed with the allocator it came from, so the allocator can be changed at any time.
+// 0 restores malloc.
+void dparaster_set_allocator(enum dparaster_memory_category category, const struct dparaster_allocator* allocator);
+// Allocations which would make the category use more than limit bytes fail. 0 means no limit.
+void dparaster_set_memory_limit(enum dparaster_memory_category category, size_t limit);
+
+struct dparaster_memory_stats {
+  size_t current[DPM_COUNT]; // Bytes in use
+  size_t peak[DPM_COUNT];    // The most bytes in use at once, since the last reset
+  size_t total, total_peak;  // Of all categories together
+  unsigned long long allocations[DPM_COUNT];
+  unsigned long long failed[DPM_COUNT]; // Allocations refused by the allocator or the limit
+};
+
+void dparaster_memory_stats(struct dparaster_memory_stats* stats);
+// The peaks start over at the current usage
+void dparaster_memory_reset_peak(void);
+
+// Like malloc, calloc, realloc, strdup and free. realloc keeps the category of the memory.
+void* dparaster_alloc(size_t size, enum dparaster_memory_category category);
+void* dparaster_calloc(size_t count, size_t size, enum dparaster_memory_category category);
+void* dparaster_aligned_alloc(size_t alignment, size_t size, enum dparaster_memory_category category);
+void* dparaster_realloc(void* memory, size_t size, enum dparaster_memory_category category);
+char* dparaster_strdup(const char* string, enum dparaster_memory_category category);
+void dparaster_free(void* memory);
+
+// For memory the library gets straight from the system, where the header in front of every
+// allocation would be in the way, like buffers aligned to huge pages. Counts the allocation of
+// memory, or a failed one if memory is 0. Returns false if memory is 0 or doesn't fit under the
+// limit, the memory has to be given back then. Once it's freed, unaccount takes back its size.
+bool dparaster_account(const void* memory, size_t size, enum dparaster_memory_category category);
+void dparaster_unaccount(size_t size, enum dparaster_memory_category category);
+
+// An allocator for memory which is only needed for a short while, like during a frame.
+// Allocations are cut from one block, freeing them does nothing, and resetting the arena makes
+// the whole block available again. Allocations which don't fit anymore go to malloc instead.
+// It's meant for DPM_SCRATCH, memory of other categories usually lives longer than a frame.
+struct dparaster_arena;
+
+struct dparaster_arena* dparaster_arena_create(size_t capacity);
+const struct dparaster_allocator* dparaster_arena_allocator(struct dparaster_arena* arena);
+// Nothing allocated from the arena may be in use anymore. Returns the bytes which were requested
+// since the last reset, including the ones which didn't fit, which is a good capacity.
+size_t dparaster_arena_reset(struct dparaster_arena* arena);
+void dparaster_arena_free(struct dparaster_arena* arena);
+
+#endif
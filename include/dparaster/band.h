@@ -0,0 +1,29 @@
+#ifndef DPARASTER_BAND_H
+#define DPARASTER_BAND_H
+
+#include <dparaster/shader.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Renders an image in horizontal bands of a few rows, so only the color and depth buffer
+// of one band needs to be in memory at once. Draws only run the vertex stage, and remember
+// which bands the resulting triangles touch. Each band then only rasterizes those triangles.
+struct band_renderer;
+
+// Fails if the width or height is too big for a bitmap, see bitmap_size_fits. Images with more
+// than 4GiB of data work, their header just can't say how big they are.
+struct band_renderer* band_renderer_create(uint32_t w, uint32_t h, uint32_t rows);
+// The shader and texture have to stay valid until band_write, the uniform is copied.
+bool band_draw(
+  struct band_renderer*restrict br,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry
+);
+// Writes the image as a bitmap. Bitmaps are stored bottom up, so bands are rendered and written
+// in that order, and the output needs no seeking. Afterwards, the renderer is ready for the next frame.
+bool band_write(struct band_renderer*restrict br, FILE*restrict of);
+void band_renderer_free(struct band_renderer* br);
+
+#endif
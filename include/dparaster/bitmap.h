@@ -1,10 +1,40 @@
 #ifndef DPARASTER_BITMAP_H
 #define DPARASTER_BITMAP_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
 
+// The file and image size are stored in 32 bits. For 4GiB of image data and more, the image
+// size is left 0, which uncompressed bitmaps allow, and the file size is the most it can be.
+// Readers then go by the width and height, which are signed, and have to fit.
+static inline bool bitmap_size_fits(uint32_t w, uint32_t h){
+  return w <= INT32_MAX && h <= INT32_MAX && (uint64_t)w * h <= (SIZE_MAX - 54) / 4;
+}
+
+// The header of a 32bpp bitmap, the w*h*4 bytes of image data need to follow.
+// The size has to fit, see bitmap_size_fits.
+void bitmap_header_build(
+  uint8_t header[static 54],
+  const uint32_t w,
+  const uint32_t h
+);
+
+// Fails if the width or height is too big for a bitmap
+bool bitmap_write_header(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h
+);
+
+bool bitmap_write(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+);
+
 bool bitmap_save(
   const char*restrict file,
   const uint32_t w,
@@ -0,0 +1,58 @@
+#ifndef DPARASTER_DELTA_H
+#define DPARASTER_DELTA_H
+
+#include <dparaster/shader.h>
+#include <dparaster/framebuffer.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Renders frames incrementally. The draws of each frame are recorded and compared to the ones of
+// the frame before. Only the tiles a changed draw covers now or covered before get cleared, and
+// only the draws touching those tiles get drawn again, into just those tiles.
+//
+// Which tiles a draw covers is estimated from the bounding box of its geometry, transformed by the
+// modelview matrix of the uniform. Like for scene culling, shaders are expected to transform
+// positions by it and nothing else.
+struct delta_renderer;
+
+struct delta_stats {
+  unsigned draws;
+  unsigned changed; // Draws which differ from the frame before, or were added or removed
+  unsigned redrawn; // Draws touching a changed tile
+  unsigned tiles;
+  unsigned dirty;   // Tiles which got redrawn
+};
+
+struct delta_renderer* delta_renderer_create(uint32_t w, uint32_t h, enum framebuffer_flags flags);
+// Draws are compared with the draw at the same position in the frame before, by shader, uniform
+// and the address of the geometry. The shader, geometry and texture have to stay valid until the
+// next frame was rendered, the uniform is copied.
+bool delta_draw(
+  struct delta_renderer*restrict dr,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry
+);
+// Everything gets redrawn in the next frame. Needed if a geometry changed in place.
+void delta_invalidate(struct delta_renderer* dr);
+// Brings the framebuffer up to date with the recorded draws, which become the frame to compare
+// the next one to. Returns 0 on error, stats may be 0.
+const Framebuffer* delta_render(struct delta_renderer*restrict dr, struct delta_stats*restrict stats);
+// Writes the tiles redrawn by the last delta_render, see below
+bool delta_write(const struct delta_renderer*restrict dr, FILE*restrict of);
+void delta_renderer_free(struct delta_renderer* dr);
+
+// A tile delta stream is a sequence of frames, all numbers are little endian uint32_t:
+//   "DPTD" w h tile run-count, then the runs
+// A run is a horizontal strip of tiles, which all changed:
+//   tile-row first-tile-column tile-count, then the pixels
+// The pixels are BGRX, row by row, of all the tiles of the run. The strip is tile pixels high,
+// and tile-count * tile pixels wide, less at the top and right edge of the image. Rows are
+// counted bottom up, just like in a bitmap. Pixels not in any run are the same as in the frame
+// before, or black in the first frame and after the size changed.
+#define DELTA_MAGIC "DPTD"
+#define DELTA_HEADER_SIZE 20
+#define DELTA_RUN_SIZE 12
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef DPARASTER_DPTX_H
+#define DPARASTER_DPTX_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <dparaster/texture.h>
+
+// The native texture container. It's made to be mapped and used as is, the loader only has to
+// check the header and set the pointers. All fields are little endian.
+//
+//   header (DPTX_HEADER_SIZE bytes):
+//     char magic[4]      "DPTX"
+//     u32  version
+//     char format[8]     The format string of the texture, 0 padded
+//     u8   dimension_count
+//     u8   level_count   Mip levels after the base level
+//     u8   flags         Bit n is set if dimension n is flipped, bit 7 if the texture is layered
+//     u8   compression   A texture_compression, only for the format "RGBA"
+//   level_count+1 levels, the base level first (DPTX_LEVEL_SIZE bytes each):
+//     u64  offset        Of the image data, from the start of the file, a multiple of DPTX_ALIGN
+//     u64  size[3]
+//     u64  stride[3]
+//   image data
+
+#define DPTX_MAGIC "DPTX"
+#define DPTX_VERSION 1
+#define DPTX_HEADER_SIZE 24
+#define DPTX_LEVEL_SIZE 56
+#define DPTX_ALIGN 64
+#define DPTX_LAYERED 0x80
+
+bool dptx_write(FILE*restrict of, const struct texture*restrict texture);
+bool dptx_save(const char*restrict file, const struct texture*restrict texture);
+
+#endif
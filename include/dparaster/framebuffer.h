@@ -0,0 +1,150 @@
+#ifndef DPARASTER_FRAMEBUFFER_H
+#define DPARASTER_FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// The depth buffer is split into tiles of HIZ_TILE x HIZ_TILE pixels, and the nearest and farthest
+// depth of each is kept. Anything farther than the farthest depth of a tile is hidden in all of it,
+// which lets draw_triangle skip whole triangles and spans without looking at each pixel.
+#define HIZ_TILE 8
+
+// Tiled framebuffers keep each FB_TILE x FB_TILE square of pixels together in memory, the rows of
+// a tile one after another. A triangle then touches fewer cache lines and pages than it would
+// going row by row over the whole width. The tiles are the depth tiles.
+#define FB_TILE HIZ_TILE
+#define FB_TILE_SHIFT 3
+
+enum framebuffer_flags {
+  FBF_TILED     = 1<<0, // Lay out color and depth in tiles, instead of row by row
+  FBF_HUGEPAGES = 1<<1, // Put big buffers into transparent huge pages, for fewer TLB misses
+  // Multisampling: coverage and depth are kept for each of 2, 4 or 8 samples per pixel, but the
+  // fragment shader runs only once per pixel and triangle. framebuffer_resolve averages the samples.
+  FBF_MSAA_2X   = 1<<2,
+  FBF_MSAA_4X   = 2<<2,
+  FBF_MSAA_8X   = 3<<2,
+  FBF_MSAA_MASK = 3<<2,
+  // The format fragments get written in, packed and with one store of the texel size. By default,
+  // they go into the 8 bit BGRX image right away. Otherwise, they go into a target of that format,
+  // and framebuffer_resolve converts each pixel once, after everything was drawn. Floats keep
+  // colors above 1 for tone mapping.
+  FBF_RGB10A2     = 1<<4,
+  FBF_FLOAT16     = 2<<4,
+  FBF_FLOAT32     = 3<<4,
+  FBF_FORMAT_MASK = 3<<4,
+  FBF_TONEMAP     = 1<<6, // framebuffer_resolve maps 0..infinity to 0..1, with the ACES filmic curve
+  FBF_DITHER      = 1<<7, // framebuffer_resolve adds an ordered dither before reducing colors to 8 bit
+};
+
+enum framebuffer_format {
+  FBF_FORMAT_BGRX8,   // uint8_t[4], like the image
+  FBF_FORMAT_RGB10A2, // uint32_t, red in the lowest bits, alpha in the highest 2
+  FBF_FORMAT_FLOAT16, // uint16_t[4], RGBA as half floats
+  FBF_FORMAT_FLOAT32, // float[4], RGBA, the same as a Vector
+};
+
+static inline unsigned framebuffer_texel_size(enum framebuffer_format format){
+  switch(format){
+    case FBF_FORMAT_BGRX8  : return 4;
+    case FBF_FORMAT_RGB10A2: return 4;
+    case FBF_FORMAT_FLOAT16: return 8;
+    case FBF_FORMAT_FLOAT32: return 16;
+  }
+  return 0;
+}
+
+// How many pixels the fragment shader runs once for, see framebuffer_set_shading_rate. The lowest
+// 2 bits are the log2 of the width of such a block, the next 2 bits the log2 of its height.
+enum shading_rate {
+  SR_1X1 = 0,
+  SR_2X1 = 1,
+  SR_1X2 = 1<<2,
+  SR_2X2 = 1 | 1<<2,
+  SR_4X4 = 2 | 2<<2,
+};
+
+// The color a block of pixels got shaded with, for the triangle being drawn
+struct coarse_fragment {
+  uint32_t triangle, block;
+  float color[4];
+};
+
+struct hiz_tile {
+  double min, max;
+  bool dirty; // Something got drawn in the tile since max was computed, it may be less now
+};
+
+typedef struct Framebuffer {
+  uint32_t w, h;       // Size of the whole image
+  uint32_t y, rows;    // The rows of the image this buffer holds, counted bottom up, just like in a bitmap
+  uint8_t (*image)[4]; // uint8_t[rows][w][4], BGRX. Or in tiles, see framebuffer_offset.
+  double* depth;       // double[rows][w][samples], laid out like the image
+  void* target;        // [rows][w][samples] texels of the format, if it isn't BGRX8 or there's multisampling, or 0
+  enum framebuffer_format format;
+  enum framebuffer_flags resolve; // FBF_TONEMAP and FBF_DITHER
+  uint8_t samples;     // Per pixel, 1 without multisampling
+  uint8_t (*linear)[4]; // Where tiled images get copied to for writing them out, or 0
+  size_t stride;       // Pixels from one row to the next, or from one row of tiles to the next
+  uint8_t tile_shift;  // FB_TILE_SHIFT if tiled, 0 otherwise
+  struct hiz_tile* hiz; // [(rows+HIZ_TILE-1)/HIZ_TILE][hiz_w], top down like the rows in memory, or 0
+  uint32_t hiz_w;
+  const uint8_t* scissor; // If set, only tiles with a nonzero entry get drawn into, see framebuffer_clear_tiles
+  enum shading_rate shading_rate;    // See framebuffer_set_shading_rate
+  const uint8_t* shading_rate_image; // An enum shading_rate per tile, like scissor, or 0
+  struct coarse_fragment* coarse;    // [w] by the first column of the block, or 0 if it was never needed
+  uint32_t coarse_triangle;          // Counts the triangles drawn with coarse shading
+  uint64_t samples_passed; // Pixels which passed the depth test, for occlusion queries
+  bool query_only;     // Only count the samples passing the depth test, don't draw anything
+  bool external_image; // If set, image isn't ours to free
+  bool hugepages;      // Created with FBF_HUGEPAGES, big buffers have to be freed differently
+} Framebuffer;
+
+// If image is 0, it will be allocated
+Framebuffer* framebuffer_create(uint32_t w, uint32_t h, uint8_t (*image)[4]);
+Framebuffer* framebuffer_create_with_flags(uint32_t w, uint32_t h, enum framebuffer_flags flags);
+// A buffer for only some rows of an image. Set fb->y to choose which ones.
+Framebuffer* framebuffer_create_band(uint32_t w, uint32_t h, uint32_t rows);
+void framebuffer_clear(Framebuffer* fb);
+// Clears the tiles with a nonzero entry in tiles[(rows+FB_TILE-1)/FB_TILE][(w+FB_TILE-1)/FB_TILE],
+// in the order the rows are in memory. This works with either layout.
+void framebuffer_clear_tiles(Framebuffer*restrict fb, const uint8_t tiles[restrict]);
+// The depth tiles are on by default. Turning them off only makes sense for comparing the speed.
+// Multisampled framebuffers don't have any.
+bool framebuffer_set_hiz(Framebuffer* fb, bool enable);
+// Coarse shading, for the draws which follow. The fragment shader runs once for each block of
+// pixels of a triangle, instead of for every pixel, and the color goes to all of them. Depth is
+// still interpolated and tested per pixel, and only blocks with a pixel passing it get shaded.
+// Where rate_image is set, its entry for the tile is combined with rate, taking the coarser
+// size in each direction. It has an entry per tile, just like scissor, and has to stay valid
+// while drawing. Shaders which write depth always run per pixel.
+// Returns false if there wasn't enough memory for it.
+bool framebuffer_set_shading_rate(Framebuffer*restrict fb, enum shading_rate rate, const uint8_t rate_image[]);
+// The farthest depth in a tile, with its pixel coordinates as they are in memory
+double framebuffer_hiz_max(Framebuffer*restrict fb, uint32_t tx, uint32_t ty);
+// Converts the target into the image, if there is one. The samples of each pixel get averaged, and
+// tone mapped and dithered if the framebuffer was created with the flags for that.
+void framebuffer_resolve(const Framebuffer* fb);
+// The image row by row, as bitmap_write and the other writers want it. Targets get resolved
+// first. Tiled images get copied into a buffer owned by the framebuffer, which stays valid until
+// the next call or framebuffer_free.
+const uint8_t (*framebuffer_image(const Framebuffer* fb))[4];
+void framebuffer_free(Framebuffer* fb);
+
+// Where the pixel at x, y of the rows in memory is in the image and depth buffers.
+// Row by row, the shift is 0 and this comes down to y * w + x.
+static inline size_t framebuffer_row_offset(const Framebuffer*restrict fb, uint32_t y){
+  const uint32_t mask = (1u << fb->tile_shift) - 1;
+  return (size_t)(y >> fb->tile_shift) * fb->stride + ((y & mask) << fb->tile_shift);
+}
+
+static inline size_t framebuffer_column_offset(const Framebuffer*restrict fb, uint32_t x){
+  const uint32_t mask = (1u << fb->tile_shift) - 1;
+  return (size_t)(x >> fb->tile_shift) << 2*fb->tile_shift | (x & mask);
+}
+
+static inline size_t framebuffer_offset(const Framebuffer*restrict fb, uint32_t x, uint32_t y){
+  return framebuffer_row_offset(fb, y) + framebuffer_column_offset(fb, x);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef DPARASTER_FRAMERING_H
+#define DPARASTER_FRAMERING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// A ring of framebuffers in shared memory, to pass frames to another process without copying them.
+// The consumer creates the ring with framering_create, and passes the fd to the producer. The producer
+// then sets the size of the frames with framering_setup. The state fields are used as futexes.
+
+#define FRAMERING_MAGIC   0x52465044 // "DPFR"
+#define FRAMERING_VERSION 1
+#define FRAMERING_HEADER_SIZE 4096
+#define FRAMERING_MAX_SLOTS 128
+
+enum framering_state {
+  FRS_CREATED, // Waiting for the producer to set up the ring
+  FRS_READY,
+  FRS_CLOSED,  // The producer won't submit any more frames, or the consumer won't take any more
+};
+
+enum framering_slot_state {
+  FRSS_FREE,
+  FRSS_FULL,
+};
+
+struct framering_slot {
+  _Atomic uint32_t state;
+  uint32_t reserved;
+  uint64_t sequence;
+  uint64_t offset; // Of the image data, from the start of the ring
+};
+
+struct framering_header {
+  uint32_t magic;
+  uint32_t version;
+  _Atomic uint32_t state;
+  uint32_t slot_count;
+  uint32_t width;
+  uint32_t height;
+  char format[8];      // "BGRX", rows are bottom up, just like in a bitmap
+  uint64_t stride;
+  uint64_t frame_size;
+  uint64_t size;       // Of the whole ring
+  struct framering_slot slot[FRAMERING_MAX_SLOTS];
+};
+
+_Static_assert(sizeof(struct framering_header) <= FRAMERING_HEADER_SIZE, "framering header too big");
+
+struct framering;
+
+// Consumer side
+struct framering* framering_create(unsigned slot_count);
+int framering_fd(const struct framering* ring);
+// Returns false if the producer closed the ring without ever setting it up, or if alive returned false.
+// alive is polled while waiting, in case the producer died. It may be 0.
+bool framering_wait_setup(struct framering* ring, bool (*alive)(void* param), void* param);
+// Returns 0 once the producer closed the ring and all frames have been consumed
+const uint8_t (*framering_next(struct framering* ring, uint64_t* sequence, bool (*alive)(void* param), void* param))[4];
+void framering_release(struct framering* ring);
+
+// Producer side
+struct framering* framering_open(int fd);
+bool framering_setup(struct framering* ring, uint32_t w, uint32_t h);
+// Blocks until the next slot is free. Returns 0 if the consumer closed the ring, or if alive returned
+// false. alive is polled while waiting, in case the consumer died. It may be 0.
+uint8_t (*framering_acquire(struct framering* ring, bool (*alive)(void* param), void* param))[4];
+void framering_submit(struct framering* ring);
+
+// The consumer and producer may both use these
+void framering_close(struct framering* ring);
+const struct framering_header* framering_header(const struct framering* ring);
+void framering_free(struct framering* ring);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef DPARASTER_GEOMETRY_H
 #define DPARASTER_GEOMETRY_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <dparaster/math.h>
 
 enum e_attribute_in {
@@ -10,17 +12,86 @@ enum e_attribute_in {
   AIN_COUNT,
 };
 
+// Vertices can be stored in smaller formats, they're converted to a Vector when fetched.
+// Missing components are 0, except for w, which is 1.
+enum attribute_format {
+  AF_VECTOR, // Same as AF_FLOAT32X4
+  AF_FLOAT32X2,
+  AF_FLOAT32X3,
+  AF_FLOAT32X4,
+  AF_FLOAT16X4,
+  AF_UNORM8X4,  // 0..255 maps to 0..1
+  AF_SNORM16X4, // -32767..32767 maps to -1..1
+  AF_COUNT
+};
+
+enum index_type {
+  IT_U32,
+  IT_U16,
+};
+
 typedef struct Attribute {
-  const Vector *vertex;
+  union {
+    const Vector *vertex;
+    const void *data; // For formats other than AF_VECTOR
+  };
   Vector vertex_default; // If vertex is not set, this will be the default for all vertices
-  const unsigned (*index)[3];
+  union {
+    const unsigned (*index)[3];
+    const uint16_t (*index16)[3];
+  };
+  enum attribute_format format;
+  enum index_type index_type;
 } Attribute;
 
+// Bytes per vertex of a format
+static inline unsigned attribute_format_size(enum attribute_format format){
+  switch(format){
+    case AF_VECTOR   : return sizeof(Vector);
+    case AF_FLOAT32X2: return 8;
+    case AF_FLOAT32X3: return 12;
+    case AF_FLOAT32X4: return 16;
+    case AF_FLOAT16X4: return 8;
+    case AF_UNORM8X4 : return 4;
+    case AF_SNORM16X4: return 8;
+    case AF_COUNT: break;
+  }
+  return 0;
+}
+
+// A small cluster of neighbouring triangles, which come one after another in the geometry.
+// Meshlets outside of the view, or with all triangles facing away, are skipped before any of
+// their vertices get processed. They're also the unit of work for processing vertices in parallel.
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct meshlet {
+  unsigned first, count; // Of the triangles
+  Vector center;         // Of the sphere around the positions
+  float radius;
+  Vector cone_axis;      // The normals of all triangles are less than a cone angle from it
+  float cone_cutoff;     // The sine of the cone angle, more than 1 if the triangles face too many ways
+};
+
 typedef struct Geometry {
   Attribute attribute[AIN_COUNT];
   unsigned triangle_count;
+  const struct meshlet* meshlet; // Optional, they need to cover all triangles, in order
+  unsigned meshlet_count;
+  bool cull_back_faces; // Don't draw triangles facing away. They face the view if they are clockwise on screen.
 } Geometry;
 
+void attribute_pack(enum attribute_format format, void*restrict out, Vector v);
+Vector attribute_vertex(const Attribute*restrict attribute, unsigned index);
+// The vertices of a triangle
+void attribute_fetch(const Attribute*restrict attribute, unsigned triangle, Vector out[restrict 3]);
+// The axis aligned box around the positions of all triangles, min and max
+void geometry_bounds(const Geometry*restrict geometry, Vector bounds[restrict 2]);
+// Groups the triangles into meshlets, in the order they are in, so they should already be ordered
+// for locality, e.g. by mesh_optimize_vertex_cache. Returns an array of count meshlets, or 0.
+// It has to be freed with dparaster_free.
+struct meshlet* geometry_build_meshlets(const Geometry*restrict geometry, unsigned*restrict count);
+
 static inline Geometry geometry_with_flat_color(const Geometry* pg, Vector color){
   Geometry g = *pg;
   g.attribute[AIN_COLOR] = (Attribute){ .vertex_default = color };
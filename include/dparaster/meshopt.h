@@ -0,0 +1,38 @@
+#ifndef DPARASTER_MESHOPT_H
+#define DPARASTER_MESHOPT_H
+
+#include <stdbool.h>
+#include <dparaster/geometry.h>
+
+// A geometry with one index for all attributes, which is what the optimizations need.
+// Attributes without vertices use their default.
+typedef struct Mesh {
+  Vector* vertex[AIN_COUNT];
+  Vector vertex_default[AIN_COUNT];
+  unsigned (*index)[3];
+  unsigned vertex_count;
+  unsigned triangle_count;
+} Mesh;
+
+// Merges the corners with the same values in all attributes into one vertex
+bool mesh_weld(Mesh*restrict mesh, const Geometry*restrict geometry);
+void mesh_free(Mesh* mesh);
+// The mesh as a geometry, it stays owned by the mesh
+Geometry mesh_geometry(const Mesh* mesh);
+
+// Average number of vertices missing in a FIFO cache of the given size, per triangle.
+// 0.5 is the best possible for big meshes, 3 the worst.
+double mesh_acmr(const Mesh* mesh, unsigned cache_size);
+
+// Orders triangles to reuse recently used vertices (Forsyth's linear-speed vertex cache optimization)
+bool mesh_optimize_vertex_cache(Mesh* mesh);
+// Splits the triangles into clusters where the vertex cache order starts over, and draws the clusters
+// facing outwards first, so fewer pixels get drawn over. Should be done after mesh_optimize_vertex_cache.
+// Smaller clusters can be sorted better, but cost vertex reuse. The threshold is by how much
+// the ACMR of a cluster may be worse than the one of the mesh, 1.05 is a good start.
+// Returns the number of clusters, or 0 on error.
+unsigned mesh_optimize_overdraw(Mesh* mesh, double threshold);
+// Numbers the vertices in the order they are used, so they get fetched from memory in order
+bool mesh_optimize_vertex_fetch(Mesh* mesh);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DPARASTER_QOI_H
+#define DPARASTER_QOI_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The "Quite OK Image" format. Much smaller than a bitmap for rendered frames, and fast to encode.
+// Loading QOI textures is handled by a texture loader.
+
+#define QOI_HEADER_SIZE 14
+
+// Takes the same bottom up BGRX image as bitmap_write, and writes it as a 3 channel QOI image
+bool qoi_write(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+);
+
+bool qoi_save(
+  const char*restrict file,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+);
+
+#endif
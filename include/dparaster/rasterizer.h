@@ -2,27 +2,66 @@
 #define DPARASTER_RASTERIZER_H
 
 #include <dparaster/shader.h>
+#include <dparaster/framebuffer.h>
 #include <stdint.h>
+#include <stdbool.h>
 
+// Only the rows held by the framebuffer are drawn. Parts with z<-1 are cut off, things with z>1 are drawn.
 void draw_triangle(
-  const uint32_t w,
-  const uint32_t h,
-  uint8_t image[restrict h][w][4],
-  double depth_plane[restrict h][w],
+  Framebuffer*const restrict fb,
   const ShaderProgram*const restrict shader,
   const Uniform*const restrict uniform,
   Triangle triangle[]
 );
 
+// Runs the triangle and vertex shader for a triangle of the geometry.
+// The result has shader->attribute_count entries, and can be passed to draw_triangle.
+void process_triangle(
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  unsigned index,
+  Triangle triangle_out[restrict]
+);
+
 // Draw the geometry
 void draw(
-  const uint32_t w,
-  const uint32_t h,
-  uint8_t image[h][w][4],
-  double depth[h][w],
+  Framebuffer*const restrict fb,
   const ShaderProgram*const restrict shader,
   const Uniform*const restrict uniform,
   const Geometry*const restrict geometry
 );
 
+// Like draw, but the vertices are processed by that many threads, one meshlet at a time,
+// or a few hundred triangles if the geometry has no meshlets.
+void draw_threaded(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  unsigned threads
+);
+
+// Whether any triangle of the meshlet may be seen. Like for the scene, shaders are expected to transform
+// the positions by the modelview matrix, and things up to margin (1/w) left or right of the view are kept.
+bool meshlet_visible(const struct meshlet*restrict meshlet, const Matrix*restrict modelview, float margin, bool cull_back_faces);
+// Whether a triangle from process_triangle faces away
+bool triangle_facing_away(const Triangle*restrict position);
+
+// Occlusion queries count the pixels passing the depth test between begin_query and end_query.
+// They can't be nested.
+void begin_query(Framebuffer* fb);
+uint64_t end_query(Framebuffer* fb);
+
+// Draws the geometry only if some of the proxy geometry passes the depth test. The proxy should
+// enclose the geometry, like a box around it. It's only tested, nothing of it gets drawn.
+// Returns whether the geometry was drawn.
+bool draw_conditional(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  const Geometry*const restrict proxy
+);
+
 #endif
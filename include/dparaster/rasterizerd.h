@@ -0,0 +1,46 @@
+#ifndef DPARASTER_RASTERIZERD_H
+#define DPARASTER_RASTERIZERD_H
+
+#include <stdint.h>
+
+// The protocol spoken by rasterizerd over its unix socket. A client sends a request, and gets
+// a reply. The frame data is either passed as a memfd using SCM_RIGHTS along with the reply,
+// or follows the reply on the socket, if RDR_INLINE was requested or fd passing failed.
+// A connection can be used for any number of requests.
+
+#define RASTERIZERD_SOCKET "/tmp/dparaster-rasterizerd.sock"
+#define RASTERIZERD_MAGIC 0x44525044 // "DPRD"
+
+enum rasterizerd_format {
+  RDF_BMP, // A whole bitmap
+  RDF_RAW, // Just the image data of the bitmap
+};
+
+enum rasterizerd_request_flags {
+  RDR_INLINE = 1<<0,
+};
+
+struct rasterizerd_request {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t format;
+  uint32_t w, h;
+  double ry, rx;
+};
+
+enum rasterizerd_status {
+  RDS_OK,
+  RDS_BAD_REQUEST,
+  RDS_FAILED,
+};
+
+struct rasterizerd_reply {
+  uint32_t magic;
+  uint32_t status;
+  uint32_t format;
+  uint32_t w, h;
+  uint32_t has_fd;
+  uint64_t size;
+};
+
+#endif
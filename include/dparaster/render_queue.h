@@ -0,0 +1,35 @@
+#ifndef DPARASTER_RENDER_QUEUE_H
+#define DPARASTER_RENDER_QUEUE_H
+
+#include <dparaster/framebuffer.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Frames are numbered in submission order, starting at 0. A fence is just the number of a frame,
+// it is signaled once that frame has been passed to the output callback.
+typedef uint64_t render_fence;
+
+typedef void render_queue__render(void* param, Framebuffer* fb, render_fence frame); // Called on a worker thread, fb is already cleared
+typedef bool render_queue__output(void* param, const Framebuffer* fb, render_fence frame); // Called on the writer thread, in submission order
+typedef void render_queue__done(void* param, render_fence frame, bool ok); // Called on the writer thread after the frame was output
+
+struct render_queue_config {
+  uint32_t w, h;
+  unsigned workers; // Number of render threads, frames are rendered concurrently if there is more than one
+  unsigned buffers; // Number of framebuffers, 2 for double buffering, 3 for triple buffering, and so on.
+                    // This also limits how far rendering may run ahead of the next frame to be written.
+  enum framebuffer_flags framebuffer_flags;
+  render_queue__output* output;
+  void* output_param;
+};
+
+struct render_queue* render_queue_create(const struct render_queue_config* config);
+// Blocks if there are already 2*buffers or more frames waiting to be written
+render_fence render_queue_submit(struct render_queue* queue, render_queue__render* render, render_queue__done* done, void* param);
+// Returns false if the output of any frame so far failed
+bool render_queue_wait(struct render_queue* queue, render_fence fence);
+bool render_queue_finish(struct render_queue* queue);
+// Waits for all submitted frames
+void render_queue_destroy(struct render_queue* queue);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef DPARASTER_SCENE_H
+#define DPARASTER_SCENE_H
+
+#include <stdbool.h>
+#include <dparaster/shader.h>
+#include <dparaster/framebuffer.h>
+
+// A set of objects, each a geometry placed in the world with a transform. The objects are kept in
+// a bounding volume hierarchy, so the ones outside the view can be skipped without looking at each.
+//
+// The view volume is what draw_triangle draws: -1 <= x,y <= 1 and z >= -1 after the modelview
+// matrix of the uniform, which is the world to view transform. The transforms of the objects
+// have to be affine, and shaders are expected to transform positions by the modelview matrix.
+struct scene;
+
+struct scene_stats {
+  unsigned objects;
+  unsigned visible;
+  unsigned culled;
+  unsigned nodes_visited;
+  unsigned long long triangles; // Of the visible objects
+};
+
+struct scene* scene_create(void);
+void scene_free(struct scene* scene);
+// The geometry must stay valid while it's in the scene. Returns the index of the object, or -1.
+int scene_add(struct scene*restrict scene, const Geometry*restrict geometry, Matrix transform);
+// Moving objects only refits the hierarchy, adding objects rebuilds it
+void scene_set_transform(struct scene* scene, int object, Matrix transform);
+const Geometry* scene_get_geometry(const struct scene* scene, int object);
+Matrix scene_get_transform(const struct scene* scene, int object);
+
+// Happen on their own when the scene is culled, but can be done beforehand
+bool scene_build(struct scene* scene);
+void scene_refit(struct scene* scene);
+
+// Writes the objects intersecting the view volume to visible, which needs room for all objects.
+// draw_triangle still draws things less than 1/w right of the view into the last column, the margin should be that.
+// Returns their count, or -1 if the hierarchy couldn't be built. stats may be 0.
+int scene_cull(struct scene*restrict scene, Matrix view, float margin, int visible[restrict], struct scene_stats*restrict stats);
+
+// Draws every visible object in the order they were added, with the modelview of the uniform as the view
+bool scene_draw(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  struct scene*const restrict scene,
+  struct scene_stats*restrict stats
+);
+
+#endif
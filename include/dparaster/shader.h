@@ -1,20 +1,28 @@
 #ifndef DPARASTER_SHADER_H
 #define DPARASTER_SHADER_H
 
+#include <stdbool.h>
 #include <dparaster/geometry.h>
 
 typedef struct Uniform {
   Matrix modelview;
   Vector light;
   const struct texture* tex;
+  struct texture_future* tex_future; // If tex isn't set, draw waits for this one, once it needs it
+  float layer; // Added to the texture layer of each vertex, which is the z of its texture coordinate
 } Uniform;
 
+// The most attributes a shader can have. The varyings of the triangles being drawn are kept on the
+// stack, with room for this many.
+#define SHADER_MAX_ATTRIBUTES 16
+
 typedef void shader_triangle(const Uniform*restrict uniform, Triangle out[restrict], const Triangle in[restrict AIN_COUNT]); // Not something found in regular pipelines, but useful for per-triangle stuff
 typedef void shader_vertex(const Uniform*restrict uniform, Vector out[], const Vector in[AIN_COUNT]);
 typedef Vector shader_fragment(const Uniform*restrict uniform, double*restrict depth, Vector varying[restrict]);
 
 typedef struct ShaderProgram {
-  unsigned attribute_count;
+  unsigned attribute_count; // At most SHADER_MAX_ATTRIBUTES
+  bool writes_depth; // The fragment shader changes the depth, so it's not known before it ran
   shader_triangle* triangle;
   shader_vertex*   vertex;
   shader_fragment* fragment;
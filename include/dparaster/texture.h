@@ -6,16 +6,36 @@
 #include <stdbool.h>
 #include <dparaster/math.h>
 
+// A smaller version of the texture, a mip level
+struct texture_level {
+  size_t size[3];
+  size_t stride[3];
+  const void* img;
+};
+
+// Compressed textures consist of 4x4 texel blocks, stored row by row without padding, the strides are
+// unused. Their format is always RGBA, which is what a block decodes to.
+enum texture_compression {
+  TC_NONE,
+  TC_BC1, // 8 byte blocks, two RGB565 colors and 2 bit indices, 1 bit alpha
+  TC_BC3, // 16 byte blocks, 8 bit alpha endpoints and 3 bit indices, followed by a BC1 color block
+};
+
 struct texture {
   const struct texture_loader* impl;
+  struct texture_cache_entry* cache_entry; // Set if the texture belongs to a texture_cache
   char format[5]; // RGBAX
+  enum texture_compression compression;
   size_t file_length;
   const void* file_content;
   uint8_t dimension_count;
   size_t size[3];
   size_t stride[3];
   bool flip[3];
+  bool layered; // The last dimension selects a layer. It's addressed by index, and always clamped.
   const void* img;
+  uint8_t level_count; // Mip levels after the base level described above. The loader owns the level array.
+  const struct texture_level* level;
 };
 
 enum texture_lookup_mode {
@@ -23,9 +43,46 @@ enum texture_lookup_mode {
   TL_CLAMP,
 };
 
+enum texture_load_flags {
+  TLF_POPULATE  = 1<<0, // Read the whole file while loading, instead of faulting it in while drawing
+  TLF_HUGEPAGES = 1<<1, // Copy big textures used in place into transparent huge pages, for fewer TLB misses
+};
+
 struct texture* texture_load(const char* texture);
+struct texture* texture_load_with_flags(const char* texture, enum texture_load_flags flags);
+// From a file opened for reading, which can be closed afterwards
+struct texture* texture_load_fd(int fd, enum texture_load_flags flags);
 void texture_free(struct texture* texture);
 
+// Textures can be loaded by a loader thread, while the caller does other things.
+// A Uniform can take the future instead of the texture, draw then waits for it when it's needed.
+struct texture_future;
+struct texture_future* texture_load_async(const char* texture, enum texture_load_flags flags);
+bool texture_future_ready(struct texture_future* future);
+// Returns the texture, or 0 if it couldn't be loaded. The texture belongs to the future.
+struct texture* texture_future_wait(struct texture_future* future);
+// Waits for the texture, and frees it along with the future
+void texture_future_free(struct texture_future* future);
+
+// Level 0 is the base level, the others are the mip levels
+struct texture_level texture_get_level(const struct texture* texture, unsigned level);
+size_t texture_level_data_size(const struct texture* texture, unsigned level);
+
+// Textures are shared by everyone acquiring the same unchanged file, and are freed once they have been
+// released by everyone and the cache needs the room. Only the memory of unused textures counts towards
+// the budget. The memory of a texture is its decoded image, or the file, if the image was used in place.
+#define TEXTURE_CACHE_UNLIMITED ((size_t)-1)
+struct texture_cache;
+struct texture_cache* texture_cache_create(size_t budget);
+const struct texture* texture_cache_acquire(struct texture_cache* cache, const char* file);
+void texture_cache_release(struct texture_cache* cache, const struct texture* texture);
+// All textures need to have been released already
+void texture_cache_free(struct texture_cache* cache);
+
+size_t texture_block_size(enum texture_compression compression);
+void texture_block_decode(enum texture_compression compression, const uint8_t* block, uint8_t texel[16][4]);
+void texture_block_encode(enum texture_compression compression, const uint8_t texel[16][4], uint8_t* block);
+
 void texture_texel_get_raw(const struct texture* texture, uint16_t result[], long long coord[], enum texture_lookup_mode tlm[]);
 Vector texture_texel_get(const struct texture* texture, long long coord[], enum texture_lookup_mode tlm[]);
 Vector texture_lookup(const struct texture* texture, float coord[], enum texture_lookup_mode tlm[]);
@@ -42,18 +99,20 @@ struct texture_loader {
 };
 void texture_loader_register(struct texture_loader* impl);
 
-#define IMPLEMENT_TEXTURE_LOADER \
-  __attribute__((weak)) texture_loader__can_handle tl_can_handle; \
-  texture_loader__load tl_load; \
-  __attribute__((weak)) texture_loader__free tl_free; \
-  static struct texture_loader tl_texture_loader = { \
-    .can_handle = tl_can_handle, \
-    .load = tl_load, \
-    .free = tl_free, \
+// For libraries with more than one loader, the functions of each need a different prefix
+#define IMPLEMENT_TEXTURE_LOADER IMPLEMENT_TEXTURE_LOADER_NAMED(tl)
+#define IMPLEMENT_TEXTURE_LOADER_NAMED(P) \
+  __attribute__((weak)) texture_loader__can_handle P ## _can_handle; \
+  texture_loader__load P ## _load; \
+  __attribute__((weak)) texture_loader__free P ## _free; \
+  static struct texture_loader P ## _texture_loader = { \
+    .can_handle = P ## _can_handle, \
+    .load = P ## _load, \
+    .free = P ## _free, \
   }; \
   __attribute__((constructor,used)) \
-  static void tl_texture_loader_register(void){ \
-    texture_loader_register(&tl_texture_loader); \
+  static void P ## _texture_loader_register(void){ \
+    texture_loader_register(&P ## _texture_loader); \
   }
 
 #endif
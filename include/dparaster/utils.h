@@ -1,12 +1,62 @@
 #ifndef DPARASTER_UTILS_H
 #define DPARASTER_UTILS_H
 
+#include <stdint.h>
+#include <string.h>
+
 static inline uint32_t u16le(const uint8_t x[2]){
   return (uint32_t)x[0] | x[1]<<8;
 }
 
 static inline uint32_t u32le(const uint8_t x[4]){
-  return (uint32_t)x[0] | x[1]<<8 | x[2]<<16 | x[3]<<24;
+  return (uint32_t)x[0] | x[1]<<8 | x[2]<<16 | (uint32_t)x[3]<<24;
+}
+
+static inline uint64_t u64le(const uint8_t x[8]){
+  return u32le(x) | (uint64_t)u32le(x+4)<<32;
+}
+
+static inline float half_to_float(uint16_t h){
+  // Shifted into place, the exponent is 112 too small, which a multiplication fixes,
+  // for subnormals too. Only infinity and NaN need their exponent set.
+  uint32_t bits = (uint32_t)(h & 0x7FFF) << 13;
+  if((h & 0x7C00) == 0x7C00)
+    bits |= 0x7F800000;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  if((h & 0x7C00) != 0x7C00)
+    f *= 0x1p112f;
+  return h & 0x8000 ? -f : f;
+}
+
+static inline uint16_t float_to_half(float f){
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  const uint16_t sign = bits >> 16 & 0x8000;
+  const uint32_t exponent = bits >> 23 & 0xFF;
+  uint32_t mantissa = bits & 0x7FFFFF;
+  if(exponent == 0xFF)
+    return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+  const int e = (int)exponent - 112;
+  if(e >= 0x1F)
+    return sign | 0x7C00;
+  if(e <= 0){ // Subnormal, or too small
+    if(e < -10)
+      return sign;
+    mantissa |= 0x800000;
+    const unsigned shift = 14 - e;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t mid = 1u << (shift - 1);
+    if(rest > mid || (rest == mid && half & 1))
+      half++;
+    return sign | half;
+  }
+  uint32_t half = (uint32_t)e << 10 | mantissa >> 13;
+  const uint32_t rest = mantissa & 0x1FFF;
+  if(rest > 0x1000 || (rest == 0x1000 && half & 1))
+    half++; // May carry into the exponent, which is right
+  return sign | half;
 }
 
 #endif
@@ -0,0 +1,287 @@
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+// In front of every allocation, so it can be freed without knowing where it came from
+struct allocation {
+  const struct dparaster_allocator* allocator;
+  void* block; // What the allocator returned, the allocation may start later because of alignment
+  size_t block_size;
+  size_t size;
+  enum dparaster_memory_category category;
+};
+
+#define MIN_ALIGNMENT alignof(max_align_t)
+#define HEADER_SIZE ((sizeof(struct allocation) + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1))
+
+static void* system_alloc(void* user, size_t size){
+  (void)user;
+  return malloc(size);
+}
+
+static void* system_realloc(void* user, void* memory, size_t old_size, size_t size){
+  (void)user, (void)old_size;
+  return realloc(memory, size);
+}
+
+static void system_free(void* user, void* memory, size_t size){
+  (void)user, (void)size;
+  free(memory);
+}
+
+static const struct dparaster_allocator system_allocator = {
+  .alloc = system_alloc,
+  .realloc = system_realloc,
+  .free = system_free,
+};
+
+static struct {
+  _Atomic(const struct dparaster_allocator*) allocator;
+  atomic_size_t limit;
+  atomic_size_t current, peak;
+  atomic_ullong allocations, failed;
+} category_state[DPM_COUNT];
+
+static atomic_size_t total, total_peak;
+
+void dparaster_set_allocator(enum dparaster_memory_category category, const struct dparaster_allocator* allocator){
+  atomic_store(&category_state[category].allocator, allocator);
+}
+
+void dparaster_set_memory_limit(enum dparaster_memory_category category, size_t limit){
+  atomic_store(&category_state[category].limit, limit);
+}
+
+static void raise_peak(atomic_size_t* peak, size_t usage){
+  size_t p = atomic_load_explicit(peak, memory_order_relaxed);
+  while(usage > p && !atomic_compare_exchange_weak_explicit(peak, &p, usage, memory_order_relaxed, memory_order_relaxed));
+}
+
+static bool account(enum dparaster_memory_category category, size_t size){
+  const size_t limit = atomic_load_explicit(&category_state[category].limit, memory_order_relaxed);
+  atomic_size_t* current = &category_state[category].current;
+  size_t usage = atomic_load_explicit(current, memory_order_relaxed);
+  do{
+    if(limit && (usage > limit || size > limit - usage)){
+      atomic_fetch_add_explicit(&category_state[category].failed, 1, memory_order_relaxed);
+      return false;
+    }
+  }while(!atomic_compare_exchange_weak_explicit(current, &usage, usage + size, memory_order_relaxed, memory_order_relaxed));
+  raise_peak(&category_state[category].peak, usage + size);
+  raise_peak(&total_peak, atomic_fetch_add_explicit(&total, size, memory_order_relaxed) + size);
+  return true;
+}
+
+static void unaccount(enum dparaster_memory_category category, size_t size){
+  atomic_fetch_sub_explicit(&category_state[category].current, size, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&total, size, memory_order_relaxed);
+}
+
+static void count(enum dparaster_memory_category category, bool ok){
+  if(ok)
+    atomic_fetch_add_explicit(&category_state[category].allocations, 1, memory_order_relaxed);
+  else
+    atomic_fetch_add_explicit(&category_state[category].failed, 1, memory_order_relaxed);
+}
+
+bool dparaster_account(const void* memory, size_t size, enum dparaster_memory_category category){
+  if(!memory){
+    count(category, false);
+    return false;
+  }
+  if(!account(category, size))
+    return false;
+  count(category, true);
+  return true;
+}
+
+void dparaster_unaccount(size_t size, enum dparaster_memory_category category){
+  unaccount(category, size);
+}
+
+void dparaster_memory_stats(struct dparaster_memory_stats* stats){
+  *stats = (struct dparaster_memory_stats){
+    .total = atomic_load(&total),
+    .total_peak = atomic_load(&total_peak),
+  };
+  for(unsigned i=0; i<DPM_COUNT; i++){
+    stats->current[i] = atomic_load(&category_state[i].current);
+    stats->peak[i] = atomic_load(&category_state[i].peak);
+    stats->allocations[i] = atomic_load(&category_state[i].allocations);
+    stats->failed[i] = atomic_load(&category_state[i].failed);
+  }
+}
+
+void dparaster_memory_reset_peak(void){
+  for(unsigned i=0; i<DPM_COUNT; i++)
+    atomic_store(&category_state[i].peak, atomic_load(&category_state[i].current));
+  atomic_store(&total_peak, atomic_load(&total));
+}
+
+static inline struct allocation* header(void* memory){
+  return (struct allocation*)((uint8_t*)memory - sizeof(struct allocation));
+}
+
+static inline const struct dparaster_allocator* allocator_of(enum dparaster_memory_category category){
+  const struct dparaster_allocator* allocator = atomic_load_explicit(&category_state[category].allocator, memory_order_acquire);
+  return allocator ? allocator : &system_allocator;
+}
+
+void* dparaster_aligned_alloc(size_t alignment, size_t size, enum dparaster_memory_category category){
+  if(alignment < MIN_ALIGNMENT)
+    alignment = MIN_ALIGNMENT;
+  if(size > SIZE_MAX - HEADER_SIZE - alignment)
+    goto error;
+  if(!account(category, size))
+    goto error;
+  const struct dparaster_allocator* allocator = allocator_of(category);
+  const size_t block_size = HEADER_SIZE + size + (alignment - MIN_ALIGNMENT);
+  uint8_t* block = allocator->alloc(allocator->user, block_size);
+  if(!block)
+    goto error_after_account;
+  uint8_t* memory = (uint8_t*)(((uintptr_t)block + HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  *header(memory) = (struct allocation){
+    .allocator = allocator,
+    .block = block,
+    .block_size = block_size,
+    .size = size,
+    .category = category,
+  };
+  count(category, true);
+  return memory;
+error_after_account:
+  unaccount(category, size);
+  count(category, false);
+error:
+  return 0;
+}
+
+void* dparaster_alloc(size_t size, enum dparaster_memory_category category){
+  return dparaster_aligned_alloc(MIN_ALIGNMENT, size, category);
+}
+
+void* dparaster_calloc(size_t count, size_t size, enum dparaster_memory_category category){
+  if(size && count > SIZE_MAX / size)
+    return 0;
+  void* memory = dparaster_alloc(count * size, category);
+  if(memory)
+    memset(memory, 0, count * size);
+  return memory;
+}
+
+void* dparaster_realloc(void* memory, size_t size, enum dparaster_memory_category category){
+  if(!memory)
+    return dparaster_alloc(size, category);
+  const struct allocation old = *header(memory);
+  // Blocks with the allocation right after the header can be resized by the allocator
+  if(old.allocator->realloc && (uint8_t*)memory == (uint8_t*)old.block + HEADER_SIZE){
+    if(size > SIZE_MAX - HEADER_SIZE)
+      return 0;
+    // Only the growth has to fit under the limit, the old size is still accounted for
+    if(size > old.size && !account(old.category, size - old.size))
+      return 0;
+    uint8_t* block = old.allocator->realloc(old.allocator->user, old.block, old.block_size, HEADER_SIZE + size);
+    if(!block){
+      if(size > old.size)
+        unaccount(old.category, size - old.size);
+      count(old.category, false);
+      return 0;
+    }
+    if(size < old.size)
+      unaccount(old.category, old.size - size);
+    count(old.category, true);
+    memory = block + HEADER_SIZE;
+    *header(memory) = (struct allocation){
+      .allocator = old.allocator,
+      .block = block,
+      .block_size = HEADER_SIZE + size,
+      .size = size,
+      .category = old.category,
+    };
+    return memory;
+  }
+  void* result = dparaster_alloc(size, old.category);
+  if(!result)
+    return 0;
+  memcpy(result, memory, old.size < size ? old.size : size);
+  dparaster_free(memory);
+  return result;
+}
+
+char* dparaster_strdup(const char* string, enum dparaster_memory_category category){
+  const size_t size = strlen(string) + 1;
+  char* copy = dparaster_alloc(size, category);
+  if(copy)
+    memcpy(copy, string, size);
+  return copy;
+}
+
+void dparaster_free(void* memory){
+  if(!memory)
+    return;
+  const struct allocation a = *header(memory);
+  unaccount(a.category, a.size);
+  a.allocator->free(a.allocator->user, a.block, a.block_size);
+}
+
+struct dparaster_arena {
+  struct dparaster_allocator allocator;
+  uint8_t* base;
+  size_t capacity;
+  atomic_size_t used;
+};
+
+static void* arena_alloc(void* user, size_t size){
+  struct dparaster_arena* arena = user;
+  size = (size + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1);
+  const size_t offset = atomic_fetch_add_explicit(&arena->used, size, memory_order_relaxed);
+  if(offset <= arena->capacity && size <= arena->capacity - offset)
+    return arena->base + offset;
+  return malloc(size);
+}
+
+static void arena_free(void* user, void* memory, size_t size){
+  (void)size;
+  struct dparaster_arena* arena = user;
+  if((uint8_t*)memory < arena->base || (uint8_t*)memory >= arena->base + arena->capacity)
+    free(memory);
+}
+
+struct dparaster_arena* dparaster_arena_create(size_t capacity){
+  struct dparaster_arena* arena = malloc(sizeof(*arena));
+  if(!arena)
+    goto error;
+  capacity = (capacity + MIN_ALIGNMENT - 1) & ~(MIN_ALIGNMENT - 1);
+  *arena = (struct dparaster_arena){
+    .allocator = {
+      .alloc = arena_alloc,
+      .free = arena_free,
+      .user = arena,
+    },
+    .base = malloc(capacity ? capacity : 1),
+    .capacity = capacity,
+  };
+  if(!arena->base)
+    goto error_after_alloc;
+  return arena;
+error_after_alloc:
+  free(arena);
+error:
+  return 0;
+}
+
+const struct dparaster_allocator* dparaster_arena_allocator(struct dparaster_arena* arena){
+  return &arena->allocator;
+}
+
+size_t dparaster_arena_reset(struct dparaster_arena* arena){
+  return atomic_exchange(&arena->used, 0);
+}
+
+void dparaster_arena_free(struct dparaster_arena* arena){
+  free(arena->base);
+  free(arena);
+}
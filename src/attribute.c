@@ -0,0 +1,128 @@
+#include <dparaster/geometry.h>
+#include <dparaster/utils.h>
+#include <string.h>
+
+static inline Vector unpack(enum attribute_format format, const void*restrict data, unsigned index){
+  switch(format){
+    case AF_VECTOR: return ((const Vector*)data)[index];
+    case AF_FLOAT32X2: {
+      const float*restrict v = (const float*)data + index*2;
+      return (Vector){{ v[0], v[1], 0, 1 }};
+    }
+    case AF_FLOAT32X3: {
+      const float*restrict v = (const float*)data + index*3;
+      return (Vector){{ v[0], v[1], v[2], 1 }};
+    }
+    case AF_FLOAT32X4: {
+      const float*restrict v = (const float*)data + index*4;
+      return (Vector){{ v[0], v[1], v[2], v[3] }};
+    }
+    case AF_FLOAT16X4: {
+      const uint16_t*restrict v = (const uint16_t*)data + index*4;
+      return (Vector){{ half_to_float(v[0]), half_to_float(v[1]), half_to_float(v[2]), half_to_float(v[3]) }};
+    }
+    case AF_UNORM8X4: {
+      const uint8_t*restrict v = (const uint8_t*)data + index*4;
+      return (Vector){{ v[0] * (1.f/255), v[1] * (1.f/255), v[2] * (1.f/255), v[3] * (1.f/255) }};
+    }
+    case AF_SNORM16X4: {
+      const int16_t*restrict v = (const int16_t*)data + index*4;
+      return (Vector){{
+        fmaxf(v[0] * (1.f/32767), -1), fmaxf(v[1] * (1.f/32767), -1),
+        fmaxf(v[2] * (1.f/32767), -1), fmaxf(v[3] * (1.f/32767), -1),
+      }};
+    }
+    case AF_COUNT: break;
+  }
+  return (Vector){{0,0,0,1}};
+}
+
+static inline float clampf(float x, float min, float max){
+  return x < min ? min : x > max ? max : x;
+}
+
+void attribute_pack(enum attribute_format format, void*restrict out, Vector v){
+  switch(format){
+    case AF_VECTOR: memcpy(out, &v, sizeof(v)); break;
+    case AF_FLOAT32X2: memcpy(out, v.data,  8); break;
+    case AF_FLOAT32X3: memcpy(out, v.data, 12); break;
+    case AF_FLOAT32X4: memcpy(out, v.data, 16); break;
+    case AF_FLOAT16X4: {
+      uint16_t*restrict o = out;
+      for(unsigned i=0; i<4; i++)
+        o[i] = float_to_half(v.data[i]);
+    } break;
+    case AF_UNORM8X4: {
+      uint8_t*restrict o = out;
+      for(unsigned i=0; i<4; i++)
+        o[i] = lroundf(clampf(v.data[i], 0, 1) * 255);
+    } break;
+    case AF_SNORM16X4: {
+      int16_t*restrict o = out;
+      for(unsigned i=0; i<4; i++)
+        o[i] = lroundf(clampf(v.data[i], -1, 1) * 32767);
+    } break;
+    case AF_COUNT: break;
+  }
+}
+
+Vector attribute_vertex(const Attribute*restrict attribute, unsigned index){
+  if(!attribute->data)
+    return attribute->vertex_default;
+  return unpack(attribute->format, attribute->data, index);
+}
+
+// Every format gets its own loop, so the switch isn't done for every vertex
+#define FETCH(F) \
+  for(unsigned k=0; k<3; k++) \
+    out[k] = unpack(F, attribute->data, index[k]);
+
+void attribute_fetch(const Attribute*restrict attribute, unsigned triangle, Vector out[restrict 3]){
+  if(!attribute->data){
+    for(unsigned k=0; k<3; k++)
+      out[k] = attribute->vertex_default;
+    return;
+  }
+  unsigned index[3];
+  if(!attribute->index){
+    for(unsigned k=0; k<3; k++)
+      index[k] = triangle*3 + k;
+  }else if(attribute->index_type == IT_U16){
+    for(unsigned k=0; k<3; k++)
+      index[k] = attribute->index16[triangle][k];
+  }else{
+    for(unsigned k=0; k<3; k++)
+      index[k] = attribute->index[triangle][k];
+  }
+  switch(attribute->format){
+    case AF_VECTOR   : FETCH(AF_VECTOR   ) break;
+    case AF_FLOAT32X2: FETCH(AF_FLOAT32X2) break;
+    case AF_FLOAT32X3: FETCH(AF_FLOAT32X3) break;
+    case AF_FLOAT32X4: FETCH(AF_FLOAT32X4) break;
+    case AF_FLOAT16X4: FETCH(AF_FLOAT16X4) break;
+    case AF_UNORM8X4 : FETCH(AF_UNORM8X4 ) break;
+    case AF_SNORM16X4: FETCH(AF_SNORM16X4) break;
+    case AF_COUNT: break;
+  }
+}
+#undef FETCH
+
+void geometry_bounds(const Geometry*restrict geometry, Vector bounds[restrict 2]){
+  const Attribute*restrict position = &geometry->attribute[AIN_POSITION];
+  if(!geometry->triangle_count || !position->data){
+    bounds[0] = bounds[1] = position->vertex_default;
+    return;
+  }
+  bounds[0] = (Vector){{ INFINITY, INFINITY, INFINITY, 1 }};
+  bounds[1] = (Vector){{ -INFINITY, -INFINITY, -INFINITY, 1 }};
+  for(unsigned t=0; t<geometry->triangle_count; t++){
+    Vector v[3];
+    attribute_fetch(position, t, v);
+    for(unsigned k=0; k<3; k++){
+      for(unsigned i=0; i<3; i++){
+        if(v[k].data[i] < bounds[0].data[i]) bounds[0].data[i] = v[k].data[i];
+        if(v[k].data[i] > bounds[1].data[i]) bounds[1].data[i] = v[k].data[i];
+      }
+    }
+  }
+}
@@ -0,0 +1,193 @@
+#include <dparaster/band.h>
+#include <dparaster/bitmap.h>
+#include <dparaster/rasterizer.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <math.h>
+
+struct band_draw {
+  const ShaderProgram* shader;
+  Uniform uniform;
+};
+
+struct band_triangle {
+  unsigned draw;
+  size_t first; // Index of the first of the shader->attribute_count entries in band_renderer::vertex
+};
+
+struct band_bin {
+  size_t count, capacity;
+  size_t* triangle;
+};
+
+struct band_renderer {
+  Framebuffer* fb;
+  uint32_t rows;
+  unsigned band_count;
+  struct band_bin* bin;
+  size_t draw_count, draw_capacity;
+  struct band_draw* draw;
+  size_t triangle_count, triangle_capacity;
+  struct band_triangle* triangle;
+  size_t vertex_count, vertex_capacity;
+  Triangle* vertex;
+};
+
+static bool reserve(void** list, size_t* capacity, size_t count, size_t size){
+  if(count <= *capacity)
+    return true;
+  size_t n = *capacity ? *capacity : 16;
+  while(n < count)
+    n *= 2;
+  void* tmp = dparaster_realloc(*list, n * size, DPM_FRAMEBUFFER);
+  if(!tmp)
+    return false;
+  *list = tmp;
+  *capacity = n;
+  return true;
+}
+#define RESERVE(L, C, N) reserve((void**)&(L), &(C), (N), sizeof(*(L)))
+
+struct band_renderer* band_renderer_create(uint32_t w, uint32_t h, uint32_t rows){
+  if(!w || !h || !rows || !bitmap_size_fits(w, h))
+    goto error;
+  struct band_renderer* br = dparaster_calloc(1, sizeof(*br), DPM_FRAMEBUFFER);
+  if(!br)
+    goto error;
+  br->fb = framebuffer_create_band(w, h, rows);
+  if(!br->fb)
+    goto error_after_alloc;
+  br->rows = br->fb->rows;
+  br->band_count = (h + br->rows - 1) / br->rows;
+  br->bin = dparaster_calloc(br->band_count, sizeof(*br->bin), DPM_FRAMEBUFFER);
+  if(!br->bin)
+    goto error_after_fb;
+  return br;
+error_after_fb:
+  framebuffer_free(br->fb);
+error_after_alloc:
+  dparaster_free(br);
+error:
+  return 0;
+}
+
+// Processes a triangle, and adds it to the bins of the bands it touches
+static bool bin_triangle(
+  struct band_renderer*restrict br,
+  unsigned draw,
+  const Geometry*const restrict geometry,
+  unsigned i
+){
+  const uint32_t h = br->fb->h;
+  const ShaderProgram*restrict shader = br->draw[draw].shader;
+  const unsigned attribute_count = shader->attribute_count;
+  if(!RESERVE(br->vertex, br->vertex_capacity, br->vertex_count+attribute_count))
+    return false;
+  Triangle*restrict triangle = &br->vertex[br->vertex_count];
+  process_triangle(shader, &br->draw[draw].uniform, geometry, i, triangle);
+  if(geometry->cull_back_faces && triangle_facing_away(triangle))
+    return true;
+  const Vector*restrict v = triangle[0].vertex;
+  if(v[0].data[2] < -1 && v[1].data[2] < -1 && v[2].data[2] < -1)
+    return true;
+  const double miny = fmin(fmin(v[0].data[1], v[1].data[1]), v[2].data[1]);
+  const double maxy = fmax(fmax(v[0].data[1], v[1].data[1]), v[2].data[1]);
+  if(miny > 1 || maxy < -1 || miny != miny || maxy != maxy)
+    return true;
+  // Same mapping as in draw_triangle, with a row to spare, bitmap rows are flipped
+  const double sy = floor((fmax(miny,-1)+1.)/2. * (h-1)) - 1;
+  const double ey = floor((fmin(maxy, 1)+1.)/2. * (h-1)) + 1;
+  const uint32_t siy = ey >= h-1 ? 0 : h-1 - ey;
+  const uint32_t eiy = sy <= 0 ? h-1 : h-1 - sy;
+  if(!RESERVE(br->triangle, br->triangle_capacity, br->triangle_count+1))
+    return false;
+  const size_t t = br->triangle_count++;
+  br->triangle[t] = (struct band_triangle){
+    .draw = draw,
+    .first = br->vertex_count,
+  };
+  br->vertex_count += attribute_count;
+  for(unsigned b=siy/br->rows, e=eiy/br->rows; b<=e; b++){
+    struct band_bin*restrict bin = &br->bin[b];
+    if(!RESERVE(bin->triangle, bin->capacity, bin->count+1))
+      return false;
+    bin->triangle[bin->count++] = t;
+  }
+  return true;
+}
+
+bool band_draw(
+  struct band_renderer*restrict br,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry
+){
+  if(!RESERVE(br->draw, br->draw_capacity, br->draw_count+1))
+    return false;
+  const unsigned draw = br->draw_count++;
+  br->draw[draw] = (struct band_draw){
+    .shader = shader,
+    .uniform = *uniform,
+  };
+  if(geometry->meshlet){
+    const float margin = 1.f / br->fb->w;
+    for(unsigned m=0; m<geometry->meshlet_count; m++){
+      const struct meshlet*restrict meshlet = &geometry->meshlet[m];
+      if(!meshlet_visible(meshlet, &uniform->modelview, margin, geometry->cull_back_faces))
+        continue;
+      for(unsigned i=meshlet->first; i<meshlet->first+meshlet->count; i++)
+        if(!bin_triangle(br, draw, geometry, i))
+          return false;
+    }
+  }else{
+    for(unsigned i=0; i<geometry->triangle_count; i++)
+      if(!bin_triangle(br, draw, geometry, i))
+        return false;
+  }
+  // The texture is only needed once the bands get drawn
+  if(!uniform->tex && uniform->tex_future)
+    br->draw[draw].uniform.tex = texture_future_wait(uniform->tex_future);
+  return true;
+}
+
+static void reset(struct band_renderer*restrict br){
+  for(unsigned b=0; b<br->band_count; b++)
+    br->bin[b].count = 0;
+  br->draw_count = 0;
+  br->triangle_count = 0;
+  br->vertex_count = 0;
+}
+
+bool band_write(struct band_renderer*restrict br, FILE*restrict of){
+  Framebuffer*restrict fb = br->fb;
+  bool ok = bitmap_write_header(of, fb->w, fb->h);
+  for(unsigned b=0; ok && b<br->band_count; b++){
+    fb->y = b * br->rows;
+    fb->rows = fb->h - fb->y < br->rows ? fb->h - fb->y : br->rows;
+    framebuffer_clear(fb);
+    const struct band_bin*restrict bin = &br->bin[b];
+    for(size_t i=0; i<bin->count; i++){
+      const struct band_triangle* triangle = &br->triangle[bin->triangle[i]];
+      const struct band_draw* draw = &br->draw[triangle->draw];
+      draw_triangle(fb, draw->shader, &draw->uniform, &br->vertex[triangle->first]);
+    }
+    const size_t size = sizeof(uint8_t[fb->rows][fb->w][4]);
+    if(fwrite(framebuffer_image(fb), 1, size, of) != size)
+      ok = false;
+  }
+  fb->rows = br->rows;
+  reset(br);
+  return ok;
+}
+
+void band_renderer_free(struct band_renderer* br){
+  for(unsigned b=0; b<br->band_count; b++)
+    dparaster_free(br->bin[b].triangle);
+  dparaster_free(br->bin);
+  dparaster_free(br->draw);
+  dparaster_free(br->triangle);
+  dparaster_free(br->vertex);
+  framebuffer_free(br->fb);
+  dparaster_free(br);
+}
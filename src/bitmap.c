@@ -1,9 +1,53 @@
 #include <dparaster/bitmap.h>
 #include <dparaster/texture.h>
 #include <dparaster/utils.h>
+#include <dparaster/allocator.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+void bitmap_header_build(
+  uint8_t header[static 54],
+  const uint32_t w,
+  const uint32_t h
+){
+  const uint64_t hs = 54;
+  // Too big for the 32 bit sizes, see bitmap_size_fits
+  const bool big = (uint64_t)w * h * 4 > UINT32_MAX - hs;
+  const uint32_t ims = big ? 0 : (uint64_t)w * h * 4;
+  const uint32_t fs = big ? UINT32_MAX : hs + ims;
+  memcpy(header, (const uint8_t[54]){
+    'B','M', fs,fs>>8,fs>>16,fs>>24, 0,0,0,0, hs,hs>>8,hs>>16,hs>>24,
+    40,0,0,0, w,w>>8,w>>16,w>>24, h,h>>8,h>>16,h>>24, 1,0, 32,0, 0,0,0,0, ims,ims>>8,ims>>16,ims>>24, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0
+  }, 54);
+}
+
+bool bitmap_write_header(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h
+){
+  if(!bitmap_size_fits(w, h))
+    return false;
+  uint8_t header[54];
+  bitmap_header_build(header, w, h);
+  return fwrite(header, 1, sizeof(header), of) == sizeof(header);
+}
+
+bool bitmap_write(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+){
+  const size_t ims = sizeof(uint8_t[h][w][4]);
+  if(!bitmap_write_header(of, w, h))
+    return false;
+  if(fwrite(image, 1, ims, of) != ims)
+    return false;
+  return true;
+}
+
 bool bitmap_save(
   const char*restrict file,
   const uint32_t w,
@@ -19,16 +63,11 @@ bool bitmap_save(
     if(!nf) return false;
   }
 
-  const size_t ims = sizeof(uint8_t[h][w][4]);
-  const uint8_t header[54] = {
-    'B','M', (sizeof(header)+ims),(sizeof(header)+ims)>>8,(sizeof(header)+ims)>>16,(sizeof(header)+ims)>>24, 0,0,0,0, sizeof(header),sizeof(header)>>8,sizeof(header)>>16,sizeof(header)>>24,
-    40,0,0,0, w,w>>8,w>>16,w>>24, h,h>>8,h>>16,h>>24, 1,0, 32,0, 0,0,0,0, ims,ims>>8,ims>>16,ims>>24, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0
-  };
-  fwrite(header, 1, sizeof(header), of);
-  fwrite(image , 1, ims, of);
+  bool ret = bitmap_write(of, w, h, image);
 
-  if(nf) fclose(nf);
-  return true;
+  if(nf && fclose(nf))
+    ret = false;
+  return ret;
 }
 
 bool bitmap_header_parse(struct bmpinfo*restrict info, const uint8_t buf[static restrict 54]){
@@ -104,6 +143,7 @@ bool bitmap_header_parse(struct bmpinfo*restrict info, const uint8_t buf[static
       case 16: fourcc="BR16"; fformat="rgb565le"; gformat="BGR16"; break;
       case 15: fourcc="BGR5"; fformat="rgb555le"; gformat="BGR15"; break;
       case  8: fourcc="BGR8"; fformat="bgr8"    ; gformat="BGR8" ; break;
+      case  4: case 2: case 1: break; // Palette indices
       default: fprintf(stderr, "Strange bits per pixel value\n"); break;
     }
   }
@@ -113,7 +153,9 @@ bool bitmap_header_parse(struct bmpinfo*restrict info, const uint8_t buf[static
     ok = false;
   }
 
-  if((uint64_t)image_data_size + data_offset > file_size){
+  // A file size of all ones with no image size is what's left for image data of 4GiB and more
+  const bool big = file_size == UINT32_MAX && !image_size && !compression;
+  if(!big && (uint64_t)image_data_size + data_offset > file_size){
     fprintf(stderr, "warning: broken bitmap: specified file size too small for all the image data!\n");
     ok = false;
   }
@@ -148,29 +190,210 @@ bool tl_can_handle(const struct texture* texture){
       && ((char*)texture->file_content)[1] == 'M';
 }
 
+// Everything but uncompressed 24 and 32 bpp bitmaps gets converted to RGBA once when loading,
+// so sampling doesn't need to care about the format. The rows stay bottom up, like in the file.
+// The row conversions are kept simple, so the compiler can vectorize them.
+
+#define MAX_PIXELS ((uint64_t)1<<30)
+
+struct bitfield {
+  uint32_t mask;  // After shifting
+  uint32_t shift;
+  uint32_t scale; // 16.16 fixed point factor, to scale the channel to 0-255
+  uint32_t fill;  // For channels which aren't there
+};
+
+static struct bitfield bitfield_make(uint32_t mask){
+  struct bitfield field = { .fill = mask ? 0 : 0xFF };
+  if(!mask)
+    return field;
+  while(!(mask & 1)){
+    mask >>= 1;
+    field.shift++;
+  }
+  unsigned bits = 0;
+  while(bits < 32 && (mask >> bits & 1))
+    bits++;
+  if(bits > 16){ // Only the upper bits matter, and the scaling mustn't overflow
+    field.shift += bits - 16;
+    bits = 16;
+  }
+  field.mask = (1u << bits) - 1;
+  field.scale = (255u * 65536 + field.mask / 2) / field.mask;
+  return field;
+}
+
+static void convert_bitfields_16(uint8_t (*restrict out)[4], const uint8_t*restrict in, uint32_t w, const struct bitfield field[4]){
+  const struct bitfield r=field[0], g=field[1], b=field[2], a=field[3];
+  for(uint32_t x=0; x<w; x++){
+    const uint32_t px = u16le(in + x*2);
+    out[x][0] = ((px >> r.shift & r.mask) * r.scale + 32768) >> 16 | r.fill;
+    out[x][1] = ((px >> g.shift & g.mask) * g.scale + 32768) >> 16 | g.fill;
+    out[x][2] = ((px >> b.shift & b.mask) * b.scale + 32768) >> 16 | b.fill;
+    out[x][3] = ((px >> a.shift & a.mask) * a.scale + 32768) >> 16 | a.fill;
+  }
+}
+
+static void convert_bitfields_32(uint8_t (*restrict out)[4], const uint8_t*restrict in, uint32_t w, const struct bitfield field[4]){
+  const struct bitfield r=field[0], g=field[1], b=field[2], a=field[3];
+  for(uint32_t x=0; x<w; x++){
+    const uint32_t px = u32le(in + x*4);
+    out[x][0] = ((px >> r.shift & r.mask) * r.scale + 32768) >> 16 | r.fill;
+    out[x][1] = ((px >> g.shift & g.mask) * g.scale + 32768) >> 16 | g.fill;
+    out[x][2] = ((px >> b.shift & b.mask) * b.scale + 32768) >> 16 | b.fill;
+    out[x][3] = ((px >> a.shift & a.mask) * a.scale + 32768) >> 16 | a.fill;
+  }
+}
+
+static void convert_indexed(uint8_t (*restrict out)[4], const uint8_t*restrict in, uint32_t w, unsigned bpp, const uint8_t palette[restrict 256][4]){
+  if(bpp == 8){
+    for(uint32_t x=0; x<w; x++)
+      memcpy(out[x], palette[in[x]], 4);
+    return;
+  }
+  const unsigned per_byte = 8 / bpp, mask = (1u << bpp) - 1;
+  for(uint32_t x=0; x<w; x++){
+    const unsigned index = in[x/per_byte] >> (per_byte-1 - x%per_byte) * bpp & mask;
+    memcpy(out[x], palette[index], 4);
+  }
+}
+
+// Entries the file doesn't have are opaque black
+static void load_palette(const struct bmpinfo* bmp, const uint8_t* file, size_t length, uint8_t palette[256][4]){
+  for(unsigned i=0; i<256; i++)
+    memcpy(palette[i], (uint8_t[]){0,0,0,0xFF}, 4);
+  const size_t offset = 14 + (size_t)bmp->bitmap_info_header_size;
+  size_t count = bmp->used_indeces ? bmp->used_indeces : 1u << bmp->bits_per_pixel;
+  if(count > 256)
+    count = 256;
+  if(offset > length)
+    return;
+  if(count > (length - offset) / 4)
+    count = (length - offset) / 4;
+  for(size_t i=0; i<count; i++){
+    const uint8_t* entry = file + offset + i*4;
+    memcpy(palette[i], (uint8_t[]){entry[2],entry[1],entry[0],0xFF}, 4);
+  }
+}
+
+// Decodes to one palette index per byte. Pixels skipped with a delta, or never set, stay 0.
+static void decode_rle(uint8_t*restrict index, uint32_t w, uint32_t h, const uint8_t*restrict data, size_t length, bool rle4){
+  size_t i = 0;
+  uint32_t x = 0, y = 0;
+  while(y < h && length - i >= 2){
+    const uint8_t n = data[i++];
+    const uint8_t v = data[i++];
+    if(n){
+      for(unsigned j=0; j<n; j++, x++)
+        if(x < w)
+          index[(size_t)y*w+x] = !rle4 ? v : j & 1 ? v & 0xF : v >> 4;
+      continue;
+    }
+    switch(v){
+      case 0: x = 0; y++; break; // End of line
+      case 1: return; // End of bitmap
+      case 2: { // Delta
+        if(length - i < 2)
+          return;
+        x += data[i++];
+        y += data[i++];
+      } break;
+      default: { // Absolute mode, v pixels follow, padded to 2 bytes
+        const size_t bytes = rle4 ? (v+1u) / 2 : v;
+        if(length - i < bytes)
+          return;
+        for(unsigned j=0; j<v; j++, x++)
+          if(x < w)
+            index[(size_t)y*w+x] = !rle4 ? data[i+j] : j & 1 ? data[i+j/2] & 0xF : data[i+j/2] >> 4;
+        i += bytes + (bytes & 1);
+        if(i > length)
+          return;
+      } break;
+    }
+  }
+}
+
 bool tl_load(struct texture* texture){
   if(texture->file_length < 54)
     return false;
   struct bmpinfo bmp = {0};
   if(!bitmap_header_parse(&bmp, texture->file_content))
     return false;
-  if((size_t)bmp.data_offset+bmp.image_size > texture->file_length)
+  const uint8_t* file = texture->file_content;
+  const size_t length = texture->file_length;
+  if((size_t)bmp.data_offset+bmp.image_size > length)
     return false;
-  if(bmp.compression){
-    fprintf(stderr, "Only uncompressed 32 or 24 bpp bitmaps supported!\n");
+  const uint32_t w = bmp.width;
+  const uint32_t h = bmp.height;
+  const unsigned bpp = bmp.bits_per_pixel;
+  if(!w || !h || (uint64_t)w * h > MAX_PIXELS)
     return false;
-  }
-  switch(bmp.bits_per_pixel){
-    case 32: strcpy(texture->format, "BGRX"); break;
-    case 24: strcpy(texture->format, "BGR" ); break;
-    default: fprintf(stderr, "Only uncompressed 32 or 24 bpp bitmaps supported!\n"); break;
-  }
+  const uint8_t* data = file + bmp.data_offset;
+  const size_t data_length = length - bmp.data_offset;
+  const size_t stride = ((size_t)w * bpp + 31) / 32 * 4;
+  const bool rle = (bmp.compression == BMP_C_RLE8 && bpp == 8)
+                || (bmp.compression == BMP_C_RLE4 && bpp == 4);
+  if(!rle && (uint64_t)stride * h > data_length)
+    return false;
+
   texture->dimension_count = 2;
-  texture->img = (uint8_t*)texture->file_content + bmp.data_offset;
-  texture->size[0] = bmp.width;
-  texture->size[1] = bmp.height;
-  texture->stride[1] = bmp.stride;
+  texture->size[0] = w;
+  texture->size[1] = h;
   texture->flip[1] = true;
+
+  // The common case can be used right from the file
+  if(bmp.compression == BMP_C_RAW && (bpp == 24 || bpp == 32)){
+    strcpy(texture->format, bpp == 32 ? "BGRX" : "BGR");
+    texture->img = data;
+    texture->stride[0] = stride;
+    return true;
+  }
+
+  struct bitfield field[4];
+  if(bmp.compression == BMP_C_RAW && bpp == 16){
+    field[0] = bitfield_make(0x7C00);
+    field[1] = bitfield_make(0x03E0);
+    field[2] = bitfield_make(0x001F);
+    field[3] = bitfield_make(0);
+  }else if(bmp.compression == BMP_C_BITFIELDS && (bpp == 16 || bpp == 32)){
+    // The masks follow a BITMAPINFOHEADER, and are at the same place in the later headers.
+    // Only those later headers have an alpha mask.
+    if(length < 66)
+      return false;
+    for(unsigned i=0; i<3; i++)
+      field[i] = bitfield_make(u32le(file + 54 + i*4));
+    field[3] = bitfield_make(bmp.bitmap_info_header_size >= 56 ? u32le(file + 66) : 0);
+  }else if(!rle && !(bmp.compression == BMP_C_RAW && (bpp == 1 || bpp == 2 || bpp == 4 || bpp == 8))){
+    fprintf(stderr, "Unsupported bitmap format: %s with %u bpp\n", bmp.format ? bmp.format : "unknown compression", bpp);
+    return false;
+  }
+
+  uint8_t (*img)[4] = dparaster_alloc(sizeof(*img) * w * h, DPM_TEXTURE);
+  if(!img)
+    return false;
+  if(bpp > 8){
+    for(uint32_t y=0; y<h; y++)
+      (bpp == 16 ? convert_bitfields_16 : convert_bitfields_32)(img + (size_t)y*w, data + y*stride, w, field);
+  }else{
+    uint8_t palette[256][4];
+    load_palette(&bmp, file, length, palette);
+    if(rle){
+      uint8_t* index = dparaster_calloc(w, h, DPM_SCRATCH);
+      if(!index){
+        dparaster_free(img);
+        return false;
+      }
+      decode_rle(index, w, h, data, data_length, bmp.compression == BMP_C_RLE4);
+      for(uint32_t y=0; y<h; y++)
+        convert_indexed(img + (size_t)y*w, index + (size_t)y*w, w, 8, (const uint8_t(*)[4])palette);
+      dparaster_free(index);
+    }else{
+      for(uint32_t y=0; y<h; y++)
+        convert_indexed(img + (size_t)y*w, data + y*stride, w, bpp, (const uint8_t(*)[4])palette);
+    }
+  }
+  strcpy(texture->format, "RGBA");
+  texture->img = img;
   return true;
 }
 
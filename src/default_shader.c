@@ -27,12 +27,15 @@ void shader_default_vertex(const Uniform*restrict uniform, Vector out[AOUT_COUNT
   out[AOUT_NORMAL] = mmulv(uniform->modelview, out[AOUT_NORMAL]);
   out[AOUT_COLOR] = in[AIN_COLOR];
   out[AOUT_TEXCOORD] = in[AIN_TEXCOORD];
+  out[AOUT_TEXCOORD].data[2] += uniform->layer;
 }
 
 Vector shader_default_fragment(const Uniform*restrict uniform, double*restrict depth, Vector varying[restrict AOUT_COUNT]){
   UNUSED(depth);
   float ambient_strength = 0.2;
-  Vector tex_color = texture_lookup(uniform->tex, varying[AOUT_TEXCOORD].data, (enum texture_lookup_mode[]){TL_REPEAT,TL_REPEAT,TL_REPEAT});
+  Vector tex_color = {{1,1,1,1}}; // In case the texture couldn't be loaded
+  if(uniform->tex)
+    tex_color = texture_lookup(uniform->tex, varying[AOUT_TEXCOORD].data, (enum texture_lookup_mode[]){TL_REPEAT,TL_REPEAT,TL_REPEAT});
   Vector base_color = vmul(varying[AOUT_COLOR], tex_color);
   Vector normal = vnormalize(varying[AOUT_NORMAL]);
   Vector ambient_color = vmulf(base_color, ambient_strength);
@@ -0,0 +1,297 @@
+#include <dparaster/delta.h>
+#include <dparaster/rasterizer.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// The first and last tile column and row, empty if the first is after the last
+struct tile_rect {
+  uint32_t x0, y0, x1, y1;
+};
+
+struct delta_draw {
+  const ShaderProgram* shader;
+  const Geometry* geometry;
+  Uniform uniform;
+  Vector bounds[2]; // Of the geometry
+  struct tile_rect tile;
+};
+
+struct delta_renderer {
+  Framebuffer* fb;
+  uint32_t tiles_w, tiles_h;
+  uint8_t* dirty; // [tiles_h][tiles_w], the tiles redrawn by the last delta_render
+  uint8_t (*line)[4]; // A row of pixels, for writing them out
+  size_t draw_count, draw_capacity;
+  struct delta_draw* draw;
+  size_t last_count, last_capacity;
+  struct delta_draw* last; // The draws of the frame before
+  bool invalid;
+};
+
+static bool reserve(void** list, size_t* capacity, size_t count, size_t size){
+  if(count <= *capacity)
+    return true;
+  size_t n = *capacity ? *capacity : 16;
+  while(n < count)
+    n *= 2;
+  void* tmp = dparaster_realloc(*list, n * size, DPM_FRAMEBUFFER);
+  if(!tmp)
+    return false;
+  *list = tmp;
+  *capacity = n;
+  return true;
+}
+#define RESERVE(L, C, N) reserve((void**)&(L), &(C), (N), sizeof(*(L)))
+
+struct delta_renderer* delta_renderer_create(uint32_t w, uint32_t h, enum framebuffer_flags flags){
+  if(!w || !h)
+    goto error;
+  struct delta_renderer* dr = dparaster_calloc(1, sizeof(*dr), DPM_FRAMEBUFFER);
+  if(!dr)
+    goto error;
+  dr->fb = framebuffer_create_with_flags(w, h, flags);
+  if(!dr->fb)
+    goto error_after_alloc;
+  dr->tiles_w = (w + FB_TILE - 1) / FB_TILE;
+  dr->tiles_h = (h + FB_TILE - 1) / FB_TILE;
+  dr->dirty = dparaster_calloc(dr->tiles_h, dr->tiles_w, DPM_FRAMEBUFFER);
+  if(!dr->dirty)
+    goto error_after_fb;
+  dr->line = dparaster_alloc(sizeof(*dr->line) * w, DPM_FRAMEBUFFER);
+  if(!dr->line)
+    goto error_after_dirty;
+  dr->invalid = true;
+  return dr;
+error_after_dirty:
+  dparaster_free(dr->dirty);
+error_after_fb:
+  framebuffer_free(dr->fb);
+error_after_alloc:
+  dparaster_free(dr);
+error:
+  return 0;
+}
+
+bool delta_draw(
+  struct delta_renderer*restrict dr,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry
+){
+  if(!RESERVE(dr->draw, dr->draw_capacity, dr->draw_count + 1))
+    return false;
+  dr->draw[dr->draw_count++] = (struct delta_draw){
+    .shader = shader,
+    .geometry = geometry,
+    .uniform = *uniform,
+  };
+  return true;
+}
+
+void delta_invalidate(struct delta_renderer* dr){
+  dr->invalid = true;
+}
+
+// The fields one by one, the padding may differ
+static bool same_draw(const struct delta_draw*restrict a, const struct delta_draw*restrict b){
+  return a->shader == b->shader
+      && a->geometry == b->geometry
+      && !memcmp(&a->uniform.modelview, &b->uniform.modelview, sizeof(Matrix))
+      && !memcmp(&a->uniform.light, &b->uniform.light, sizeof(Vector))
+      && a->uniform.tex == b->uniform.tex
+      && a->uniform.tex_future == b->uniform.tex_future
+      && a->uniform.layer == b->uniform.layer;
+}
+
+// The pixels are found the same way as in draw_triangle, with a pixel to spare around them,
+// and things up to 2 pixels outside the view count, since draw_triangle draws things just right of it into the last column.
+static void draw_tiles(const struct delta_renderer*restrict dr, struct delta_draw*restrict d){
+  const uint32_t w = dr->fb->w, h = dr->fb->h;
+  d->tile = (struct tile_rect){ 1, 1, 0, 0 };
+  if(!d->geometry->triangle_count)
+    return;
+  double min[2] = { INFINITY, INFINITY }, max[2] = { -INFINITY, -INFINITY };
+  bool in_front = false, nan = false;
+  for(unsigned i=0; i<8; i++){
+    const Vector corner = {{ d->bounds[i&1].data[0], d->bounds[i>>1&1].data[1], d->bounds[i>>2].data[2], 1 }};
+    const Vector p = mmulv(d->uniform.modelview, corner);
+    if(!(p.data[2] < -1))
+      in_front = true;
+    for(unsigned j=0; j<2; j++){
+      if(p.data[j] != p.data[j])
+        nan = true;
+      if(p.data[j] < min[j]) min[j] = p.data[j];
+      if(p.data[j] > max[j]) max[j] = p.data[j];
+    }
+  }
+  if(!in_front)
+    return;
+  if(nan)
+    min[0] = min[1] = -1, max[0] = max[1] = 1;
+  const double margin[2] = { 2. / w, 2. / h };
+  for(unsigned j=0; j<2; j++){
+    if(max[j] < -1 - margin[j] || min[j] > 1 + margin[j])
+      return;
+    min[j] = fmax(min[j], -1);
+    max[j] = fmin(max[j], 1);
+  }
+  const uint32_t size[2] = { w, h };
+  uint32_t first[2], last[2];
+  for(unsigned j=0; j<2; j++){
+    const double a = floor((min[j]+1.)/2. * (size[j]-1)) - 1;
+    const double b = ceil((max[j]+1.)/2. * (size[j]-1)) + 1;
+    first[j] = a < 0 ? 0 : a;
+    last[j] = b > size[j]-1 ? size[j]-1 : b;
+  }
+  // Rows are flipped, like iy in draw_triangle
+  d->tile = (struct tile_rect){
+    first[0] / FB_TILE, (h-1 - last[1]) / FB_TILE,
+    last[0] / FB_TILE, (h-1 - first[1]) / FB_TILE,
+  };
+}
+
+static void mark_tiles(struct delta_renderer*restrict dr, struct tile_rect tile){
+  for(uint32_t ty=tile.y0; ty<=tile.y1; ty++)
+    memset(dr->dirty + (size_t)ty * dr->tiles_w + tile.x0, 1, tile.x1 - tile.x0 + 1);
+}
+
+static bool touches_dirty(const struct delta_renderer*restrict dr, struct tile_rect tile){
+  for(uint32_t ty=tile.y0; ty<=tile.y1; ty++)
+    for(uint32_t tx=tile.x0; tx<=tile.x1; tx++)
+      if(dr->dirty[(size_t)ty * dr->tiles_w + tx])
+        return true;
+  return false;
+}
+
+const Framebuffer* delta_render(struct delta_renderer*restrict dr, struct delta_stats*restrict stats){
+  Framebuffer*restrict fb = dr->fb;
+  const size_t tile_count = (size_t)dr->tiles_w * dr->tiles_h;
+  memset(dr->dirty, dr->invalid, tile_count);
+  unsigned changed = 0;
+  const size_t n = dr->draw_count > dr->last_count ? dr->draw_count : dr->last_count;
+  for(size_t i=0; i<n; i++){
+    struct delta_draw*restrict d = i < dr->draw_count ? &dr->draw[i] : 0;
+    const struct delta_draw*restrict l = i < dr->last_count ? &dr->last[i] : 0;
+    // After delta_invalidate, geometry may have changed in place, so nothing of the last frame is
+    // reused. Everything gets redrawn anyway, but the next frame relies on the tiles found here.
+    if(d && l && d->geometry == l->geometry && !dr->invalid){
+      memcpy(d->bounds, l->bounds, sizeof(d->bounds));
+    }else if(d){
+      geometry_bounds(d->geometry, d->bounds);
+    }
+    if(d && l && same_draw(d, l)){
+      if(dr->invalid){
+        draw_tiles(dr, d);
+      }else{
+        d->tile = l->tile;
+      }
+      continue;
+    }
+    changed++;
+    if(d){
+      draw_tiles(dr, d);
+      mark_tiles(dr, d->tile);
+    }
+    if(l)
+      mark_tiles(dr, l->tile);
+  }
+
+  unsigned dirty = 0;
+  for(size_t i=0; i<tile_count; i++)
+    dirty += dr->dirty[i];
+  unsigned redrawn = 0;
+  if(dirty){
+    if(dirty == tile_count){
+      framebuffer_clear(fb);
+    }else{
+      framebuffer_clear_tiles(fb, dr->dirty);
+      fb->scissor = dr->dirty;
+    }
+    for(size_t i=0; i<dr->draw_count; i++){
+      const struct delta_draw*restrict d = &dr->draw[i];
+      if(!touches_dirty(dr, d->tile))
+        continue;
+      draw(fb, d->shader, &d->uniform, d->geometry);
+      redrawn++;
+    }
+    fb->scissor = 0;
+    framebuffer_resolve(fb);
+  }
+  if(stats){
+    *stats = (struct delta_stats){
+      .draws = dr->draw_count,
+      .changed = changed,
+      .redrawn = redrawn,
+      .tiles = tile_count,
+      .dirty = dirty,
+    };
+  }
+
+  // This frame is the one to compare the next one to
+  struct delta_draw* list = dr->last;
+  const size_t capacity = dr->last_capacity;
+  dr->last = dr->draw;
+  dr->last_count = dr->draw_count;
+  dr->last_capacity = dr->draw_capacity;
+  dr->draw = list;
+  dr->draw_count = 0;
+  dr->draw_capacity = capacity;
+  dr->invalid = false;
+  return fb;
+}
+
+bool delta_write(const struct delta_renderer*restrict dr, FILE*restrict of){
+  const Framebuffer*restrict fb = dr->fb;
+  const uint32_t w = fb->w, h = fb->h;
+  uint32_t runs = 0;
+  for(uint32_t ty=0; ty<dr->tiles_h; ty++){
+    const uint8_t*restrict row = dr->dirty + (size_t)ty * dr->tiles_w;
+    for(uint32_t tx=0; tx<dr->tiles_w; tx++)
+      runs += row[tx] && (!tx || !row[tx-1]);
+  }
+  const uint8_t header[DELTA_HEADER_SIZE] = {
+    'D','P','T','D', w,w>>8,w>>16,w>>24, h,h>>8,h>>16,h>>24, FB_TILE,0,0,0, runs,runs>>8,runs>>16,runs>>24
+  };
+  if(fwrite(header, 1, sizeof(header), of) != sizeof(header))
+    return false;
+  for(uint32_t ty=0; ty<dr->tiles_h; ty++){
+    const uint8_t*restrict row = dr->dirty + (size_t)ty * dr->tiles_w;
+    for(uint32_t tx=0; tx<dr->tiles_w; ){
+      if(!row[tx]){
+        tx++;
+        continue;
+      }
+      uint32_t count = 1;
+      while(tx+count < dr->tiles_w && row[tx+count])
+        count++;
+      const uint8_t run[DELTA_RUN_SIZE] = {
+        ty,ty>>8,ty>>16,ty>>24, tx,tx>>8,tx>>16,tx>>24, count,count>>8,count>>16,count>>24
+      };
+      if(fwrite(run, 1, sizeof(run), of) != sizeof(run))
+        return false;
+      const uint32_t x0 = tx * FB_TILE;
+      const uint32_t x1 = (tx+count) * FB_TILE < w ? (tx+count) * FB_TILE : w;
+      for(uint32_t y=ty*FB_TILE; y<h && y<(ty+1)*FB_TILE; y++){
+        const size_t offset = framebuffer_row_offset(fb, y);
+        for(uint32_t x=x0; x<x1; x++)
+          memcpy(dr->line[x-x0], fb->image[offset + framebuffer_column_offset(fb, x)], sizeof(*dr->line));
+        const size_t size = sizeof(*dr->line) * (x1 - x0);
+        if(fwrite(dr->line, 1, size, of) != size)
+          return false;
+      }
+      tx += count;
+    }
+  }
+  return true;
+}
+
+void delta_renderer_free(struct delta_renderer* dr){
+  dparaster_free(dr->draw);
+  dparaster_free(dr->last);
+  dparaster_free(dr->line);
+  dparaster_free(dr->dirty);
+  framebuffer_free(dr->fb);
+  dparaster_free(dr);
+}
@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE
+#include <dparaster/dptx.h>
+#include <dparaster/utils.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+static void put32(uint8_t* x, uint32_t v){
+  for(unsigned i=0; i<4; i++)
+    x[i] = v >> i*8;
+}
+
+static void put64(uint8_t* x, uint64_t v){
+  for(unsigned i=0; i<8; i++)
+    x[i] = v >> i*8;
+}
+
+static const uint8_t padding[DPTX_ALIGN];
+
+bool dptx_write(FILE*restrict of, const struct texture*restrict texture){
+  if(!texture->dimension_count || texture->dimension_count > 3)
+    return false;
+  const unsigned level_count = texture->level_count + 1;
+  uint8_t header[DPTX_HEADER_SIZE] = {0};
+  memcpy(header, DPTX_MAGIC, 4);
+  put32(header+4, DPTX_VERSION);
+  memcpy(header+8, texture->format, strnlen(texture->format, 4));
+  header[16] = texture->dimension_count;
+  header[17] = texture->level_count;
+  for(unsigned i=0; i<texture->dimension_count; i++)
+    header[18] |= texture->flip[i] << i;
+  if(texture->layered)
+    header[18] |= DPTX_LAYERED;
+  header[19] = texture->compression;
+  if(fwrite(header, 1, sizeof(header), of) != sizeof(header))
+    return false;
+  uint64_t offset = DPTX_HEADER_SIZE + (uint64_t)DPTX_LEVEL_SIZE * level_count;
+  for(unsigned l=0; l<level_count; l++){
+    const struct texture_level level = texture_get_level(texture, l);
+    offset = (offset + DPTX_ALIGN - 1) / DPTX_ALIGN * DPTX_ALIGN;
+    uint8_t entry[DPTX_LEVEL_SIZE];
+    put64(entry, offset);
+    for(unsigned i=0; i<3; i++){
+      put64(entry +  8 + i*8, level.size[i]);
+      put64(entry + 32 + i*8, level.stride[i]);
+    }
+    if(fwrite(entry, 1, sizeof(entry), of) != sizeof(entry))
+      return false;
+    offset += texture_level_data_size(texture, l);
+  }
+  offset = DPTX_HEADER_SIZE + (uint64_t)DPTX_LEVEL_SIZE * level_count;
+  for(unsigned l=0; l<level_count; l++){
+    const size_t pad = (DPTX_ALIGN - offset % DPTX_ALIGN) % DPTX_ALIGN;
+    if(fwrite(padding, 1, pad, of) != pad)
+      return false;
+    const size_t size = texture_level_data_size(texture, l);
+    if(fwrite(texture_get_level(texture, l).img, 1, size, of) != size)
+      return false;
+    offset += pad + size;
+  }
+  return true;
+}
+
+bool dptx_save(const char*restrict file, const struct texture*restrict texture){
+  FILE* nf = 0;
+  FILE* of = 0;
+  if(!strcmp(file, "-")){
+    of = stdout;
+  }else{
+    of = nf = fopen(file, "wb");
+    if(!nf) return false;
+  }
+
+  bool ret = dptx_write(of, texture);
+
+  if(nf && fclose(nf))
+    ret = false;
+  return ret;
+}
+
+bool dptx_can_handle(const struct texture* texture){
+  return texture->file_length >= DPTX_HEADER_SIZE
+      && !memcmp(texture->file_content, DPTX_MAGIC, 4);
+}
+
+// a * b, or 0 if it doesn't fit into size_t
+static inline size_t checked_mul(size_t a, size_t b){
+  return b && a > SIZE_MAX / b ? 0 : a * b;
+}
+
+// The bytes a level spans, or 0 if it's broken. Each stride has to cover the dimensions before it,
+// or texels would overlap, and the last stride wouldn't be the extent of the level.
+static size_t level_extent(const struct texture* texture, const struct texture_level* l){
+  if(texture->compression){
+    size_t size = texture_block_size(texture->compression);
+    for(unsigned i=0; size && i<texture->dimension_count; i++)
+      size = checked_mul(size, i < 2 ? l->size[i] / 4 + (l->size[i] % 4 != 0) : l->size[i]);
+    return size;
+  }
+  size_t extent = strnlen(texture->format, 4);
+  for(unsigned i=0; extent && i<texture->dimension_count; i++){
+    const size_t needed = checked_mul(extent, l->size[i]);
+    if(l->stride[i] && l->stride[i] < needed)
+      return 0;
+    extent = l->stride[i] ? l->stride[i] : needed;
+  }
+  return extent;
+}
+
+bool dptx_load(struct texture* texture){
+  const uint8_t* file = texture->file_content;
+  const size_t length = texture->file_length;
+  if(length < DPTX_HEADER_SIZE || u32le(file+4) != DPTX_VERSION)
+    return false;
+  if(file[12] || file[13] || file[14] || file[15])
+    return false; // Longer format strings than we have room for
+  const unsigned dimension_count = file[16];
+  const unsigned level_count = file[17] + 1;
+  if(!dimension_count || dimension_count > 3)
+    return false;
+  if(length < DPTX_HEADER_SIZE + (uint64_t)DPTX_LEVEL_SIZE * level_count)
+    return false;
+  memcpy(texture->format, file+8, 4);
+  texture->format[4] = 0;
+  if(!texture->format[0])
+    return false;
+  texture->dimension_count = dimension_count;
+  texture->compression = file[19];
+  // Blocks always decode to RGBA
+  if(texture->compression && (!texture_block_size(texture->compression) || strcmp(texture->format, "RGBA")))
+    return false;
+  for(unsigned i=0; i<dimension_count; i++)
+    texture->flip[i] = file[18] >> i & 1;
+  texture->layered = file[18] & DPTX_LAYERED;
+  struct texture_level* level = 0;
+  if(level_count > 1){
+    level = dparaster_calloc(level_count-1, sizeof(*level), DPM_TEXTURE);
+    if(!level)
+      return false;
+  }
+  texture->level_count = level_count - 1;
+  texture->level = level;
+  for(unsigned l=0; l<level_count; l++){
+    const uint8_t* entry = file + DPTX_HEADER_SIZE + DPTX_LEVEL_SIZE * l;
+    struct texture_level current = {0};
+    for(unsigned i=0; i<dimension_count; i++){
+      current.size[i] = u64le(entry +  8 + i*8);
+      current.stride[i] = u64le(entry + 32 + i*8);
+      if(!current.size[i])
+        goto error;
+    }
+    const uint64_t offset = u64le(entry);
+    if(offset % DPTX_ALIGN || offset > length)
+      goto error;
+    current.img = file + offset;
+    if(l){
+      level[l-1] = current;
+    }else{
+      memcpy(texture->size, current.size, sizeof(current.size));
+      memcpy(texture->stride, current.stride, sizeof(current.stride));
+      texture->img = current.img;
+    }
+    const size_t extent = level_extent(texture, &current);
+    if(!extent || extent > length - offset)
+      goto error;
+  }
+  return true;
+error:
+  dparaster_free(level);
+  texture->level = 0;
+  texture->level_count = 0;
+  return false;
+}
+
+void dptx_free(struct texture* texture){
+  dparaster_free((void*)texture->level);
+  texture->level = 0;
+  texture->level_count = 0;
+}
+
+IMPLEMENT_TEXTURE_LOADER_NAMED(dptx)
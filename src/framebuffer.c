@@ -0,0 +1,378 @@
+#define _DEFAULT_SOURCE
+#include <dparaster/framebuffer.h>
+#include <dparaster/allocator.h>
+#include <dparaster/utils.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define CACHE_LINE 64
+#define HUGEPAGE_SIZE ((size_t)2<<20)
+
+_Static_assert(FB_TILE == 1 << FB_TILE_SHIFT, "FB_TILE_SHIFT doesn't match FB_TILE");
+
+static inline size_t hugepage_length(size_t size){
+  return (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+}
+
+// Aligned to cache lines, so a tile row of 8 pixels never straddles two of them. Huge page
+// buffers come from aligned_alloc, the allocator would put its header in front of them and
+// waste most of a huge page, so only the accounting goes through it. Free with buffer_free.
+static void* buffer_alloc(size_t size, enum framebuffer_flags flags){
+  if(flags & FBF_HUGEPAGES && size >= HUGEPAGE_SIZE){
+    const size_t length = hugepage_length(size);
+    void* memory = aligned_alloc(HUGEPAGE_SIZE, length);
+    if(!dparaster_account(memory, length, DPM_FRAMEBUFFER)){
+      free(memory);
+      return 0;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(memory, length, MADV_HUGEPAGE);
+#endif
+    return memory;
+  }
+  return dparaster_aligned_alloc(CACHE_LINE, size, DPM_FRAMEBUFFER);
+}
+
+static void buffer_free(void* memory, size_t size, bool hugepages){
+  if(!memory)
+    return;
+  if(hugepages && size >= HUGEPAGE_SIZE){
+    free(memory);
+    dparaster_unaccount(hugepage_length(size), DPM_FRAMEBUFFER);
+  }else
+    dparaster_free(memory);
+}
+
+// Including the padding of partial tiles
+static inline size_t pixel_count(const Framebuffer* fb){
+  const uint32_t mask = (1u << fb->tile_shift) - 1;
+  return fb->stride * ((fb->rows + mask) >> fb->tile_shift);
+}
+
+static Framebuffer* create(uint32_t w, uint32_t h, uint32_t rows, uint8_t (*image)[4], enum framebuffer_flags flags){
+  Framebuffer* fb = dparaster_alloc(sizeof(*fb), DPM_FRAMEBUFFER);
+  if(!fb)
+    goto error;
+  const bool tiled = flags & FBF_TILED;
+  *fb = (Framebuffer){
+    .w = w,
+    .h = h,
+    .rows = rows,
+    .image = image,
+    .stride = tiled ? (size_t)((w + FB_TILE - 1) / FB_TILE) * FB_TILE * FB_TILE : w,
+    .tile_shift = tiled ? FB_TILE_SHIFT : 0,
+    .samples = 1 << ((flags & FBF_MSAA_MASK) >> 2),
+    .format = (flags & FBF_FORMAT_MASK) >> 4,
+    .resolve = flags & (FBF_TONEMAP|FBF_DITHER),
+    .external_image = !!image,
+    .hugepages = flags & FBF_HUGEPAGES,
+  };
+  const size_t pixels = pixel_count(fb);
+  if(!fb->image)
+    fb->image = buffer_alloc(sizeof(*fb->image) * pixels, flags);
+  if(!fb->image)
+    goto error_after_alloc;
+  fb->depth = buffer_alloc(sizeof(*fb->depth) * pixels * fb->samples, flags);
+  if(!fb->depth)
+    goto error_after_image;
+  const size_t texel_size = framebuffer_texel_size(fb->format);
+  if((fb->format || fb->samples > 1) && !(fb->target = buffer_alloc(texel_size * pixels * fb->samples, flags)))
+    goto error_after_depth;
+  if(tiled && !(fb->linear = dparaster_alloc(sizeof(uint8_t[rows][w][4]), DPM_FRAMEBUFFER)))
+    goto error_after_samples;
+  if(!framebuffer_set_hiz(fb, true))
+    goto error_after_linear;
+  framebuffer_clear(fb);
+  return fb;
+error_after_linear:
+  dparaster_free(fb->linear);
+error_after_samples:
+  buffer_free(fb->target, texel_size * pixels * fb->samples, fb->hugepages);
+error_after_depth:
+  buffer_free(fb->depth, sizeof(*fb->depth) * pixels * fb->samples, fb->hugepages);
+error_after_image:
+  if(!fb->external_image)
+    buffer_free(fb->image, sizeof(*fb->image) * pixels, fb->hugepages);
+error_after_alloc:
+  dparaster_free(fb);
+error:
+  return 0;
+}
+
+Framebuffer* framebuffer_create(uint32_t w, uint32_t h, uint8_t (*image)[4]){
+  return create(w, h, h, image, 0);
+}
+
+Framebuffer* framebuffer_create_with_flags(uint32_t w, uint32_t h, enum framebuffer_flags flags){
+  return create(w, h, h, 0, flags);
+}
+
+Framebuffer* framebuffer_create_band(uint32_t w, uint32_t h, uint32_t rows){
+  if(rows > h)
+    rows = h;
+  return create(w, h, rows, 0, 0);
+}
+
+void framebuffer_clear(Framebuffer* fb){
+  const size_t pixels = pixel_count(fb);
+  memset(fb->image, 0, sizeof(*fb->image) * pixels);
+  if(fb->target)
+    memset(fb->target, 0, framebuffer_texel_size(fb->format) * pixels * fb->samples);
+  for(size_t i=0, n=pixels*fb->samples; i<n; i++)
+    fb->depth[i] = INFINITY;
+  if(fb->hiz)
+    for(size_t i=0, n=(size_t)fb->hiz_w*((fb->rows+HIZ_TILE-1)/HIZ_TILE); i<n; i++)
+      fb->hiz[i] = (struct hiz_tile){ INFINITY, INFINITY, false };
+}
+
+void framebuffer_clear_tiles(Framebuffer*restrict fb, const uint8_t tiles[restrict]){
+  const size_t texel_size = framebuffer_texel_size(fb->format);
+  const uint32_t tw = (fb->w + FB_TILE - 1) / FB_TILE;
+  const uint32_t th = (fb->rows + FB_TILE - 1) / FB_TILE;
+  for(uint32_t ty=0; ty<th; ty++){
+    for(uint32_t tx=0; tx<tw; tx++){
+      if(!tiles[ty*tw+tx])
+        continue;
+      for(uint32_t y=ty*FB_TILE; y<fb->rows && y<(ty+1)*FB_TILE; y++){
+        const size_t row = framebuffer_row_offset(fb, y);
+        for(uint32_t x=tx*FB_TILE; x<fb->w && x<(tx+1)*FB_TILE; x++){
+          const size_t at = row + framebuffer_column_offset(fb, x);
+          memset(fb->image[at], 0, sizeof(*fb->image));
+          for(unsigned s=0; s<fb->samples; s++)
+            fb->depth[at*fb->samples+s] = INFINITY;
+          if(fb->target)
+            memset((uint8_t*)fb->target + at*fb->samples*texel_size, 0, texel_size*fb->samples);
+        }
+      }
+      if(fb->hiz)
+        fb->hiz[ty*fb->hiz_w+tx] = (struct hiz_tile){ INFINITY, INFINITY, false };
+    }
+  }
+}
+
+bool framebuffer_set_hiz(Framebuffer* fb, bool enable){
+  if(!enable){
+    dparaster_free(fb->hiz);
+    fb->hiz = 0;
+    return true;
+  }
+  if(fb->hiz || fb->samples > 1)
+    return true;
+  const uint32_t tw = (fb->w + HIZ_TILE - 1) / HIZ_TILE;
+  const uint32_t th = (fb->rows + HIZ_TILE - 1) / HIZ_TILE;
+  fb->hiz = dparaster_alloc(sizeof(*fb->hiz) * tw * th, DPM_FRAMEBUFFER);
+  if(!fb->hiz)
+    return false;
+  fb->hiz_w = tw;
+  // Whatever is in the depth buffer already
+  for(uint32_t ty=0; ty<th; ty++){
+    for(uint32_t tx=0; tx<tw; tx++){
+      struct hiz_tile*restrict tile = &fb->hiz[ty*tw+tx];
+      *tile = (struct hiz_tile){ INFINITY, INFINITY, true };
+      for(uint32_t y=ty*HIZ_TILE; y<fb->rows && y<(ty+1)*HIZ_TILE; y++)
+        for(uint32_t x=tx*HIZ_TILE; x<fb->w && x<(tx+1)*HIZ_TILE; x++)
+          if(fb->depth[framebuffer_offset(fb, x, y)] < tile->min)
+            tile->min = fb->depth[framebuffer_offset(fb, x, y)];
+    }
+  }
+  return true;
+}
+
+bool framebuffer_set_shading_rate(Framebuffer*restrict fb, enum shading_rate rate, const uint8_t rate_image[]){
+  if((rate != SR_1X1 || rate_image) && !fb->coarse){
+    fb->coarse = dparaster_calloc(fb->w, sizeof(*fb->coarse), DPM_FRAMEBUFFER);
+    if(!fb->coarse)
+      return false;
+    fb->coarse_triangle = 0;
+  }
+  fb->shading_rate = rate;
+  fb->shading_rate_image = rate_image;
+  return true;
+}
+
+double framebuffer_hiz_max(Framebuffer*restrict fb, uint32_t tx, uint32_t ty){
+  struct hiz_tile*restrict tile = &fb->hiz[ty*fb->hiz_w+tx];
+  if(tile->dirty){
+    double max = -INFINITY;
+    for(uint32_t y=ty*HIZ_TILE; y<fb->rows && y<(ty+1)*HIZ_TILE; y++){
+      const double*restrict row = fb->depth + framebuffer_row_offset(fb, y);
+      for(uint32_t x=tx*HIZ_TILE; x<fb->w && x<(tx+1)*HIZ_TILE; x++){
+        const double depth = row[framebuffer_column_offset(fb, x)];
+        if(!(depth <= max)) // NaN counts as farthest
+          max = depth;
+      }
+    }
+    tile->max = max;
+    tile->dirty = false;
+  }
+  return tile->max;
+}
+
+// With the number of samples known, the loops get unrolled and vectorized
+static inline void resolve_bgrx(uint8_t (*restrict out)[4], const uint8_t (*restrict in)[4], size_t pixels, unsigned samples){
+  for(size_t i=0; i<pixels; i++){
+    for(unsigned c=0; c<4; c++){
+      unsigned sum = samples / 2;
+      for(unsigned s=0; s<samples; s++)
+        sum += in[i*samples+s][c];
+      out[i][c] = sum / samples;
+    }
+  }
+}
+
+// Other formats are resolved a few pixels at a time, each step in its own loop over all of them,
+// so the compiler can vectorize the ones which don't depend on the format.
+#define RESOLVE_PIXELS 64
+
+static void decode(float (*restrict out)[4], const void*restrict in, enum framebuffer_format format, unsigned samples, uint32_t n){
+  switch(format){
+    case FBF_FORMAT_BGRX8: break;
+    case FBF_FORMAT_RGB10A2: {
+      const uint32_t*restrict t = in;
+      for(uint32_t i=0; i<n; i++){
+        float sum[4] = {0};
+        for(unsigned s=0; s<samples; s++){
+          const uint32_t p = t[i*samples+s];
+          sum[0] += p       & 0x3FF;
+          sum[1] += p >> 10 & 0x3FF;
+          sum[2] += p >> 20 & 0x3FF;
+          sum[3] += (p >> 30) * (1023.f / 3);
+        }
+        for(unsigned c=0; c<4; c++)
+          out[i][c] = sum[c] / (1023.f * samples);
+      }
+    } break;
+    case FBF_FORMAT_FLOAT16: {
+      const uint16_t (*restrict t)[4] = (const uint16_t(*)[4])in;
+      for(uint32_t i=0; i<n; i++){
+        for(unsigned c=0; c<4; c++){
+          float sum = 0;
+          for(unsigned s=0; s<samples; s++)
+            sum += half_to_float(t[i*samples+s][c]);
+          out[i][c] = sum / samples;
+        }
+      }
+    } break;
+    case FBF_FORMAT_FLOAT32: {
+      const float (*restrict t)[4] = (const float(*)[4])in;
+      for(uint32_t i=0; i<n; i++){
+        for(unsigned c=0; c<4; c++){
+          float sum = 0;
+          for(unsigned s=0; s<samples; s++)
+            sum += t[i*samples+s][c];
+          out[i][c] = sum / samples;
+        }
+      }
+    } break;
+  }
+}
+
+// The fit of the ACES filmic curve by Krzysztof Narkowicz
+static void tonemap(float (*restrict color)[4], uint32_t n){
+  for(uint32_t i=0; i<n; i++){
+    for(unsigned c=0; c<3; c++){
+      const float x = color[i][c] > 0 ? color[i][c] : 0;
+      color[i][c] = x * (2.51f * x + 0.03f) / (x * (2.43f * x + 0.59f) + 0.14f);
+    }
+  }
+}
+
+// A 4x4 Bayer matrix, as offsets of -0.5..0.5 of the last bit
+static const float dither_offset[4][4] = {
+  { 0.5f/16-0.5f,  8.5f/16-0.5f,  2.5f/16-0.5f, 10.5f/16-0.5f},
+  {12.5f/16-0.5f,  4.5f/16-0.5f, 14.5f/16-0.5f,  6.5f/16-0.5f},
+  { 3.5f/16-0.5f, 11.5f/16-0.5f,  1.5f/16-0.5f,  9.5f/16-0.5f},
+  {15.5f/16-0.5f,  7.5f/16-0.5f, 13.5f/16-0.5f,  5.5f/16-0.5f},
+};
+
+// Without dithering, this is the same as the conversion draw_triangle does for BGRX8. The clamps
+// are written so they become min and max.
+static void quantize(uint8_t (*restrict out)[4], const float (*restrict color)[4], uint32_t n, uint32_t x, uint32_t y, bool dither){
+  for(uint32_t i=0; i<n; i++){
+    const float d = dither ? dither_offset[y & 3][(x+i) & 3] : 0;
+    for(unsigned c=0; c<3; c++){
+      float v = color[i][c] * 0x100 + d;
+      v = v > 0x00 ? v : 0x00;
+      v = v < 0xFF ? v : 0xFF;
+      out[i][2-c] = (int)v;
+    }
+  }
+}
+
+// X is set for the samples something was drawn into, like it is in the BGRX8 samples. In its own
+// loop, mixing doubles into the one above would keep it from being vectorized.
+static void coverage(uint8_t (*restrict out)[4], const double*restrict depth, unsigned samples, uint32_t n){
+  for(uint32_t i=0; i<n; i++){
+    unsigned covered = 0;
+    for(unsigned s=0; s<samples; s++)
+      covered += depth[i*samples+s] != INFINITY;
+    out[i][3] = (0xFF * covered + samples / 2) / samples;
+  }
+}
+
+// n pixels in a row, one after another in memory, the first one at x, y
+static void resolve_run(const Framebuffer*restrict fb, size_t at, uint32_t n, uint32_t x, uint32_t y){
+  const size_t texel_size = framebuffer_texel_size(fb->format);
+  for(uint32_t i=0; i<n; i+=RESOLVE_PIXELS){
+    const uint32_t m = n - i < RESOLVE_PIXELS ? n - i : RESOLVE_PIXELS;
+    float color[RESOLVE_PIXELS][4];
+    decode(color, (const uint8_t*)fb->target + (at+i) * fb->samples * texel_size, fb->format, fb->samples, m);
+    if(fb->resolve & FBF_TONEMAP)
+      tonemap(color, m);
+    quantize(fb->image + at + i, (const float(*)[4])color, m, x + i, y, fb->resolve & FBF_DITHER);
+    coverage(fb->image + at + i, fb->depth + (at+i) * fb->samples, fb->samples, m);
+  }
+}
+
+void framebuffer_resolve(const Framebuffer* fb){
+  if(!fb->target)
+    return;
+  if(fb->format == FBF_FORMAT_BGRX8){
+    const size_t pixels = pixel_count(fb);
+    const uint8_t (*in)[4] = (const uint8_t(*)[4])fb->target;
+    switch(fb->samples){
+      case 2: resolve_bgrx(fb->image, in, pixels, 2); break;
+      case 4: resolve_bgrx(fb->image, in, pixels, 4); break;
+      case 8: resolve_bgrx(fb->image, in, pixels, 8); break;
+    }
+    return;
+  }
+  // Rows of tiles are FB_TILE pixels long
+  const uint32_t run = fb->tile_shift ? FB_TILE : fb->w;
+  for(uint32_t y=0; y<fb->rows; y++){
+    const size_t row = framebuffer_row_offset(fb, y);
+    for(uint32_t x=0; x<fb->w; x+=run)
+      resolve_run(fb, row + framebuffer_column_offset(fb, x), fb->w - x < run ? fb->w - x : run, x, y);
+  }
+}
+
+// Copies whole tile rows of 32 bytes at once, which the compiler turns into vector moves
+const uint8_t (*framebuffer_image(const Framebuffer* fb))[4] {
+  framebuffer_resolve(fb);
+  if(!fb->tile_shift)
+    return (const uint8_t(*)[4])fb->image;
+  const uint32_t w = fb->w, full = w / FB_TILE * FB_TILE;
+  for(uint32_t y=0; y<fb->rows; y++){
+    const uint8_t (*restrict in)[4] = (const uint8_t(*)[4])fb->image + framebuffer_row_offset(fb, y);
+    uint8_t (*restrict out)[4] = fb->linear + (size_t)y * w;
+    for(uint32_t x=0; x<full; x+=FB_TILE, in+=FB_TILE*FB_TILE)
+      memcpy(out + x, in, sizeof(uint8_t[FB_TILE][4]));
+    if(full < w)
+      memcpy(out + full, in, sizeof(uint8_t[4]) * (w - full));
+  }
+  return (const uint8_t(*)[4])fb->linear;
+}
+
+void framebuffer_free(Framebuffer* fb){
+  const size_t pixels = pixel_count(fb);
+  if(!fb->external_image)
+    buffer_free(fb->image, sizeof(*fb->image) * pixels, fb->hugepages);
+  buffer_free(fb->depth, sizeof(*fb->depth) * pixels * fb->samples, fb->hugepages);
+  buffer_free(fb->target, framebuffer_texel_size(fb->format) * pixels * fb->samples, fb->hugepages);
+  dparaster_free(fb->linear);
+  dparaster_free(fb->hiz);
+  dparaster_free(fb->coarse);
+  dparaster_free(fb);
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dparaster/framering.h>
+#include <dparaster/allocator.h>
+
+struct framering {
+  int fd;
+  struct framering_header* header;
+  size_t mapped;
+  uint64_t next; // Sequence number of the next frame to acquire / consume
+};
+
+static void futex_wait(_Atomic uint32_t* word, uint32_t value, bool timeout){
+  // The timeout is so the caller can check if the other side is still there
+  const struct timespec ts = { .tv_nsec = 100000000 };
+  syscall(SYS_futex, (void*)word, FUTEX_WAIT, value, timeout ? &ts : 0, 0, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* word){
+  syscall(SYS_futex, (void*)word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+static bool map(struct framering* ring, size_t size){
+  void* memory = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, 0);
+  if(memory == MAP_FAILED)
+    return false;
+  if(ring->header)
+    munmap(ring->header, ring->mapped);
+  ring->header = memory;
+  ring->mapped = size;
+  return true;
+}
+
+struct framering* framering_create(unsigned slot_count){
+  if(!slot_count || slot_count > FRAMERING_MAX_SLOTS)
+    goto error;
+  struct framering* ring = dparaster_calloc(1, sizeof(*ring), DPM_FRAMEBUFFER);
+  if(!ring)
+    goto error;
+  // Not close on exec, the producer is meant to inherit it
+  ring->fd = memfd_create("dparaster-framering", 0);
+  if(ring->fd == -1)
+    goto error_after_alloc;
+  if(ftruncate(ring->fd, FRAMERING_HEADER_SIZE) == -1)
+    goto error_after_open;
+  if(!map(ring, FRAMERING_HEADER_SIZE))
+    goto error_after_open;
+  ring->header->magic = FRAMERING_MAGIC;
+  ring->header->version = FRAMERING_VERSION;
+  ring->header->slot_count = slot_count;
+  atomic_store(&ring->header->state, FRS_CREATED);
+  return ring;
+error_after_open:
+  close(ring->fd);
+error_after_alloc:
+  dparaster_free(ring);
+error:
+  return 0;
+}
+
+int framering_fd(const struct framering* ring){
+  return ring->fd;
+}
+
+bool framering_wait_setup(struct framering* ring, bool (*alive)(void* param), void* param){
+  uint32_t state;
+  while((state=atomic_load(&ring->header->state)) == FRS_CREATED){
+    if(alive && !alive(param))
+      return false;
+    futex_wait(&ring->header->state, FRS_CREATED, true);
+  }
+  if(!ring->header->size)
+    return false;
+  return map(ring, ring->header->size);
+}
+
+const uint8_t (*framering_next(struct framering* ring, uint64_t* sequence, bool (*alive)(void* param), void* param))[4]{
+  struct framering_header*restrict header = ring->header;
+  struct framering_slot*restrict slot = &header->slot[ring->next % header->slot_count];
+  while(true){
+    const bool closed = atomic_load(&header->state) == FRS_CLOSED;
+    if(atomic_load(&slot->state) == FRSS_FULL){
+      if(sequence)
+        *sequence = slot->sequence;
+      return (void*)((uint8_t*)header + slot->offset);
+    }
+    if(closed)
+      return 0;
+    if(alive && !alive(param))
+      return 0;
+    futex_wait(&slot->state, FRSS_FREE, true);
+  }
+}
+
+void framering_release(struct framering* ring){
+  struct framering_slot*restrict slot = &ring->header->slot[ring->next++ % ring->header->slot_count];
+  atomic_store(&slot->state, FRSS_FREE);
+  futex_wake(&slot->state);
+}
+
+struct framering* framering_open(int fd){
+  struct framering* ring = dparaster_calloc(1, sizeof(*ring), DPM_FRAMEBUFFER);
+  if(!ring)
+    goto error;
+  ring->fd = fd;
+  if(!map(ring, FRAMERING_HEADER_SIZE))
+    goto error_after_alloc;
+  const struct framering_header* header = ring->header;
+  if( header->magic != FRAMERING_MAGIC || header->version != FRAMERING_VERSION
+   || !header->slot_count || header->slot_count > FRAMERING_MAX_SLOTS
+  ) goto error_after_map;
+  return ring;
+error_after_map:
+  munmap(ring->header, ring->mapped);
+error_after_alloc:
+  dparaster_free(ring);
+error:
+  return 0;
+}
+
+bool framering_setup(struct framering* ring, uint32_t w, uint32_t h){
+  const unsigned slot_count = ring->header->slot_count;
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  const uint64_t stride = (uint64_t)w * 4;
+  const uint64_t frame_size = stride * h;
+  const uint64_t slot_size = (frame_size + page - 1) / page * page;
+  const uint64_t size = FRAMERING_HEADER_SIZE + slot_size * slot_count;
+  if(ftruncate(ring->fd, size) == -1)
+    return false;
+  if(!map(ring, size))
+    return false;
+  struct framering_header*restrict header = ring->header;
+  header->width = w;
+  header->height = h;
+  memcpy(header->format, "BGRX", 5);
+  header->stride = stride;
+  header->frame_size = frame_size;
+  header->size = size;
+  for(unsigned i=0; i<slot_count; i++){
+    header->slot[i].offset = FRAMERING_HEADER_SIZE + slot_size * i;
+    atomic_store(&header->slot[i].state, FRSS_FREE);
+  }
+  atomic_store(&header->state, FRS_READY);
+  futex_wake(&header->state);
+  return true;
+}
+
+uint8_t (*framering_acquire(struct framering* ring, bool (*alive)(void* param), void* param))[4]{
+  struct framering_header*restrict header = ring->header;
+  struct framering_slot*restrict slot = &header->slot[ring->next % header->slot_count];
+  while(true){
+    if(atomic_load(&header->state) == FRS_CLOSED)
+      return 0;
+    if(atomic_load(&slot->state) == FRSS_FREE)
+      return (void*)((uint8_t*)header + slot->offset);
+    if(alive && !alive(param))
+      return 0;
+    futex_wait(&slot->state, FRSS_FULL, true);
+  }
+}
+
+void framering_submit(struct framering* ring){
+  struct framering_slot*restrict slot = &ring->header->slot[ring->next % ring->header->slot_count];
+  slot->sequence = ring->next++;
+  atomic_store(&slot->state, FRSS_FULL);
+  futex_wake(&slot->state);
+}
+
+void framering_close(struct framering* ring){
+  struct framering_header*restrict header = ring->header;
+  atomic_store(&header->state, FRS_CLOSED);
+  futex_wake(&header->state);
+  for(unsigned i=0; i<header->slot_count; i++)
+    futex_wake(&header->slot[i].state);
+}
+
+const struct framering_header* framering_header(const struct framering* ring){
+  return ring->header;
+}
+
+void framering_free(struct framering* ring){
+  munmap(ring->header, ring->mapped);
+  close(ring->fd);
+  dparaster_free(ring);
+}
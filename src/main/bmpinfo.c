@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -26,9 +29,11 @@ static int nointr_read_minmax(uint8_t buf[], unsigned min, unsigned max){
   return i;
 }
 
-int writeall(unsigned i, const uint8_t buf[i]){
-  int ret = 0;
-  while(i && (ret=write(9, buf, i)) == -1 && errno == EINTR){
+static int writeall_fd(int fd, size_t i, const uint8_t buf[i]){
+  while(i){
+    ssize_t ret = write(fd, buf, i);
+    if(ret == -1 && errno == EINTR)
+      continue;
     if(ret == -1){
       perror("write");
       return -1;
@@ -39,13 +44,116 @@ int writeall(unsigned i, const uint8_t buf[i]){
   return 0;
 }
 
+int writeall(unsigned i, const uint8_t buf[i]){
+  return writeall_fd(9, i, buf);
+}
+
+// Moves size bytes from stdin to stdout. If one of them is a pipe, splice is used,
+// so the data doesn't need to be copied to userspace.
+static int forward(size_t size){
+  static bool no_splice = false;
+  static uint8_t buf[1<<16];
+  while(size){
+    if(!no_splice){
+      ssize_t ret = splice(0, 0, 1, 0, size, SPLICE_F_MOVE|SPLICE_F_MORE);
+      if(ret == -1 && errno == EINTR)
+        continue;
+      if(ret == -1 && errno == EINVAL){
+        no_splice = true;
+        continue;
+      }
+      if(ret == -1){
+        perror("splice");
+        return -1;
+      }
+      if(!ret)
+        return -1;
+      size -= ret;
+    }else{
+      int ret = nointr_read_minmax(buf, 1, size < sizeof(buf) ? size : sizeof(buf));
+      if(ret <= 0)
+        return -1;
+      if(writeall_fd(1, ret, buf) == -1)
+        return -1;
+      size -= ret;
+    }
+  }
+  return 0;
+}
+
+// Reads a stream of bitmaps, and writes only their image data to stdout.
+// With dump_input, the headers of the first bitmap are kept.
+static int split_stream(bool dump_input){
+  static uint8_t buf[4096];
+  struct bmpinfo first = {0};
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while(true){
+    int i = nointr_read_minmax(buf, 54, 54);
+    if(i == -1)
+      return 1;
+    if(!i)
+      break;
+    if(i != 54){
+      fprintf(stderr,"invalid bitmap: too short\n");
+      return 2;
+    }
+    struct bmpinfo info = {0};
+    if(!bitmap_header_parse(&info, buf))
+      return 3;
+    if(!frames){
+      first = info;
+    }else if( info.width != first.width || info.height != first.height
+           || info.bits_per_pixel != first.bits_per_pixel || info.compression != first.compression
+           || info.image_data_size != first.image_data_size
+    ){
+      fprintf(stderr,"frame %"PRIu64": bitmap format changed mid-stream from %"PRIu32"x%"PRIu32" %"PRIu16"bpp to %"PRIu32"x%"PRIu32" %"PRIu16"bpp\n",
+        frames, first.width, first.height, first.bits_per_pixel, info.width, info.height, info.bits_per_pixel);
+      return 3;
+    }
+    const bool dump = dump_input && !frames;
+    if(dump && writeall_fd(1, i, buf) == -1)
+      return 5;
+    while((size_t)i < info.data_offset){
+      int ret = nointr_read_minmax(buf, 1, info.data_offset-i < sizeof(buf) ? info.data_offset-i : sizeof(buf));
+      if(ret <= 0){
+        fprintf(stderr,"invalid bitmap: too short\n");
+        return 4;
+      }
+      if(dump && writeall_fd(1, ret, buf) == -1)
+        return 5;
+      i += ret;
+    }
+    if(forward(info.image_data_size) == -1){
+      fprintf(stderr,"frame %"PRIu64": failed to forward image data\n", frames);
+      return 4;
+    }
+    frames += 1;
+    bytes += info.image_data_size;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "%"PRIu64" frames, %"PRIu64" bytes in %.3fs, %.1f frames/s, %.1f MiB/s\n",
+    frames, bytes, t, t ? frames / t : 0., t ? bytes / t / (1<<20) : 0.);
+  return 0;
+}
+
 int main(int argc, char* argv[]){
   int ret = 0;
 
   bool dump_input = false;
-  for(int i=1; i<argc; i++)
+  bool split = false;
+  for(int i=1; i<argc; i++){
     if(!strcmp(argv[i], "--dump-input"))
       dump_input = true;
+    if(!strcmp(argv[i], "--split-stream"))
+      split = true;
+  }
+
+  if(split)
+    return split_stream(dump_input);
 
   static uint8_t buf[4096];
   int i = 0;
@@ -55,6 +163,9 @@ int main(int argc, char* argv[]){
   if(dump_input && writeall(i, buf) == -1)
     ret = 5;
 
+  if(!i) // End of stream, nothing to complain about
+    return 2;
+
   if(i != 54){
     fprintf(stderr,"invalid bitmap: too short\n");
     return 2;
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dparaster/bitmap.h>
+#include <dparaster/utils.h>
+#include <dparaster/delta.h>
+
+// Reads a tile delta stream from stdin, and writes every frame to stdout as a whole bitmap.
+// This is the reference decoder for the format described in delta.h.
+
+static bool read_all(void* buf, size_t size){
+  return fread(buf, 1, size, stdin) == size;
+}
+
+int main(int argc, char* argv[]){
+  if(argc != 1){
+    fprintf(stderr, "usage: %s < delta-stream > bitmaps\n", *argv);
+    return 1;
+  }
+  int ret = 0;
+  uint32_t w = 0, h = 0;
+  uint8_t (*image)[4] = 0;
+  for(unsigned frame=0; ; frame++){
+    uint8_t header[DELTA_HEADER_SIZE];
+    const size_t got = fread(header, 1, sizeof(header), stdin);
+    if(!got)
+      break;
+    if(got != sizeof(header) || memcmp(header, DELTA_MAGIC, 4)){
+      fprintf(stderr, "frame %u: broken header\n", frame);
+      ret = 1;
+      break;
+    }
+    const uint32_t fw = u32le(header+4);
+    const uint32_t fh = u32le(header+8);
+    const uint32_t tile = u32le(header+12);
+    const uint32_t runs = u32le(header+16);
+    if(!fw || !fh || !tile || (uint64_t)fw * fh > (uint64_t)1<<30){
+      fprintf(stderr, "frame %u: bad size %ux%u, or tile size %u\n", frame, fw, fh, tile);
+      ret = 1;
+      break;
+    }
+    if(fw != w || fh != h){
+      free(image);
+      w = fw, h = fh;
+      if(!(image = calloc((size_t)w * h, sizeof(*image)))){
+        perror("calloc");
+        ret = 1;
+        break;
+      }
+    }
+    const uint32_t tiles_w = (w + tile - 1) / tile;
+    const uint32_t tiles_h = (h + tile - 1) / tile;
+    for(uint32_t r=0; r<runs; r++){
+      uint8_t run[DELTA_RUN_SIZE];
+      if(!read_all(run, sizeof(run))){
+        fprintf(stderr, "frame %u: truncated\n", frame);
+        ret = 1;
+        goto out;
+      }
+      const uint32_t ty = u32le(run);
+      const uint32_t tx = u32le(run+4);
+      const uint32_t count = u32le(run+8);
+      if(ty >= tiles_h || tx >= tiles_w || !count || count > tiles_w - tx){
+        fprintf(stderr, "frame %u: run outside of the image\n", frame);
+        ret = 1;
+        goto out;
+      }
+      const uint32_t x0 = tx * tile;
+      const uint32_t x1 = (uint64_t)(tx+count) * tile < w ? (tx+count) * tile : w;
+      for(uint32_t y=ty*tile; y<h && y<(uint64_t)(ty+1)*tile; y++){
+        if(!read_all(image + (size_t)y*w + x0, sizeof(*image) * (x1 - x0))){
+          fprintf(stderr, "frame %u: truncated\n", frame);
+          ret = 1;
+          goto out;
+        }
+      }
+    }
+    if(!bitmap_write(stdout, w, h, (void*)image)){
+      ret = 1;
+      break;
+    }
+  }
+out:
+  free(image);
+  if(fflush(stdout))
+    ret = 1;
+  return ret;
+}
@@ -0,0 +1,1112 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dparaster/rasterizer.h>
+#include <dparaster/geometry.h>
+#include <dparaster/meshopt.h>
+#include <dparaster/scene.h>
+#include <dparaster/model.h>
+#include <dparaster/delta.h>
+#include <dparaster/band.h>
+#include <dparaster/bitmap.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+// Benchmarks for parts of the pipeline, on generated meshes.
+//   vertex: memory use and vertex throughput of the attribute formats
+//   meshopt: the mesh optimizations, on the grid as an unindexed triangle soup in random order
+//   scene: frustum culling of many small boxes, of which only a few are in view
+//   hiz: many grids, most of them behind a wall, with and without depth tiles and occlusion queries
+//   meshlet: a sphere partly out of view, with back face culling per triangle and per meshlet
+//   layout: big flat shaded triangles, into framebuffers laid out row by row and in tiles
+//   delta: a field of boxes of which only one moves, redrawn fully and only where it changed
+//   msaa: the field of boxes with multisampling, and supersampled at twice the width and height
+//   memory: the field of boxes drawn threaded, with scratch memory from malloc and from an arena reset every frame
+//   clip: a coarse grid in the view, reaching far out of it, and through the near plane
+//   vrs: the field of boxes in flat colors, like CAD models, with coarse shading, at each rate and with a rate image, compared to shading every pixel
+//   bitmap: only the header of a banded 60000x40000 poster, whose image data is too big for the 32 bit sizes, parsed back
+
+struct params {
+  unsigned grid; // The mesh is a grid of grid x grid quads
+  unsigned repeat;
+  unsigned objects;
+  uint32_t w, h;
+  int count;
+  char** test;
+};
+
+struct params parse_args(int argc, char* argv[]){
+  struct params p = {
+    .grid = 1000,
+    .repeat = 3,
+    .objects = 100000,
+    .w = 800,
+    .h = 600,
+  };
+  int i = 1;
+  for(; i<argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    if(argv[i][2] != '\0' || i+1 >= argc)
+      goto usage;
+    switch(argv[i][1]){
+      case 'g': p.grid = atoi(argv[++i]); break;
+      case 'r': p.repeat = atoi(argv[++i]); break;
+      case 'o': p.objects = atoi(argv[++i]); break;
+      case 'w': p.w = atoi(argv[++i]); break;
+      case 'h': p.h = atoi(argv[++i]); break;
+      default: goto usage;
+    }
+  }
+  if(i >= argc || !p.grid || !p.repeat || !p.objects || !p.w || !p.h)
+    goto usage;
+  p.test = argv + i;
+  p.count = argc - i;
+  return p;
+usage:
+  fprintf(stderr, "usage: %s [-g grid-size|-r repetitions|-o objects|-w w|-h h] vertex|meshopt|scene|hiz|meshlet|layout|delta|msaa|memory|clip|vrs|bitmap...\n", *argv);
+  exit(1);
+}
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct grid {
+  unsigned vertex_count;
+  unsigned triangle_count;
+  Vector* position;
+  Vector* texcoord;
+  Vector* color;
+  unsigned (*index)[3];
+};
+
+// A wavy grid, seen from the front
+static bool grid_create(struct grid* mesh, unsigned grid){
+  const unsigned n = grid + 1;
+  mesh->vertex_count = n * n;
+  mesh->triangle_count = grid * grid * 2;
+  mesh->position = malloc(sizeof(Vector) * mesh->vertex_count);
+  mesh->texcoord = malloc(sizeof(Vector) * mesh->vertex_count);
+  mesh->color = malloc(sizeof(Vector) * mesh->vertex_count);
+  mesh->index = malloc(sizeof(*mesh->index) * mesh->triangle_count);
+  if(!mesh->position || !mesh->texcoord || !mesh->color || !mesh->index)
+    return false;
+  for(unsigned y=0; y<n; y++)
+  for(unsigned x=0; x<n; x++){
+    const float u = (float)x / grid, v = (float)y / grid;
+    mesh->position[y*n+x] = (Vector){{ u*1.8f-0.9f, v*1.8f-0.9f, sinf(u*12) * cosf(v*9) * 0.1f, 1 }};
+    mesh->texcoord[y*n+x] = (Vector){{ u, v }};
+    mesh->color[y*n+x] = (Vector){{ u, v, 1-u, 1 }};
+  }
+  for(unsigned y=0, t=0; y<grid; y++)
+  for(unsigned x=0; x<grid; x++){
+    const unsigned i = y*n+x;
+    memcpy(mesh->index[t++], (unsigned[]){ i, i+1, i+n }, sizeof(*mesh->index));
+    memcpy(mesh->index[t++], (unsigned[]){ i+1, i+n+1, i+n }, sizeof(*mesh->index));
+  }
+  return true;
+}
+
+static void grid_free(struct grid* mesh){
+  free(mesh->position);
+  free(mesh->texcoord);
+  free(mesh->color);
+  free(mesh->index);
+}
+
+struct vertex_config {
+  const char* name;
+  enum attribute_format format[AIN_COUNT];
+  enum index_type index_type;
+};
+
+static const struct vertex_config vertex_config[] = {
+  { "vector, u32 indices",             {AF_VECTOR,    AF_VECTOR,   AF_VECTOR   }, IT_U32 },
+  { "f32x3 f32x2 unorm8, u32 indices", {AF_FLOAT32X3, AF_UNORM8X4, AF_FLOAT32X2}, IT_U32 },
+  { "f16 f16 unorm8, u16 indices",     {AF_FLOAT16X4, AF_UNORM8X4, AF_FLOAT16X4}, IT_U16 },
+  { "snorm16 snorm16 unorm8, u16",     {AF_SNORM16X4, AF_UNORM8X4, AF_SNORM16X4}, IT_U16 },
+};
+
+// Converts the mesh to the formats of the config, returns the memory it takes, or 0
+static size_t vertex_geometry(const struct grid* mesh, const struct vertex_config* config, Geometry* g, void* buffer[AIN_COUNT+1]){
+  const Vector* source[AIN_COUNT] = {
+    [AIN_POSITION] = mesh->position,
+    [AIN_COLOR] = mesh->color,
+    [AIN_TEXCOORD] = mesh->texcoord,
+  };
+  size_t memory = 0;
+  *g = (Geometry){ .triangle_count = mesh->triangle_count };
+  const bool index16 = config->index_type == IT_U16 && mesh->vertex_count <= 0x10000;
+  const size_t index_size = sizeof(uint16_t[3]) * mesh->triangle_count;
+  uint16_t (*index)[3] = 0;
+  if(index16){
+    index = buffer[AIN_COUNT] = malloc(index_size);
+    if(!index)
+      return 0;
+    for(unsigned t=0; t<mesh->triangle_count; t++)
+      for(unsigned k=0; k<3; k++)
+        index[t][k] = mesh->index[t][k];
+    memory += index_size;
+  }else{
+    memory += sizeof(*mesh->index) * mesh->triangle_count;
+  }
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
+    const enum attribute_format format = config->format[j];
+    const unsigned size = attribute_format_size(format);
+    uint8_t* data = buffer[j] = malloc((size_t)size * mesh->vertex_count);
+    if(!data)
+      return 0;
+    for(unsigned i=0; i<mesh->vertex_count; i++)
+      attribute_pack(format, data + (size_t)i*size, source[j][i]);
+    memory += (size_t)size * mesh->vertex_count;
+    g->attribute[j] = (Attribute){ .data = data, .format = format };
+    if(index16){
+      g->attribute[j].index16 = (const uint16_t(*)[3])index;
+      g->attribute[j].index_type = IT_U16;
+    }else{
+      g->attribute[j].index = (const unsigned(*)[3])mesh->index;
+    }
+  }
+  return memory;
+}
+
+static bool bench_vertex(const struct params* p){
+  struct grid mesh = {0};
+  bool ok = false;
+  if(!grid_create(&mesh, p->grid))
+    goto out;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  printf("vertex: %u triangles, %u vertices, %ux%u\n", mesh.triangle_count, mesh.vertex_count, p->w, p->h);
+  printf("  %-32s %10s %14s %10s\n", "formats", "memory", "vertices/s", "draw");
+  const Uniform uniform = { .modelview = indentity_matrix, .light = {{1,-1,-1,1}} };
+  for(size_t c=0; c<sizeof(vertex_config)/sizeof(*vertex_config); c++){
+    Geometry g;
+    void* buffer[AIN_COUNT+1] = {0};
+    const size_t memory = vertex_geometry(&mesh, &vertex_config[c], &g, buffer);
+    if(memory){
+      double process = 1e30, full = 1e30;
+      for(unsigned r=0; r<p->repeat; r++){
+        double start = now();
+        for(unsigned i=0; i<g.triangle_count; i++){
+          Triangle triangle[SHADER_MAX_ATTRIBUTES];
+          process_triangle(&shader_default, &uniform, &g, i, triangle);
+        }
+        double t = now() - start;
+        if(t < process) process = t;
+        framebuffer_clear(fb);
+        start = now();
+        draw(fb, &shader_default, &uniform, &g);
+        t = now() - start;
+        if(t < full) full = t;
+      }
+      printf("  %-32s %8.2fMB %12.2fM %8.1fms\n", vertex_config[c].name, memory / 1e6, g.triangle_count * 3. / process / 1e6, full * 1000);
+    }
+    for(unsigned j=0; j<=AIN_COUNT; j++)
+      free(buffer[j]);
+    if(!memory)
+      goto out_after_fb;
+  }
+  ok = true;
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  grid_free(&mesh);
+  return ok;
+}
+
+static double draw_time(Framebuffer* fb, const Geometry* g, unsigned repeat){
+  const Uniform uniform = { .modelview = indentity_matrix, .light = {{1,-1,-1,1}} };
+  double best = 1e30;
+  for(unsigned r=0; r<repeat; r++){
+    framebuffer_clear(fb);
+    const double start = now();
+    draw(fb, &shader_default, &uniform, g);
+    const double t = now() - start;
+    if(t < best) best = t;
+  }
+  return best;
+}
+
+static void meshopt_report(Framebuffer* fb, const struct params* p, const char* step, const Mesh* mesh, double time){
+  const Geometry g = mesh_geometry(mesh);
+  printf("  %-14s %9u %8.3f %8.3f %8.1fms %8.1fms\n", step, mesh->vertex_count,
+    mesh_acmr(mesh, 16), mesh_acmr(mesh, 32), time * 1000, draw_time(fb, &g, p->repeat) * 1000);
+}
+
+static bool bench_meshopt(const struct params* p){
+  struct grid grid = {0};
+  Vector* soup[AIN_COUNT] = {0};
+  Mesh mesh = {0};
+  bool ok = false;
+  if(!grid_create(&grid, p->grid))
+    goto out;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+
+  // Every triangle gets its own vertices, and the triangles are shuffled
+  const Vector* source[AIN_COUNT] = {
+    [AIN_POSITION] = grid.position,
+    [AIN_COLOR] = grid.color,
+    [AIN_TEXCOORD] = grid.texcoord,
+  };
+  unsigned* order = malloc(sizeof(*order) * grid.triangle_count);
+  if(!order)
+    goto out_after_fb;
+  for(unsigned t=0; t<grid.triangle_count; t++)
+    order[t] = t;
+  uint32_t random = 1;
+  for(unsigned t=grid.triangle_count; t>1; t--){
+    random = random * 1664525 + 1013904223;
+    const unsigned j = (uint64_t)random * t >> 32;
+    const unsigned tmp = order[t-1];
+    order[t-1] = order[j];
+    order[j] = tmp;
+  }
+  Geometry g = { .triangle_count = grid.triangle_count };
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
+    soup[j] = malloc(sizeof(Vector) * grid.triangle_count * 3);
+    if(!soup[j])
+      goto out_after_order;
+    for(unsigned t=0; t<grid.triangle_count; t++)
+      for(unsigned k=0; k<3; k++)
+        soup[j][t*3+k] = source[j][grid.index[order[t]][k]];
+    g.attribute[j].vertex = soup[j];
+  }
+
+  printf("meshopt: %u triangles, %ux%u\n", grid.triangle_count, p->w, p->h);
+  printf("  %-14s %9s %8s %8s %10s %10s\n", "step", "vertices", "acmr16", "acmr32", "time", "draw");
+  printf("  %-14s %9u %8.3f %8.3f %10s %8.1fms\n", "soup", grid.triangle_count * 3, 3., 3., "", draw_time(fb, &g, p->repeat) * 1000);
+  double start = now();
+  if(!mesh_weld(&mesh, &g))
+    goto out_after_order;
+  meshopt_report(fb, p, "weld", &mesh, now() - start);
+  start = now();
+  if(!mesh_optimize_vertex_cache(&mesh))
+    goto out_after_mesh;
+  meshopt_report(fb, p, "vertex cache", &mesh, now() - start);
+  start = now();
+  const unsigned clusters = mesh_optimize_overdraw(&mesh, 1.05);
+  if(!clusters)
+    goto out_after_mesh;
+  meshopt_report(fb, p, "overdraw", &mesh, now() - start);
+  start = now();
+  if(!mesh_optimize_vertex_fetch(&mesh))
+    goto out_after_mesh;
+  meshopt_report(fb, p, "vertex fetch", &mesh, now() - start);
+  printf("  %u overdraw clusters\n", clusters);
+  ok = true;
+
+out_after_mesh:
+  mesh_free(&mesh);
+out_after_order:
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+    free(soup[j]);
+  free(order);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  grid_free(&grid);
+  return ok;
+}
+
+static float random_float(uint32_t* state){
+  *state = *state * 1664525 + 1013904223;
+  return *state / 4294967296.f;
+}
+
+// Boxes spread over a field 6 times as wide as the view, so about 3% of them are visible
+static bool bench_scene(const struct params* p){
+  bool ok = false;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  Framebuffer* reference = framebuffer_create(p->w, p->h, 0);
+  if(!reference)
+    goto out_after_fb;
+  struct scene* scene = scene_create();
+  if(!scene)
+    goto out_after_reference;
+  int* visible = malloc(sizeof(*visible) * p->objects);
+  if(!visible)
+    goto out_after_scene;
+  uint32_t random = 1;
+  for(unsigned i=0; i<p->objects; i++){
+    const float angle = random_float(&random) * 360;
+    Matrix m = mmulm(rotateY(angle), scale(0.1 + random_float(&random) * 0.2));
+    for(unsigned j=0; j<3; j++)
+      m.axis[3].data[j] = random_float(&random) * (j < 2 ? 120 : 20) - (j < 2 ? 60 : 10);
+    if(scene_add(scene, &box, m) < 0)
+      goto out_after_visible;
+  }
+  const Uniform uniform = {
+    .modelview = mmulm(scale(0.1), rotateX(20)),
+    .light = {{1,-1,-1,1}},
+  };
+
+  double start = now();
+  if(!scene_build(scene))
+    goto out_after_visible;
+  const double build = now() - start;
+  start = now();
+  scene_refit(scene);
+  const double refit = now() - start;
+  struct scene_stats stats;
+  double cull = 1e30, culled = 1e30, all = 1e30;
+  for(unsigned r=0; r<p->repeat; r++){
+    start = now();
+    scene_cull(scene, uniform.modelview, 1.f / p->w, visible, &stats);
+    double t = now() - start;
+    if(t < cull) cull = t;
+    framebuffer_clear(fb);
+    start = now();
+    scene_draw(fb, &shader_default, &uniform, scene, &stats);
+    t = now() - start;
+    if(t < culled) culled = t;
+    framebuffer_clear(reference);
+    start = now();
+    for(unsigned i=0; i<p->objects; i++){
+      Uniform u = uniform;
+      u.modelview = mmulm(uniform.modelview, scene_get_transform(scene, i));
+      draw(reference, &shader_default, &u, scene_get_geometry(scene, i));
+    }
+    t = now() - start;
+    if(t < all) all = t;
+  }
+  printf("scene: %u objects, %u visible, %u culled, %u nodes visited, %llu triangles drawn\n",
+    stats.objects, stats.visible, stats.culled, stats.nodes_visited, stats.triangles);
+  printf("  build %.1fms, refit %.1fms, cull %.3fms\n", build * 1000, refit * 1000, cull * 1000);
+  printf("  draw all %.1fms, draw culled %.1fms\n", all * 1000, culled * 1000);
+  ok = !memcmp(framebuffer_image(fb), framebuffer_image(reference), sizeof(*fb->image) * p->w * p->h);
+  if(!ok)
+    fprintf(stderr, "scene: culling changed the image\n");
+
+out_after_visible:
+  free(visible);
+out_after_scene:
+  scene_free(scene);
+out_after_reference:
+  framebuffer_free(reference);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+struct hiz_scene {
+  const Geometry* grid;
+  const Geometry* proxy; // A box around the grid
+  unsigned count;
+};
+
+// A wall in front, the grids behind it, in layers of 8x8. Returns the number of grids drawn.
+static unsigned hiz_draw(Framebuffer* fb, const struct hiz_scene* s, bool conditional){
+  const Matrix view = rotateX(10);
+  Uniform u = {
+    .modelview = mmulm(view, scale3d((Vector){{0.8, 0.8, 0.05, 1}})),
+    .light = {{1,-1,-1,1}},
+  };
+  u.modelview.axis[3].data[2] = -0.5;
+  framebuffer_clear(fb);
+  draw(fb, &shader_default, &u, &box);
+  unsigned drawn = 0;
+  for(unsigned i=0; i<s->count; i++){
+    Matrix m = scale(0.12);
+    m.axis[3] = (Vector){{ (i % 8) * 0.25f - 0.875f, (i / 8 % 8) * 0.25f - 0.875f, 0.1f + (i / 64) * 0.1f, 1 }};
+    u.modelview = mmulm(view, m);
+    if(!conditional){
+      draw(fb, &shader_default, &u, s->grid);
+      drawn++;
+    }else{
+      drawn += draw_conditional(fb, &shader_default, &u, s->grid, s->proxy);
+    }
+  }
+  return drawn;
+}
+
+static bool bench_hiz(const struct params* p){
+  bool ok = false;
+  struct grid grid = {0};
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  Framebuffer* reference = framebuffer_create(p->w, p->h, 0);
+  if(!reference)
+    goto out_after_fb;
+  if(!grid_create(&grid, p->grid < 100 ? p->grid : 40)) // Small grids, unless asked for
+    goto out_after_reference;
+  const Geometry g = {
+    .triangle_count = grid.triangle_count,
+    .attribute = {
+      [AIN_POSITION] = { .vertex = grid.position, .index = (const unsigned(*)[3])grid.index },
+      [AIN_COLOR]    = { .vertex = grid.color,    .index = (const unsigned(*)[3])grid.index },
+      [AIN_TEXCOORD] = { .vertex = grid.texcoord, .index = (const unsigned(*)[3])grid.index },
+    },
+  };
+  Vector bounds[2];
+  geometry_bounds(&g, bounds);
+  Vector corner[8];
+  for(unsigned i=0; i<8; i++) // In the same order as the ones of the box model
+    corner[i] = (Vector){{ bounds[i&1].data[0], bounds[i>>1&1].data[1], bounds[i>>2].data[2], 1 }};
+  const Geometry proxy = {
+    .triangle_count = box.triangle_count,
+    .attribute[AIN_POSITION] = { .vertex = corner, .index = box.attribute[AIN_POSITION].index },
+  };
+  const struct hiz_scene s = {
+    .grid = &g,
+    .proxy = &proxy,
+    .count = 64 * 4,
+  };
+
+  printf("hiz: %u grids of %u triangles, %ux%u\n", s.count, g.triangle_count, p->w, p->h);
+  const char* name[] = {"no depth tiles", "depth tiles", "occlusion queries"};
+  for(unsigned mode=0; mode<3; mode++){
+    Framebuffer* target = mode ? fb : reference;
+    if(!framebuffer_set_hiz(target, mode > 0))
+      goto out_after_grid;
+    double best = 1e30;
+    unsigned drawn = 0;
+    for(unsigned r=0; r<p->repeat; r++){
+      const double start = now();
+      drawn = hiz_draw(target, &s, mode == 2);
+      const double t = now() - start;
+      if(t < best) best = t;
+    }
+    printf("  %-18s %8.1fms, %u grids drawn\n", name[mode], best * 1000, drawn);
+    if(mode > 1 && memcmp(framebuffer_image(fb), framebuffer_image(reference), sizeof(*fb->image) * p->w * p->h)){
+      fprintf(stderr, "hiz: %s changed the image\n", name[mode]);
+      goto out_after_grid;
+    }
+  }
+  ok = true;
+
+out_after_grid:
+  grid_free(&grid);
+out_after_reference:
+  framebuffer_free(reference);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+static atomic_ulong vertices_shaded;
+
+static void counting_vertex(const Uniform*restrict uniform, Vector out[], const Vector in[AIN_COUNT]){
+  atomic_fetch_add_explicit(&vertices_shaded, 1, memory_order_relaxed);
+  shader_default_vertex(uniform, out, in);
+}
+
+static bool bench_meshlet(const struct params* p){
+  bool ok = false;
+  struct grid grid = {0};
+  Mesh mesh = {0};
+  struct meshlet* meshlet = 0;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  Framebuffer* reference = framebuffer_create(p->w, p->h, 0);
+  if(!reference)
+    goto out_after_fb;
+  // The grid, wrapped around a sphere. The seam and the poles get welded.
+  if(!grid_create(&grid, p->grid))
+    goto out_after_reference;
+  for(unsigned i=0; i<grid.vertex_count; i++){
+    const float u = grid.texcoord[i].data[0], v = grid.texcoord[i].data[1];
+    const float theta = v * M_PI, phi = u * 2 * M_PI;
+    grid.position[i] = (Vector){{ sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi), 1 }};
+  }
+  const Geometry g = {
+    .triangle_count = grid.triangle_count,
+    .attribute = {
+      [AIN_POSITION] = { .vertex = grid.position, .index = (const unsigned(*)[3])grid.index },
+      [AIN_COLOR]    = { .vertex = grid.color,    .index = (const unsigned(*)[3])grid.index },
+      [AIN_TEXCOORD] = { .vertex = grid.texcoord, .index = (const unsigned(*)[3])grid.index },
+    },
+  };
+  if(!mesh_weld(&mesh, &g) || !mesh_optimize_vertex_cache(&mesh) || !mesh_optimize_vertex_fetch(&mesh))
+    goto out_after_grid;
+  Geometry sphere = mesh_geometry(&mesh);
+  double start = now();
+  unsigned meshlet_count;
+  meshlet = geometry_build_meshlets(&sphere, &meshlet_count);
+  if(!meshlet)
+    goto out_after_grid;
+  const double build = now() - start;
+
+  ShaderProgram shader = shader_default;
+  shader.vertex = counting_vertex;
+  Uniform uniform = {
+    .modelview = mmulm(rotateX(30), scale(0.8)),
+    .light = {{1,-1,-1,1}},
+  };
+  uniform.modelview.axis[3].data[0] = 0.7; // Partly out of view
+  // Scaled unevenly after rotating, the sphere becomes an ellipsoid reaching farther out than its
+  // axes are long, which meshlet culling has to take into account
+  Matrix skewed = mmulm(mmulm(scale3d((Vector){{3, 0.5, 0.5, 1}}), rotateZ(45)), rotateX(30));
+  skewed.axis[3].data[0] = 1.6;
+  const struct {
+    const char* name;
+    Matrix modelview;
+  } view[] = {
+    { "", uniform.modelview },
+    { ", skewed", skewed },
+  };
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const unsigned threads = cpus > 1 ? cpus : 2;
+  printf("meshlet: %u triangles, %u meshlets built in %.1fms, %ux%u\n", sphere.triangle_count, meshlet_count, build * 1000, p->w, p->h);
+  char threaded[32];
+  snprintf(threaded, sizeof(threaded), "meshlets, %u threads", threads);
+  const char* name[] = {"no culling", "back faces", "meshlets", threaded};
+  // Back face culling changes a few pixels at the edges, the others should look just like it
+  for(size_t v=0; v<sizeof(view)/sizeof(*view); v++){
+    uniform.modelview = view[v].modelview;
+    for(unsigned mode=0; mode<4; mode++){
+      Framebuffer* target = mode == 1 ? reference : fb;
+      sphere.cull_back_faces = mode > 0;
+      sphere.meshlet = mode > 1 ? meshlet : 0;
+      sphere.meshlet_count = mode > 1 ? meshlet_count : 0;
+      double best = 1e30;
+      for(unsigned r=0; r<p->repeat; r++){
+        framebuffer_clear(target);
+        atomic_store(&vertices_shaded, 0);
+        start = now();
+        if(mode == 3){
+          draw_threaded(target, &shader, &uniform, &sphere, threads);
+        }else{
+          draw(target, &shader, &uniform, &sphere);
+        }
+        const double t = now() - start;
+        if(t < best) best = t;
+      }
+      char label[64];
+      snprintf(label, sizeof(label), "%s%s", name[mode], view[v].name);
+      printf("  %-28s %8.1fms, %lu vertices shaded\n", label, best * 1000, (unsigned long)atomic_load(&vertices_shaded));
+      if(mode > 1 && memcmp(framebuffer_image(fb), framebuffer_image(reference), sizeof(*fb->image) * p->w * p->h)){
+        fprintf(stderr, "meshlet: %s changed the image\n", label);
+        goto out_after_meshlet;
+      }
+    }
+  }
+  ok = true;
+
+out_after_meshlet:
+  dparaster_free(meshlet);
+out_after_grid:
+  mesh_free(&mesh);
+  grid_free(&grid);
+out_after_reference:
+  framebuffer_free(reference);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+// Just the color, so the time goes to getting at the pixels rather than to shading them
+static void flat_triangle(const Uniform*restrict uniform, Triangle out[restrict], const Triangle in[restrict AIN_COUNT]){
+  (void)uniform, (void)out, (void)in;
+}
+
+static void flat_vertex(const Uniform*restrict uniform, Vector out[], const Vector in[AIN_COUNT]){
+  out[0] = mmulv(uniform->modelview, in[AIN_POSITION]);
+  out[1] = in[AIN_COLOR];
+}
+
+static Vector flat_fragment(const Uniform*restrict uniform, double*restrict depth, Vector varying[restrict]){
+  (void)uniform, (void)depth;
+  return varying[1];
+}
+
+static const ShaderProgram shader_flat = {
+  .attribute_count = 2,
+  .triangle = flat_triangle,
+  .vertex   = flat_vertex,
+  .fragment = flat_fragment,
+};
+
+// Triangles with random corners anywhere in the view, most of them span many rows
+static bool bench_layout(const struct params* p){
+  enum { TRIANGLES = 64 };
+  bool ok = false;
+  Vector position[TRIANGLES*3], color[TRIANGLES*3];
+  uint32_t random = 1;
+  for(unsigned i=0; i<TRIANGLES*3; i++){
+    position[i] = (Vector){{ random_float(&random)*2-1, random_float(&random)*2-1, random_float(&random)*2-1, 1 }};
+    color[i] = (Vector){{ random_float(&random), random_float(&random), random_float(&random), 1 }};
+  }
+  const Geometry g = {
+    .triangle_count = TRIANGLES,
+    .attribute = {
+      [AIN_POSITION] = { .vertex = position },
+      [AIN_COLOR]    = { .vertex = color },
+    },
+  };
+  const Uniform uniform = { .modelview = indentity_matrix };
+  Framebuffer* reference = framebuffer_create(p->w, p->h, 0);
+  if(!reference)
+    goto out;
+  draw(reference, &shader_flat, &uniform, &g);
+
+  printf("layout: %u triangles, %ux%u, %llu pixels drawn\n", TRIANGLES, p->w, p->h, (unsigned long long)reference->samples_passed);
+  printf("  %-22s %10s %10s %10s\n", "layout", "clear", "draw", "detile");
+  const struct {
+    const char* name;
+    enum framebuffer_flags flags;
+  } layout[] = {
+    { "rows", 0 },
+    { "rows, huge pages", FBF_HUGEPAGES },
+    { "tiles", FBF_TILED },
+    { "tiles, huge pages", FBF_TILED|FBF_HUGEPAGES },
+  };
+  for(size_t l=0; l<sizeof(layout)/sizeof(*layout); l++){
+    Framebuffer* fb = framebuffer_create_with_flags(p->w, p->h, layout[l].flags);
+    if(!fb)
+      goto out_after_reference;
+    double clear = 1e30, full = 1e30, detile = 1e30;
+    const uint8_t (*image)[4] = 0;
+    for(unsigned r=0; r<p->repeat; r++){
+      double start = now();
+      framebuffer_clear(fb);
+      double t = now() - start;
+      if(t < clear) clear = t;
+      start = now();
+      draw(fb, &shader_flat, &uniform, &g);
+      t = now() - start;
+      if(t < full) full = t;
+      start = now();
+      image = framebuffer_image(fb);
+      t = now() - start;
+      if(t < detile) detile = t;
+    }
+    printf("  %-22s %8.2fms %8.2fms %8.2fms\n", layout[l].name, clear * 1000, full * 1000, detile * 1000);
+    const bool same = !memcmp(image, framebuffer_image(reference), sizeof(*image) * p->w * p->h);
+    framebuffer_free(fb);
+    if(!same){
+      fprintf(stderr, "layout: %s changed the image\n", layout[l].name);
+      goto out_after_reference;
+    }
+  }
+  ok = true;
+
+out_after_reference:
+  framebuffer_free(reference);
+out:
+  return ok;
+}
+
+enum { COLUMNS = 24, ROWS = 16 };
+
+// A field of small boxes, turned in all directions
+static void box_field(Uniform u[COLUMNS*ROWS], Matrix view){
+  for(unsigned i=0; i<COLUMNS*ROWS; i++){
+    Matrix m = mmulm(rotateY(i * 7), scale(0.7f / COLUMNS));
+    m.axis[3] = (Vector){{ (i % COLUMNS + 0.5f) * 2.f / COLUMNS - 1, (i / COLUMNS + 0.5f) * 2.f / ROWS - 1, 0, 1 }};
+    u[i] = (Uniform){ .modelview = mmulm(view, m), .light = {{1,-1,-1,1}} };
+  }
+}
+
+static bool bench_delta(const struct params* p){
+  enum { FRAMES = 30 };
+  bool ok = false;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  struct delta_renderer* dr = delta_renderer_create(p->w, p->h, 0);
+  if(!dr)
+    goto out_after_fb;
+  char* stream = 0;
+  size_t stream_size = 0;
+  FILE* of = open_memstream(&stream, &stream_size);
+  if(!of)
+    goto out_after_dr;
+
+  const Matrix view = mmulm(scale(0.9), rotateX(20));
+  Uniform u[COLUMNS*ROWS];
+  box_field(u, view);
+  const unsigned moving = COLUMNS * (ROWS / 2) + COLUMNS / 2;
+  const Matrix moving_model = mmulm(view, scale(0.7f / COLUMNS));
+
+  double full = 0, incremental = 0;
+  unsigned long dirty = 0, redrawn = 0;
+  struct delta_stats stats = {0};
+  for(unsigned f=0; f<FRAMES; f++){
+    u[moving].modelview = mmulm(moving_model, mmulm(rotateY(f * 5), rotateX(f * 3)));
+    u[moving].modelview.axis[3] = mmulv(view, (Vector){{ f * 0.01f, 1.f / ROWS, 0, 1 }});
+
+    double start = now();
+    framebuffer_clear(fb);
+    for(unsigned i=0; i<COLUMNS*ROWS; i++)
+      draw(fb, &shader_default, &u[i], &box);
+    framebuffer_resolve(fb);
+    full += now() - start;
+
+    start = now();
+    for(unsigned i=0; i<COLUMNS*ROWS; i++)
+      if(!delta_draw(dr, &shader_default, &u[i], &box))
+        goto out_after_of;
+    const Framebuffer* result = delta_render(dr, &stats);
+    if(!result)
+      goto out_after_of;
+    incremental += now() - start;
+    if(f){
+      dirty += stats.dirty;
+      redrawn += stats.redrawn;
+    }
+    if(!delta_write(dr, of))
+      goto out_after_of;
+    if(memcmp(framebuffer_image(result), fb->image, sizeof(*fb->image) * p->w * p->h)){
+      fprintf(stderr, "delta: frame %u differs from the full one\n", f);
+      goto out_after_of;
+    }
+  }
+  if(fflush(of))
+    goto out_after_of;
+  printf("delta: %u boxes, one moving, %u frames, %ux%u\n", COLUMNS*ROWS, FRAMES, p->w, p->h);
+  printf("  full redraw   %8.1fms/frame, %8.1fKB/frame as bitmap\n", full * 1000 / FRAMES, (54. + 4. * p->w * p->h) / 1000);
+  printf("  incremental   %8.1fms/frame, %8.1fKB/frame as tile delta, the first one whole\n", incremental * 1000 / FRAMES, stream_size / 1000. / FRAMES);
+  printf("  after the first frame, %.1f of %u tiles and %.1f of %u draws redrawn per frame\n",
+    (double)dirty / (FRAMES-1), stats.tiles, (double)redrawn / (FRAMES-1), stats.draws);
+  ok = true;
+
+out_after_of:
+  fclose(of);
+  free(stream);
+out_after_dr:
+  delta_renderer_free(dr);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+static atomic_ulong fragments_shaded;
+
+static Vector counting_fragment(const Uniform*restrict uniform, double*restrict depth, Vector varying[restrict]){
+  atomic_fetch_add_explicit(&fragments_shaded, 1, memory_order_relaxed);
+  return shader_default_fragment(uniform, depth, varying);
+}
+
+static bool bench_msaa(const struct params* p){
+  bool ok = false;
+  ShaderProgram shader = shader_default;
+  shader.fragment = counting_fragment;
+  Uniform u[COLUMNS*ROWS];
+  box_field(u, mmulm(rotateY(10), rotateX(30)));
+  printf("msaa: %u boxes, %ux%u\n", COLUMNS*ROWS, p->w, p->h);
+  printf("  %-22s %10s %10s %12s\n", "mode", "draw", "resolve", "fragments");
+  const struct {
+    const char* name;
+    enum framebuffer_flags flags;
+    unsigned scale; // Supersampling
+  } mode[] = {
+    { "1 sample", 0, 1 },
+    { "msaa 2x", FBF_MSAA_2X, 1 },
+    { "msaa 4x", FBF_MSAA_4X, 1 },
+    { "msaa 8x", FBF_MSAA_8X, 1 },
+    { "supersampled 4x", 0, 2 },
+  };
+  for(size_t m=0; m<sizeof(mode)/sizeof(*mode); m++){
+    const unsigned s = mode[m].scale;
+    Framebuffer* fb = framebuffer_create_with_flags(p->w * s, p->h * s, mode[m].flags);
+    if(!fb)
+      goto out;
+    uint8_t (*small)[4] = s > 1 ? malloc(sizeof(*small) * p->w * p->h) : 0;
+    if(s > 1 && !small){
+      framebuffer_free(fb);
+      goto out;
+    }
+    double full = 1e30, resolve = 1e30;
+    for(unsigned r=0; r<p->repeat; r++){
+      framebuffer_clear(fb);
+      atomic_store(&fragments_shaded, 0);
+      double start = now();
+      for(unsigned i=0; i<COLUMNS*ROWS; i++)
+        draw(fb, &shader, &u[i], &box);
+      double t = now() - start;
+      if(t < full) full = t;
+      start = now();
+      framebuffer_resolve(fb);
+      if(s > 1){ // A box filter, like the external downscaling this replaces
+        const uint32_t w = p->w;
+        for(uint32_t y=0; y<p->h; y++)
+          for(uint32_t x=0; x<w; x++)
+            for(unsigned c=0; c<4; c++)
+              small[y*w+x][c] = (fb->image[(2*y)*2*w+2*x][c] + fb->image[(2*y)*2*w+2*x+1][c]
+                + fb->image[(2*y+1)*2*w+2*x][c] + fb->image[(2*y+1)*2*w+2*x+1][c] + 2) / 4;
+      }
+      t = now() - start;
+      if(t < resolve) resolve = t;
+    }
+    printf("  %-22s %8.1fms %8.2fms %12lu\n", mode[m].name, full * 1000, resolve * 1000, (unsigned long)atomic_load(&fragments_shaded));
+    free(small);
+    framebuffer_free(fb);
+  }
+  ok = true;
+out:
+  return ok;
+}
+
+static void print_memory(const char* name, const struct dparaster_memory_stats* before){
+  static const char*const category[DPM_COUNT] = {
+    [DPM_TEXTURE] = "texture",
+    [DPM_FRAMEBUFFER] = "framebuffer",
+    [DPM_GEOMETRY] = "geometry",
+    [DPM_SCRATCH] = "scratch",
+  };
+  struct dparaster_memory_stats stats;
+  dparaster_memory_stats(&stats);
+  printf("  %s, peak %zuKB\n", name, stats.total_peak / 1024);
+  for(unsigned i=0; i<DPM_COUNT; i++)
+    printf("    %-12s %10zuKB in use %10zuKB peak %10llu allocations\n", category[i], stats.current[i] / 1024, stats.peak[i] / 1024, stats.allocations[i] - before->allocations[i]);
+}
+
+static bool bench_memory(const struct params* p){
+  bool ok = false;
+  const unsigned frames = 20;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  struct dparaster_arena* arena = dparaster_arena_create(0);
+  if(!arena)
+    goto out_after_fb;
+  Uniform u[COLUMNS*ROWS];
+  box_field(u, mmulm(rotateY(10), rotateX(30)));
+  printf("memory: %u frames of %u boxes, %ux%u\n", frames, COLUMNS*ROWS, p->w, p->h);
+  size_t demand = 0;
+  // The second arena is big enough for a whole frame, the first one finds out how big that is
+  for(unsigned mode=0; mode<3; mode++){
+    if(mode == 2){
+      dparaster_arena_free(arena);
+      if(!(arena = dparaster_arena_create(demand)))
+        goto out_after_fb;
+    }
+    dparaster_set_allocator(DPM_SCRATCH, mode ? dparaster_arena_allocator(arena) : 0);
+    dparaster_memory_reset_peak();
+    struct dparaster_memory_stats before;
+    dparaster_memory_stats(&before);
+    double best = 1e30;
+    for(unsigned r=0; r<p->repeat; r++){
+      const double start = now();
+      for(unsigned f=0; f<frames; f++){
+        framebuffer_clear(fb);
+        for(unsigned i=0; i<COLUMNS*ROWS; i++)
+          draw_threaded(fb, &shader_default, &u[i], &box, 2); // Processes the vertices into scratch memory
+        const size_t used = dparaster_arena_reset(arena);
+        if(mode && used > demand)
+          demand = used;
+      }
+      const double t = (now() - start) / frames;
+      if(t < best) best = t;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s, %.1fms/frame", mode ? mode == 1 ? "empty arena" : "arena" : "malloc", best * 1000);
+    print_memory(name, &before);
+  }
+  printf("  a frame needs %zuKB of scratch memory\n", demand / 1024);
+  dparaster_set_allocator(DPM_SCRATCH, 0);
+  ok = true;
+
+  dparaster_arena_free(arena);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+static bool bench_clip(const struct params* p){
+  struct grid mesh = {0};
+  bool ok = false;
+  if(!grid_create(&mesh, 256))
+    goto out;
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out_after_grid;
+  const Geometry g = {
+    .triangle_count = mesh.triangle_count,
+    .attribute = {
+      [AIN_POSITION] = { .vertex = mesh.position, .index = (const unsigned(*)[3])mesh.index },
+      [AIN_COLOR]    = { .vertex = mesh.color,    .index = (const unsigned(*)[3])mesh.index },
+    },
+  };
+  printf("clip: %u triangles, %ux%u\n", mesh.triangle_count, p->w, p->h);
+  const struct {
+    const char* name;
+    Matrix modelview;
+  } view[] = {
+    { "in the view", scale(0.9) },
+    { "8 times the view", scale(8) },
+    { "1000 times the view", scale(1000) },
+    { "through the near plane", mmulm(rotateX(60), scale(4)) },
+  };
+  for(size_t v=0; v<sizeof(view)/sizeof(*view); v++){
+    const Uniform uniform = { .modelview = view[v].modelview };
+    double best = 1e30;
+    for(unsigned r=0; r<p->repeat; r++){
+      framebuffer_clear(fb);
+      begin_query(fb);
+      const double start = now();
+      draw(fb, &shader_flat, &uniform, &g);
+      const double t = now() - start;
+      if(t < best) best = t;
+    }
+    printf("  %-24s %8.2fms, %llu pixels drawn\n", view[v].name, best * 1000, (unsigned long long)end_query(fb));
+  }
+  ok = true;
+
+  framebuffer_free(fb);
+out_after_grid:
+  grid_free(&mesh);
+out:
+  return ok;
+}
+
+static bool bench_vrs(const struct params* p){
+  bool ok = false;
+  ShaderProgram shader = shader_default;
+  shader.fragment = counting_fragment;
+  Uniform u[COLUMNS*ROWS];
+  box_field(u, mmulm(rotateY(10), rotateX(30)));
+  const Geometry flat_box = geometry_with_flat_color(&box, (Vector){{0.8,0.8,0.6,1}});
+  Framebuffer* fb = framebuffer_create(p->w, p->h, 0);
+  if(!fb)
+    goto out;
+  uint8_t (*reference)[4] = malloc(sizeof(*reference) * p->w * p->h);
+  if(!reference)
+    goto out_after_fb;
+  // Full rate in the middle of the view, 4x4 around it
+  const uint32_t tiles_w = (p->w + FB_TILE - 1) / FB_TILE, tiles_h = (p->h + FB_TILE - 1) / FB_TILE;
+  uint8_t* rate_image = malloc(tiles_w * tiles_h);
+  if(!rate_image)
+    goto out_after_reference;
+  for(uint32_t ty=0; ty<tiles_h; ty++)
+    for(uint32_t tx=0; tx<tiles_w; tx++)
+      rate_image[ty*tiles_w+tx] = tx < tiles_w/4 || tx >= tiles_w*3/4 || ty < tiles_h/4 || ty >= tiles_h*3/4 ? SR_4X4 : SR_1X1;
+  printf("vrs: %u boxes, %ux%u\n", COLUMNS*ROWS, p->w, p->h);
+  printf("  %-22s %10s %12s %16s %9s\n", "rate", "draw", "fragments", "pixels changed", "max diff");
+  const struct {
+    const char* name;
+    enum shading_rate rate;
+    const uint8_t* image;
+  } mode[] = {
+    { "1x1", SR_1X1, 0 },
+    { "2x1", SR_2X1, 0 },
+    { "1x2", SR_1X2, 0 },
+    { "2x2", SR_2X2, 0 },
+    { "4x4", SR_4X4, 0 },
+    { "4x4 around the middle", SR_1X1, rate_image },
+  };
+  for(size_t m=0; m<sizeof(mode)/sizeof(*mode); m++){
+    if(!framebuffer_set_shading_rate(fb, mode[m].rate, mode[m].image))
+      goto out_after_rate_image;
+    double best = 1e30;
+    for(unsigned r=0; r<p->repeat; r++){
+      framebuffer_clear(fb);
+      atomic_store(&fragments_shaded, 0);
+      const double start = now();
+      for(unsigned i=0; i<COLUMNS*ROWS; i++)
+        draw(fb, &shader, &u[i], &flat_box);
+      const double t = now() - start;
+      if(t < best) best = t;
+    }
+    framebuffer_resolve(fb);
+    if(!m)
+      memcpy(reference, fb->image, sizeof(*reference) * p->w * p->h);
+    unsigned long changed = 0;
+    int max_diff = 0;
+    for(size_t i=0; i<(size_t)p->w*p->h; i++){
+      changed += !!memcmp(reference[i], fb->image[i], sizeof(*reference));
+      for(unsigned c=0; c<3; c++)
+        if(abs(reference[i][c] - fb->image[i][c]) > max_diff)
+          max_diff = abs(reference[i][c] - fb->image[i][c]);
+    }
+    printf("  %-22s %8.1fms %12lu %16lu %9d\n", mode[m].name, best * 1000, (unsigned long)atomic_load(&fragments_shaded), changed, max_diff);
+  }
+  ok = true;
+
+out_after_rate_image:
+  free(rate_image);
+out_after_reference:
+  free(reference);
+out_after_fb:
+  framebuffer_free(fb);
+out:
+  return ok;
+}
+
+// Writing the whole poster would take 9.6GB, the header is what changes for that size
+static bool bench_bitmap(const struct params* p){
+  (void)p;
+  const uint32_t w = 60000, h = 40000;
+  bool ok = false;
+  const double start = now();
+  struct band_renderer* br = band_renderer_create(w, h, 16);
+  const double t = now() - start;
+  if(!br){
+    fprintf(stderr, "bitmap: no band renderer for %ux%u\n", w, h);
+    goto out;
+  }
+  uint8_t header[54];
+  bitmap_header_build(header, w, h);
+  struct bmpinfo info;
+  if(!bitmap_header_parse(&info, header)){
+    fprintf(stderr, "bitmap: the header of %ux%u doesn't parse\n", w, h);
+    goto out_after_br;
+  }
+  printf("bitmap: %ux%u, band renderer created in %.2fms\n", w, h, t * 1000);
+  printf("  file size %"PRIu32", image size %"PRIu32", %zu bytes of image data\n", info.file_size, info.image_size, info.image_data_size);
+  ok = info.width == w && info.height == h && info.image_data_size == (size_t)w * h * 4;
+  if(!ok)
+    fprintf(stderr, "bitmap: the header of %ux%u describes the wrong image\n", w, h);
+
+out_after_br:
+  band_renderer_free(br);
+out:
+  return ok;
+}
+
+int main(int argc, char* argv[]){
+  const struct params p = parse_args(argc, argv);
+  int ret = 0;
+  for(int i=0; i<p.count; i++){
+    bool ok;
+    if(!strcmp(p.test[i], "vertex")){
+      ok = bench_vertex(&p);
+    }else if(!strcmp(p.test[i], "meshopt")){
+      ok = bench_meshopt(&p);
+    }else if(!strcmp(p.test[i], "scene")){
+      ok = bench_scene(&p);
+    }else if(!strcmp(p.test[i], "hiz")){
+      ok = bench_hiz(&p);
+    }else if(!strcmp(p.test[i], "meshlet")){
+      ok = bench_meshlet(&p);
+    }else if(!strcmp(p.test[i], "layout")){
+      ok = bench_layout(&p);
+    }else if(!strcmp(p.test[i], "delta")){
+      ok = bench_delta(&p);
+    }else if(!strcmp(p.test[i], "msaa")){
+      ok = bench_msaa(&p);
+    }else if(!strcmp(p.test[i], "memory")){
+      ok = bench_memory(&p);
+    }else if(!strcmp(p.test[i], "clip")){
+      ok = bench_clip(&p);
+    }else if(!strcmp(p.test[i], "vrs")){
+      ok = bench_vrs(&p);
+    }else if(!strcmp(p.test[i], "bitmap")){
+      ok = bench_bitmap(&p);
+    }else{
+      fprintf(stderr, "unknown benchmark: %s\n", p.test[i]);
+      ok = false;
+    }
+    if(!ok)
+      ret = 1;
+  }
+  return ret;
+}
@@ -1,24 +1,54 @@
+#define _POSIX_C_SOURCE 200809L
 #include <dparaster/model.h>
 #include <dparaster/bitmap.h>
+#include <dparaster/qoi.h>
 #include <dparaster/texture.h>
 #include <dparaster/rasterizer.h>
+#include <dparaster/render_queue.h>
+#include <dparaster/band.h>
+#include <dparaster/framering.h>
+#include <dparaster/delta.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 // program logic
 struct params {
   const char* file;
+  const char* texture;
   uint32_t w;
   uint32_t h;
   double ry, rx;
+  unsigned n;
+  double sy;
+  unsigned j;
+  uint32_t b;
+  int r;
+  bool qoi;
+  bool delta;
+  enum framebuffer_flags fb_flags;
+  enum shading_rate shading_rate;
+};
+
+struct scene {
+  const struct params* p;
+  Vector light;
+  struct texture* logo;
+  Geometry cube;
 };
 
 struct params parse_args(int argc, char* argv[]){
   struct params p = {
+    .texture = "assets/logo.bmp",
     .w = 800,
     .h = 600,
     .ry = -20,
-    .rx =  25
+    .rx =  25,
+    .n = 1,
+    .sy = 1,
+    .j = 1,
+    .r = -1,
   };
   for(int i=1; i<argc; i++){
     if(argv[i][0] == '-' && argv[i][1] != '\0'){
@@ -29,6 +59,72 @@ struct params parse_args(int argc, char* argv[]){
         case 'h': p.h = atoi(argv[++i]); break;
         case 'y': p.ry = atof(argv[++i]); break;
         case 'x': p.rx = atof(argv[++i]); break;
+        case 'n': p.n = atoi(argv[++i]); break;
+        case 's': p.sy = atof(argv[++i]); break;
+        case 'j': p.j = atoi(argv[++i]); break;
+        case 'b': p.b = atoi(argv[++i]); break;
+        case 'r': p.r = atoi(argv[++i]); break;
+        case 't': p.texture = argv[++i]; break;
+        case 'f': {
+          i++;
+          p.qoi = p.delta = false;
+          if(!strcmp(argv[i], "qoi")){
+            p.qoi = true;
+          }else if(!strcmp(argv[i], "delta")){
+            p.delta = true;
+          }else if(strcmp(argv[i], "bmp")) goto usage;
+        } break;
+        case 'l': {
+          i++;
+          p.fb_flags &= ~(FBF_TILED|FBF_HUGEPAGES);
+          if(!strcmp(argv[i], "tiled")){
+            p.fb_flags |= FBF_TILED|FBF_HUGEPAGES;
+          }else if(strcmp(argv[i], "linear")) goto usage;
+        } break;
+        case 'm': {
+          const int samples = atoi(argv[++i]);
+          p.fb_flags &= ~FBF_MSAA_MASK;
+          switch(samples){
+            case 1: break;
+            case 2: p.fb_flags |= FBF_MSAA_2X; break;
+            case 4: p.fb_flags |= FBF_MSAA_4X; break;
+            case 8: p.fb_flags |= FBF_MSAA_8X; break;
+            default: goto usage;
+          }
+        } break;
+        case 'c': { // The format, then tonemap or dither, separated by commas
+          p.fb_flags &= ~(FBF_FORMAT_MASK|FBF_TONEMAP|FBF_DITHER);
+          const char* format = strtok(argv[++i], ",");
+          if(!format) goto usage;
+          if(!strcmp(format, "rgb10a2")){
+            p.fb_flags |= FBF_RGB10A2;
+          }else if(!strcmp(format, "half")){
+            p.fb_flags |= FBF_FLOAT16;
+          }else if(!strcmp(format, "float")){
+            p.fb_flags |= FBF_FLOAT32;
+          }else if(strcmp(format, "bgrx")) goto usage;
+          for(const char* option; (option = strtok(0, ",")); ){
+            if(!strcmp(option, "tonemap")){
+              p.fb_flags |= FBF_TONEMAP;
+            }else if(!strcmp(option, "dither")){
+              p.fb_flags |= FBF_DITHER;
+            }else goto usage;
+          }
+        } break;
+        case 'v': {
+          i++;
+          if(!strcmp(argv[i], "1x1")){
+            p.shading_rate = SR_1X1;
+          }else if(!strcmp(argv[i], "2x1")){
+            p.shading_rate = SR_2X1;
+          }else if(!strcmp(argv[i], "1x2")){
+            p.shading_rate = SR_1X2;
+          }else if(!strcmp(argv[i], "2x2")){
+            p.shading_rate = SR_2X2;
+          }else if(!strcmp(argv[i], "4x4")){
+            p.shading_rate = SR_4X4;
+          }else goto usage;
+        } break;
         default: goto usage;
       }
     }else{
@@ -37,59 +133,196 @@ struct params parse_args(int argc, char* argv[]){
       p.file = argv[i];
     }
   }
-  if(!p.file)
+  // Bands and frame rings come with their own row by row buffers
+  if((!p.file && p.r < 0) || !p.n || !p.j || ((p.qoi || p.delta) && p.b) || (p.fb_flags && (p.b || p.r >= 0))
+  || (p.shading_rate && (p.b || p.delta)))
     goto usage;
   return p;
 usage:
-  fprintf(stderr, "usage: %s [-w w|-h h|-y ry|-x rx] file.bmp\n", *argv);
+  fprintf(stderr, "usage: %s [-w w|-h h|-y ry|-x rx|-n frames|-s y-step|-j jobs|-b band-rows|-t texture|-f bmp|qoi|delta|-l linear|tiled|-m samples|-c bgrx|rgb10a2|half|float[,tonemap][,dither]|-v 1x1|2x1|1x2|2x2|4x4] file\n"
+                  "       %s [-w w|-h h|-y ry|-x rx|-n frames|-s y-step|-t texture|-v 1x1|2x1|1x2|2x2|4x4] -r framering-fd\n", *argv, *argv);
   exit(1);
 }
 
-int main(int argc, char* argv[]){
-  int ret = 0;
-  const struct params p = parse_args(argc, argv);
-
-  // Where do we place the light?
-  Vector light = {{1,-1,-1, 1}};
+static Uniform scene_uniform(const struct scene* scene, render_fence frame){
+  const struct params* p = scene->p;
 
   // We rotate the world
   Matrix m_view = indentity_matrix;
-  m_view = mmulm(rotateY(p.ry), m_view);
-  m_view = mmulm(rotateX(p.rx), m_view);
+  m_view = mmulm(rotateY(p->ry + p->sy * frame), m_view);
+  m_view = mmulm(rotateX(p->rx), m_view);
+
+  Matrix m_model = scale(0.5); // We scale down our cube
+  return (Uniform){
+    .modelview = mmulm(m_view, m_model),
+    .light = scene->light, // This places the light relative to the camera
+//    .light = mmulv(m_view, light), // This places it in the world (so it's rotated with it and so on
+    .tex = scene->logo,
+  };
+}
+
+static void render(void* param, Framebuffer* fb, render_fence frame){
+  const struct scene* scene = param;
+  const Uniform uniform = scene_uniform(scene, frame);
+  // Without the memory for coarse shading, every pixel just gets shaded
+  framebuffer_set_shading_rate(fb, scene->p->shading_rate, 0);
+  draw(fb, &shader_default, &uniform, &scene->cube);
+}
+
+// Only a few rows of the image are kept in memory at once, for images too big for that
+static bool render_banded(const struct scene* scene, FILE* of){
+  const struct params* p = scene->p;
+  if(!bitmap_size_fits(p->w, p->h)){
+    fprintf(stderr, "%ux%u is too big for a bitmap\n", p->w, p->h);
+    return false;
+  }
+  struct band_renderer* br = band_renderer_create(p->w, p->h, p->b);
+  if(!br)
+    return false;
+  bool ok = true;
+  for(unsigned i=0; ok && i<p->n; i++){
+    const Uniform uniform = scene_uniform(scene, i);
+    ok = band_draw(br, &shader_default, &uniform, &scene->cube)
+      && band_write(br, of);
+  }
+  band_renderer_free(br);
+  return ok;
+}
+
+// The consumer started us, if we got another parent, it's gone
+static bool parent_alive(void* param){
+  return getppid() == *(const pid_t*)param;
+}
+
+// Frames are drawn right into the shared memory of the consumer
+static bool render_framering(const struct scene* scene){
+  const struct params* p = scene->p;
+  struct framering* ring = framering_open(p->r);
+  if(!ring)
+    return false;
+  bool ok = framering_setup(ring, p->w, p->h);
+  Framebuffer* fb = 0;
+  pid_t parent = getppid();
+  for(unsigned i=0; ok && i<p->n; i++){
+    uint8_t (*image)[4] = framering_acquire(ring, parent_alive, &parent);
+    if(!image){
+      ok = false;
+      break;
+    }
+    if(!fb && !(fb = framebuffer_create(p->w, p->h, image))){
+      ok = false;
+      break;
+    }
+    fb->image = image;
+    framebuffer_clear(fb);
+    render((void*)scene, fb, i);
+    framebuffer_resolve(fb);
+    framering_submit(ring);
+  }
+  framering_close(ring);
+  if(fb)
+    framebuffer_free(fb);
+  framering_free(ring);
+  return ok;
+}
+
+// Frames are rendered one after another into the same framebuffer, only what changed gets
+// redrawn, and only the tiles which changed are written. See deltacat for turning them into bitmaps.
+static bool render_delta(const struct scene* scene, FILE* of){
+  const struct params* p = scene->p;
+  struct delta_renderer* dr = delta_renderer_create(p->w, p->h, p->fb_flags);
+  if(!dr)
+    return false;
+  bool ok = true;
+  for(unsigned i=0; ok && i<p->n; i++){
+    const Uniform uniform = scene_uniform(scene, i);
+    ok = delta_draw(dr, &shader_default, &uniform, &scene->cube)
+      && delta_render(dr, 0)
+      && delta_write(dr, of);
+  }
+  delta_renderer_free(dr);
+  return ok;
+}
+
+static bool output(void* param, const Framebuffer* fb, render_fence frame){
+  (void)frame;
+  return bitmap_write(param, fb->w, fb->h, (void*)framebuffer_image(fb));
+}
+
+static bool output_qoi(void* param, const Framebuffer* fb, render_fence frame){
+  (void)frame;
+  return qoi_write(param, fb->w, fb->h, (void*)framebuffer_image(fb));
+}
 
-  // Initialise screen buffer
-  uint8_t (*image)[p.w][4] = calloc(1,sizeof(uint8_t[p.h][p.w][4]));
-  if(!image)
+int main(int argc, char* argv[]){
+  int ret = 0;
+  const struct params p = parse_args(argc, argv);
+
+  // The texture gets loaded while everything else is being set up
+  struct texture_future* logo = texture_load_async(p.texture, TLF_POPULATE|TLF_HUGEPAGES);
+  if(!logo)
     return 1;
-  double (*depth)[p.w] = malloc(sizeof(double[p.h][p.w]));
-  if(!depth){
-    free(image);
+
+  FILE* of = stdout;
+  if(p.file && strcmp(p.file, "-") && !(of = fopen(p.file, "wb"))){
+    perror("fopen");
+    texture_future_free(logo);
     return 1;
   }
-  for(uint32_t y=0; y<p.h; y++)
-    for(uint32_t x=0; x<p.w; x++)
-      depth[y][x] = INFINITY;
-
-  struct texture* logo = texture_load("assets/logo.bmp");
-
-  // Draw image
-  {
-    Matrix m_model = scale(0.5); // We scale down our cube
-    Geometry yellow_box = geometry_with_flat_color(&box, (Vector){{1,1,0,1}});
-    draw(p.w,p.h,image,depth, &shader_default, &(Uniform){
-      .modelview = mmulm(m_view, m_model),
-      .light = light, // This places the light relative to the camera
-//      .light = mmulv(m_view, light), // This places it in the world (so it's rotated with it and so on
-      .tex = logo,
-    }, &yellow_box);
+
+  struct scene scene = {
+    .p = &p,
+    .light = {{1,-1,-1, 1}}, // Where do we place the light?
+    .cube = geometry_with_flat_color(&box, (Vector){{1,1,0,1}}), // A yellow box
+  };
+  if(!(scene.logo = texture_future_wait(logo))){
+    fprintf(stderr, "failed to load %s\n", p.texture);
+    ret = 1;
+    goto out;
+  }
+
+  if(p.r >= 0){
+    if(!render_framering(&scene))
+      ret = 1;
+    goto out;
   }
 
-  texture_free(logo);
+  if(p.delta){
+    if(!render_delta(&scene, of))
+      ret = 1;
+    goto out;
+  }
 
-  if(!bitmap_save(p.file, p.w,p.h,image))
+  if(p.b){
+    if(!render_banded(&scene, of))
+      ret = 1;
+    goto out;
+  }
+
+  // Frame N gets written while the next p.j frames are being drawn
+  struct render_queue* queue = render_queue_create(&(struct render_queue_config){
+    .w = p.w,
+    .h = p.h,
+    .workers = p.j,
+    .buffers = p.j + 2,
+    .framebuffer_flags = p.fb_flags,
+    .output = p.qoi ? output_qoi : output,
+    .output_param = of,
+  });
+  if(!queue){
     ret = 1;
+    goto out;
+  }
 
-  free(depth);
-  free(image);
+  for(unsigned i=0; i<p.n; i++)
+    render_queue_submit(queue, render, 0, &scene);
+  if(!render_queue_finish(queue))
+    ret = 1;
+
+  render_queue_destroy(queue);
+out:
+  texture_future_free(logo);
+  if(fclose(of))
+    ret = 1;
   return ret;
 }
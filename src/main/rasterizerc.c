@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+#include <inttypes.h>
+#include <dparaster/rasterizerd.h>
+
+// A client for rasterizerd. With -n, it requests that many frames, and prints their latency.
+
+struct params {
+  const char* file;
+  const char* socket;
+  struct rasterizerd_request request;
+  unsigned n;
+};
+
+struct params parse_args(int argc, char* argv[]){
+  struct params p = {
+    .socket = RASTERIZERD_SOCKET,
+    .request = {
+      .magic = RASTERIZERD_MAGIC,
+      .format = RDF_BMP,
+      .w = 800,
+      .h = 600,
+      .ry = -20,
+      .rx =  25,
+    },
+    .n = 1,
+  };
+  for(int i=1; i<argc; i++){
+    if(argv[i][0] == '-' && argv[i][1] != '\0'){
+      if(argv[i][2] != '\0')
+        goto usage;
+      if(argv[i][1] == 'i'){
+        p.request.flags |= RDR_INLINE;
+        continue;
+      }
+      if(i+1 >= argc)
+        goto usage;
+      switch(argv[i][1]){
+        case 'w': p.request.w = atoi(argv[++i]); break;
+        case 'h': p.request.h = atoi(argv[++i]); break;
+        case 'y': p.request.ry = atof(argv[++i]); break;
+        case 'x': p.request.rx = atof(argv[++i]); break;
+        case 'n': p.n = atoi(argv[++i]); break;
+        case 'S': p.socket = argv[++i]; break;
+        case 'f': {
+          i++;
+          if(!strcmp(argv[i], "bmp")){
+            p.request.format = RDF_BMP;
+          }else if(!strcmp(argv[i], "raw")){
+            p.request.format = RDF_RAW;
+          }else goto usage;
+        } break;
+        default: goto usage;
+      }
+    }else{
+      if(i+1 != argc)
+        goto usage;
+      p.file = argv[i];
+    }
+  }
+  if(!p.file || !p.n)
+    goto usage;
+  return p;
+usage:
+  fprintf(stderr, "usage: %s [-S socket|-w w|-h h|-y ry|-x rx|-f bmp|raw|-i|-n count] file\n", *argv);
+  exit(1);
+}
+
+static bool recv_all(int fd, void* data, size_t size){
+  while(size){
+    ssize_t ret = recv(fd, data, size, MSG_WAITALL);
+    if(ret == -1 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      return false;
+    data = (uint8_t*)data + ret;
+    size -= ret;
+  }
+  return true;
+}
+
+// Returns the frame data, or 0
+static void* request_frame(int sock, const struct rasterizerd_request* request, struct rasterizerd_reply* reply){
+  if(send(sock, request, sizeof(*request), MSG_NOSIGNAL) != sizeof(*request)){
+    perror("send");
+    return 0;
+  }
+  union {
+    struct cmsghdr header;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg = {
+    .msg_iov = &(struct iovec){ .iov_base = reply, .iov_len = sizeof(*reply) },
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+  ssize_t ret;
+  while((ret=recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+  int fd = -1;
+  for(struct cmsghdr* cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg))
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  if(ret <= 0 || (ret < (ssize_t)sizeof(*reply) && !recv_all(sock, (uint8_t*)reply+ret, sizeof(*reply)-ret))){
+    fprintf(stderr, "failed to receive reply\n");
+    goto error;
+  }
+  if(reply->magic != RASTERIZERD_MAGIC || reply->status != RDS_OK){
+    fprintf(stderr, "request failed with status %"PRIu32"\n", reply->status);
+    goto error;
+  }
+  if(reply->has_fd){
+    if(fd == -1)
+      goto error;
+    void* memory = mmap(0, reply->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return memory == MAP_FAILED ? 0 : memory;
+  }
+  void* memory = mmap(0, reply->size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED)
+    goto error;
+  if(!recv_all(sock, memory, reply->size)){
+    munmap(memory, reply->size);
+    goto error;
+  }
+  return memory;
+error:
+  if(fd != -1)
+    close(fd);
+  return 0;
+}
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]){
+  const struct params p = parse_args(argc, argv);
+
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if(strlen(p.socket) >= sizeof(address.sun_path)){
+    fprintf(stderr, "socket path too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, p.socket);
+  int sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(sock == -1 || connect(sock, (struct sockaddr*)&address, sizeof(address)) == -1){
+    perror("connect");
+    return 1;
+  }
+
+  double min = INFINITY, max = 0, total = 0;
+  struct rasterizerd_reply reply;
+  void* frame = 0;
+  for(unsigned i=0; i<p.n; i++){
+    if(frame)
+      munmap(frame, reply.size);
+    const double start = now();
+    frame = request_frame(sock, &p.request, &reply);
+    const double t = now() - start;
+    if(!frame)
+      return 1;
+    if(t < min) min = t;
+    if(t > max) max = t;
+    total += t;
+  }
+  close(sock);
+
+  if(p.n > 1)
+    fprintf(stderr, "%u requests: min %.3fms, avg %.3fms, max %.3fms\n", p.n, min*1000, total/p.n*1000, max*1000);
+
+  FILE* of = stdout;
+  if(strcmp(p.file, "-") && !(of = fopen(p.file, "wb"))){
+    perror("fopen");
+    return 1;
+  }
+  int ret = 0;
+  if(fwrite(frame, 1, reply.size, of) != reply.size)
+    ret = 1;
+  if(fclose(of))
+    ret = 1;
+  munmap(frame, reply.size);
+  return ret;
+}
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dparaster/model.h>
+#include <dparaster/bitmap.h>
+#include <dparaster/texture.h>
+#include <dparaster/rasterizer.h>
+#include <dparaster/rasterizerd.h>
+
+// Keeps the scene, textures and buffers around, and renders frames on request.
+// See dparaster/rasterizerd.h for the protocol.
+
+#define MAX_CLIENTS 64
+// The framebuffer, the depth buffer and the frame take about 28 bytes a pixel, so this allows
+// 4 megapixels, like 2560x1600, in about 120MB. -p changes it.
+#define DEFAULT_MAX_PIXELS ((uint64_t)1<<22)
+
+static struct {
+  Vector light;
+  struct texture_cache* textures; // If a texture changes, the next frame will use the new one
+  Geometry cube;
+  Framebuffer* fb; // Kept around, so the depth buffer needn't be allocated for every frame
+} scene;
+
+static uint64_t max_pixels = DEFAULT_MAX_PIXELS;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig){
+  (void)sig;
+  stop = true;
+}
+
+static void render(Framebuffer* fb, double ry, double rx){
+  const struct texture* logo = texture_cache_acquire(scene.textures, "assets/logo.bmp");
+
+  // We rotate the world
+  Matrix m_view = indentity_matrix;
+  m_view = mmulm(rotateY(ry), m_view);
+  m_view = mmulm(rotateX(rx), m_view);
+
+  Matrix m_model = scale(0.5); // We scale down our cube
+  draw(fb, &shader_default, &(Uniform){
+    .modelview = mmulm(m_view, m_model),
+    .light = scene.light,
+    .tex = logo,
+  }, &scene.cube);
+
+  if(logo)
+    texture_cache_release(scene.textures, logo);
+}
+
+// Draws the frame right into a memfd, which can then be passed to the client
+static int render_memfd(const struct rasterizerd_request* request, uint64_t* size){
+  const uint64_t offset = request->format == RDF_BMP ? 54 : 0;
+  *size = offset + (uint64_t)request->w * request->h * 4;
+  int fd = memfd_create("rasterizerd-frame", MFD_CLOEXEC);
+  if(fd == -1)
+    goto error;
+  if(ftruncate(fd, *size) == -1)
+    goto error_after_open;
+  uint8_t* memory = mmap(0, *size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(memory == MAP_FAILED)
+    goto error_after_open;
+  if(request->format == RDF_BMP)
+    bitmap_header_build(memory, request->w, request->h);
+  uint8_t (*image)[4] = (void*)(memory + offset);
+  if(scene.fb && (scene.fb->w != request->w || scene.fb->h != request->h)){
+    framebuffer_free(scene.fb);
+    scene.fb = 0;
+  }
+  if(!scene.fb && !(scene.fb = framebuffer_create(request->w, request->h, image)))
+    goto error_after_mmap;
+  scene.fb->image = image;
+  framebuffer_clear(scene.fb);
+  render(scene.fb, request->ry, request->rx);
+  framebuffer_resolve(scene.fb);
+  munmap(memory, *size);
+  return fd;
+error_after_mmap:
+  munmap(memory, *size);
+error_after_open:
+  close(fd);
+error:
+  return -1;
+}
+
+// Clients are served one step at a time, whenever their socket is ready, so a slow client can't hold
+// up the others. A client either sends a request, or gets the reply to its last one. Rendering the
+// frame isn't split up like that, everyone waits for it, which max_pixels keeps short.
+struct client {
+  int socket;
+  struct rasterizerd_request request;
+  size_t received; // Bytes of the request so far
+  struct rasterizerd_reply reply;
+  uint64_t sent;   // Bytes of the reply so far, and of the frame data following it
+  int fd;          // The frame, until it was passed along with the reply, or -1
+  uint8_t* data;   // The frame, if it's sent inline, or 0
+  bool replying;
+};
+
+enum progress {
+  P_DONE,
+  P_BLOCKED, // The socket isn't ready, try again once poll says so
+  P_FAILED,
+};
+
+static void client_init(struct client* c, int socket){
+  *c = (struct client){ .socket = socket, .fd = -1 };
+}
+
+static void reply_done(struct client* c){
+  if(c->fd != -1)
+    close(c->fd);
+  if(c->data)
+    munmap(c->data, c->reply.size);
+  c->fd = -1;
+  c->data = 0;
+  c->replying = false;
+  c->received = 0;
+}
+
+static void client_close(struct client* c){
+  reply_done(c);
+  close(c->socket);
+}
+
+static enum progress receive_request(struct client* c){
+  while(c->received < sizeof(c->request)){
+    const ssize_t ret = recv(c->socket, (uint8_t*)&c->request + c->received, sizeof(c->request) - c->received, 0);
+    if(ret == -1 && errno == EINTR)
+      continue;
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return P_BLOCKED;
+    if(ret <= 0)
+      return P_FAILED;
+    c->received += ret;
+  }
+  return P_DONE;
+}
+
+static enum progress send_reply(struct client* c){
+  while(c->sent < sizeof(c->reply)){
+    struct msghdr msg = {
+      .msg_iov = &(struct iovec){ .iov_base = (uint8_t*)&c->reply + c->sent, .iov_len = sizeof(c->reply) - c->sent },
+      .msg_iovlen = 1,
+    };
+    union {
+      struct cmsghdr header;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if(c->fd != -1){
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &c->fd, sizeof(int));
+    }
+    const ssize_t ret = sendmsg(c->socket, &msg, MSG_NOSIGNAL);
+    if(ret == -1 && errno == EINTR)
+      continue;
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return P_BLOCKED;
+    if(ret <= 0)
+      return P_FAILED;
+    // It went along with the first byte
+    if(c->fd != -1){
+      close(c->fd);
+      c->fd = -1;
+    }
+    c->sent += ret;
+  }
+  const uint64_t total = sizeof(c->reply) + (c->data ? c->reply.size : 0);
+  while(c->sent < total){
+    const ssize_t ret = send(c->socket, c->data + (c->sent - sizeof(c->reply)), total - c->sent, MSG_NOSIGNAL);
+    if(ret == -1 && errno == EINTR)
+      continue;
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return P_BLOCKED;
+    if(ret <= 0)
+      return P_FAILED;
+    c->sent += ret;
+  }
+  reply_done(c);
+  return P_DONE;
+}
+
+// Renders the frame, and gets the reply ready to be sent
+static void handle_request(struct client* c){
+  const struct rasterizerd_request* request = &c->request;
+  c->reply = (struct rasterizerd_reply){
+    .magic = RASTERIZERD_MAGIC,
+    .status = RDS_OK,
+    .format = request->format,
+    .w = request->w,
+    .h = request->h,
+  };
+  c->sent = 0;
+  c->replying = true;
+  if( request->magic != RASTERIZERD_MAGIC
+   || (request->format != RDF_BMP && request->format != RDF_RAW)
+   || !request->w || !request->h || (uint64_t)request->w * request->h > max_pixels
+  ){
+    c->reply.status = RDS_BAD_REQUEST;
+    return;
+  }
+  int fd = render_memfd(request, &c->reply.size);
+  if(fd == -1){
+    c->reply.status = RDS_FAILED;
+    c->reply.size = 0;
+    return;
+  }
+  if(request->flags & RDR_INLINE){
+    void* memory = mmap(0, c->reply.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+      c->reply.status = RDS_FAILED;
+      c->reply.size = 0;
+      return;
+    }
+    c->data = memory;
+  }else{
+    c->reply.has_fd = true;
+    c->fd = fd;
+  }
+}
+
+// Whether some other server is listening on the socket. One nobody listens on anymore is
+// left over from a server which didn't exit cleanly, and can be replaced.
+static bool socket_in_use(const struct sockaddr_un* address){
+  int probe = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(probe == -1)
+    return false;
+  const bool in_use = connect(probe, (const struct sockaddr*)address, sizeof(*address)) == 0
+                   || (errno != ECONNREFUSED && errno != ENOENT);
+  close(probe);
+  return in_use;
+}
+
+int main(int argc, char* argv[]){
+  const char* path = RASTERIZERD_SOCKET;
+  for(int i=1; i<argc; i++){
+    if(argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i+1 >= argc)
+      goto usage;
+    switch(argv[i][1]){
+      case 'S': path = argv[++i]; break;
+      case 'p': {
+        char* end;
+        max_pixels = strtoull(argv[++i], &end, 10);
+        if(!max_pixels || *end)
+          goto usage;
+      } break;
+      default: goto usage;
+    }
+  }
+
+  scene.light = (Vector){{1,-1,-1, 1}};
+  scene.textures = texture_cache_create(TEXTURE_CACHE_UNLIMITED);
+  if(!scene.textures)
+    return 1;
+  scene.cube = geometry_with_flat_color(&box, (Vector){{1,1,0,1}});
+
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(address.sun_path)){
+    fprintf(stderr, "socket path too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, path);
+  int listener = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(listener == -1){
+    perror("socket");
+    return 1;
+  }
+  if(socket_in_use(&address)){
+    fprintf(stderr, "%s is in use, is another server running?\n", path);
+    return 1;
+  }
+  unlink(path);
+  if(bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1){
+    perror("bind");
+    return 1;
+  }
+  if(listen(listener, 16) == -1){
+    perror("listen");
+    return 1;
+  }
+
+  struct sigaction action = { .sa_handler = on_signal };
+  sigaction(SIGINT, &action, 0);
+  sigaction(SIGTERM, &action, 0);
+
+  // pfd[i] is for client[i], pfd[0] for the listener
+  struct pollfd pfd[MAX_CLIENTS+1] = {{ .fd = listener, .events = POLLIN }};
+  struct client client[MAX_CLIENTS+1];
+  unsigned count = 1;
+  while(!stop){
+    if(poll(pfd, count, -1) == -1){
+      if(errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+    for(unsigned i=count; i-- > 1; ){
+      if(!pfd[i].revents)
+        continue;
+      struct client* c = &client[i];
+      enum progress progress = c->replying ? send_reply(c) : receive_request(c);
+      if(progress == P_DONE && !c->replying){
+        handle_request(c);
+        progress = send_reply(c);
+      }
+      if(progress == P_FAILED){
+        client_close(c);
+        pfd[i] = pfd[--count];
+        client[i] = client[count];
+        continue;
+      }
+      pfd[i].events = c->replying ? POLLOUT : POLLIN;
+    }
+    if(pfd[0].revents & POLLIN){
+      int fd = accept4(listener, 0, 0, SOCK_CLOEXEC|SOCK_NONBLOCK);
+      if(fd != -1){
+        if(count < MAX_CLIENTS+1){
+          client_init(&client[count], fd);
+          pfd[count++] = (struct pollfd){ .fd = fd, .events = POLLIN };
+        }else{
+          close(fd);
+        }
+      }
+    }
+  }
+
+  for(unsigned i=1; i<count; i++)
+    client_close(&client[i]);
+  close(listener);
+  unlink(path);
+  if(scene.fb)
+    framebuffer_free(scene.fb);
+  texture_cache_free(scene.textures);
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-S socket|-p max-pixels]\n", *argv);
+  return 1;
+}
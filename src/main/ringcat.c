@@ -0,0 +1,85 @@
+#define _DEFAULT_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dparaster/bitmap.h>
+#include <dparaster/framering.h>
+
+// Runs a command, which renders frames into a framering, and writes them to stdout as bitmaps.
+// The fd of the framering is passed to the command in the RING_FD environment variable.
+
+struct child {
+  pid_t pid;
+  int status;
+  bool exited;
+};
+
+static bool child_alive(void* param){
+  struct child* child = param;
+  if(!child->exited && waitpid(child->pid, &child->status, WNOHANG) == child->pid)
+    child->exited = true;
+  return !child->exited;
+}
+
+int main(int argc, char* argv[]){
+  unsigned slots = 3;
+  int i = 1;
+  if(i+1 < argc && !strcmp(argv[i], "-s")){
+    slots = atoi(argv[i+1]);
+    i += 2;
+  }
+  if(i+1 != argc){
+    fprintf(stderr, "usage: %s [-s slots] command\n", *argv);
+    return 1;
+  }
+  const char* command = argv[i];
+
+  struct framering* ring = framering_create(slots);
+  if(!ring){
+    perror("framering_create");
+    return 1;
+  }
+
+  char fd[16];
+  snprintf(fd, sizeof(fd), "%d", framering_fd(ring));
+  struct child child = {0};
+  child.pid = fork();
+  if(child.pid == -1){
+    perror("fork");
+    return 1;
+  }
+  if(!child.pid){
+    setenv("RING_FD", fd, true);
+    execl("/bin/sh", "sh", "-c", command, (char*)0);
+    perror("execl");
+    _exit(127);
+  }
+
+  int ret = 0;
+  if(framering_wait_setup(ring, child_alive, &child)){
+    const struct framering_header* header = framering_header(ring);
+    const uint8_t (*image)[4];
+    while((image=framering_next(ring, 0, child_alive, &child))){
+      if(!bitmap_write(stdout, header->width, header->height, (void*)image)){
+        framering_close(ring); // So the command stops waiting for free slots
+        ret = 1;
+        break;
+      }
+      framering_release(ring);
+    }
+  }
+  fflush(stdout);
+
+  framering_free(ring);
+  if(!child.exited){
+    if(ret)
+      kill(child.pid, SIGTERM);
+    waitpid(child.pid, &child.status, 0);
+  }
+  if(!WIFEXITED(child.status) || WEXITSTATUS(child.status))
+    ret = 1;
+  return ret;
+}
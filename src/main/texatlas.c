@@ -0,0 +1,160 @@
+#include <dparaster/texture.h>
+#include <dparaster/dptx.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+// Packs many textures into the layers of one layered RGBA texture, so geometry using any of them
+// can be drawn at once. For every input, a line with its place in the atlas is written to stdout:
+//   layer u0 v0 u1 v1 file
+// Texture coordinates of the input then need to be mapped to u0..u1 and v0..v1, with the layer as z.
+
+struct params {
+  uint32_t w, h; // Of a layer, 0 for the size of the biggest input
+  const char* output;
+  int count;
+  char** input;
+};
+
+struct image {
+  const char* file;
+  struct texture* texture;
+  uint32_t w, h;
+  uint32_t layer, x, y;
+};
+
+struct params parse_args(int argc, char* argv[]){
+  struct params p = {0};
+  int i = 1;
+  for(; i<argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    if(argv[i][2] != '\0' || i+1 >= argc)
+      goto usage;
+    switch(argv[i][1]){
+      case 's': {
+        if(sscanf(argv[++i], "%"SCNu32"x%"SCNu32, &p.w, &p.h) != 2 || !p.w || !p.h)
+          goto usage;
+      } break;
+      default: goto usage;
+    }
+  }
+  if(i+2 > argc)
+    goto usage;
+  p.output = argv[i];
+  p.input = argv + i + 1;
+  p.count = argc - i - 1;
+  return p;
+usage:
+  fprintf(stderr, "usage: %s [-s layer-width x layer-height] output.dptx input...\n", *argv);
+  exit(1);
+}
+
+static int by_height(const void* a, const void* b){
+  const struct image*const*restrict x = a;
+  const struct image*const*restrict y = b;
+  return (*x)->h < (*y)->h ? 1 : (*x)->h > (*y)->h ? -1 : 0;
+}
+
+// Shelf packing, the tallest images first. Returns the number of layers.
+static uint32_t pack(struct image* image, int count, uint32_t w, uint32_t h){
+  struct image* order[count];
+  for(int i=0; i<count; i++)
+    order[i] = &image[i];
+  qsort(order, count, sizeof(*order), by_height);
+  uint32_t layer = 0, x = 0, y = 0, shelf = 0;
+  for(int i=0; i<count; i++){
+    struct image* it = order[i];
+    if(x + it->w > w){ // Next shelf
+      y += shelf;
+      x = shelf = 0;
+    }
+    if(y + it->h > h){ // Next layer
+      layer++;
+      x = y = shelf = 0;
+    }
+    it->layer = layer;
+    it->x = x;
+    it->y = y;
+    x += it->w;
+    if(it->h > shelf)
+      shelf = it->h;
+  }
+  return layer + 1;
+}
+
+int main(int argc, char* argv[]){
+  struct params p = parse_args(argc, argv);
+  int ret = 1;
+
+  struct image* image = calloc(p.count, sizeof(*image));
+  if(!image)
+    goto error;
+  const bool fit = !p.w; // To the biggest input
+  int loaded = 0;
+  for(; loaded<p.count; loaded++){
+    struct image* it = &image[loaded];
+    it->file = p.input[loaded];
+    it->texture = texture_load(it->file);
+    if(!it->texture || it->texture->dimension_count != 2 || it->texture->layered){
+      fprintf(stderr, "%s: can't load it as a 2D texture\n", it->file);
+      if(it->texture)
+        texture_free(it->texture);
+      goto error_after_load;
+    }
+    it->w = it->texture->size[0];
+    it->h = it->texture->size[1];
+    if(fit){
+      if(it->w > p.w) p.w = it->w;
+      if(it->h > p.h) p.h = it->h;
+    }
+  }
+  for(int i=0; i<p.count; i++){
+    if(image[i].w > p.w || image[i].h > p.h){
+      fprintf(stderr, "%s: too big for a %"PRIu32"x%"PRIu32" layer\n", image[i].file, p.w, p.h);
+      goto error_after_load;
+    }
+  }
+
+  const uint32_t layers = pack(image, p.count, p.w, p.h);
+  uint8_t (*img)[4] = calloc((size_t)p.w * p.h * layers, sizeof(*img));
+  if(!img)
+    goto error_after_load;
+  for(int i=0; i<p.count; i++){
+    const struct image* it = &image[i];
+    for(uint32_t y=0; y<it->h; y++)
+    for(uint32_t x=0; x<it->w; x++){
+      const Vector c = texture_texel_get(it->texture, (long long[]){x,y}, (enum texture_lookup_mode[]){TL_CLAMP,TL_CLAMP});
+      uint8_t*restrict out = img[((size_t)it->layer * p.h + it->y + y) * p.w + it->x + x];
+      for(unsigned j=0; j<4; j++)
+        out[j] = lroundf(fminf(fmaxf(c.data[j], 0), 1) * 255);
+    }
+    printf("%"PRIu32" %g %g %g %g %s\n", it->layer,
+      (double)it->x / p.w, (double)it->y / p.h,
+      (double)(it->x + it->w) / p.w, (double)(it->y + it->h) / p.h,
+      it->file
+    );
+  }
+
+  struct texture atlas = {
+    .format = "RGBA",
+    .dimension_count = 3,
+    .size = {p.w, p.h, layers},
+    .layered = true,
+    .img = img,
+  };
+  if(!dptx_save(p.output, &atlas)){
+    perror("failed to write atlas");
+    goto error_after_img;
+  }
+  ret = 0;
+
+error_after_img:
+  free(img);
+error_after_load:
+  while(loaded--)
+    texture_free(image[loaded].texture);
+  free(image);
+error:
+  return ret;
+}
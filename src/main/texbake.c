@@ -0,0 +1,225 @@
+#define _DEFAULT_SOURCE
+#include <dparaster/texture.h>
+#include <dparaster/dptx.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Converts any texture texture_load can read into the dptx container, so programs can map it
+// and use it as is. The image gets unflipped and tightly packed, and the mip levels are generated.
+// With -c, the levels are block compressed.
+
+#define MAX_LEVELS 32
+
+struct params {
+  const char* input;
+  const char* output;
+  unsigned levels;
+  enum texture_compression compression;
+};
+
+struct params parse_args(int argc, char* argv[]){
+  struct params p = {
+    .levels = MAX_LEVELS,
+  };
+  int i = 1;
+  for(; i<argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    if(argv[i][2] != '\0' || i+1 >= argc)
+      goto usage;
+    switch(argv[i][1]){
+      case 'm': p.levels = atoi(argv[++i]); break;
+      case 'c': {
+        i++;
+        if(!strcmp(argv[i], "bc1")){
+          p.compression = TC_BC1;
+        }else if(!strcmp(argv[i], "bc3")){
+          p.compression = TC_BC3;
+        }else goto usage;
+      } break;
+      default: goto usage;
+    }
+  }
+  if(i+2 != argc || p.levels > MAX_LEVELS)
+    goto usage;
+  p.input = argv[i];
+  p.output = argv[i+1];
+  return p;
+usage:
+  fprintf(stderr, "usage: %s [-m max-mip-levels|-c bc1|bc3] input output.dptx\n", *argv);
+  exit(1);
+}
+
+// The offsets of the next texel in each dimension
+static void texel_steps(const struct texture* texture, const struct texture_level* level, size_t step[3]){
+  size_t last_stride = strnlen(texture->format, 4);
+  for(unsigned i=0; i<3; i++){
+    step[i] = last_stride;
+    if(i >= texture->dimension_count)
+      continue;
+    size_t stride = level->stride[i];
+    if(!stride)
+      stride = last_stride * level->size[i];
+    last_stride = stride;
+  }
+}
+
+static size_t level_size(const struct texture_level* level, unsigned i){
+  return level->size[i] ? level->size[i] : 1;
+}
+
+// Copies the base level into a tightly packed, unflipped image
+static void* unflip(const struct texture* texture, struct texture_level* level){
+  const size_t bpp = strnlen(texture->format, 4);
+  const struct texture_level src = texture_get_level(texture, 0);
+  size_t step[3];
+  texel_steps(texture, &src, step);
+  *level = (struct texture_level){0};
+  memcpy(level->size, src.size, sizeof(src.size));
+  const size_t w = level_size(&src, 0), h = level_size(&src, 1), d = level_size(&src, 2);
+  uint8_t* img = malloc(w * h * d * bpp);
+  if(!img)
+    return 0;
+  uint8_t* it = img;
+  for(size_t z=0; z<d; z++)
+  for(size_t y=0; y<h; y++)
+  for(size_t x=0; x<w; x++){
+    const size_t c[3] = {
+      texture->flip[0] ? w-1-x : x,
+      texture->flip[1] ? h-1-y : y,
+      texture->flip[2] ? d-1-z : z,
+    };
+    memcpy(it, (const uint8_t*)src.img + c[0]*step[0] + c[1]*step[1] + c[2]*step[2], bpp);
+    it += bpp;
+  }
+  level->img = img;
+  return img;
+}
+
+// Box filters a tightly packed level down to half its size
+static void* downsample(const struct texture* texture, const struct texture_level* src, struct texture_level* dst){
+  const size_t bpp = strnlen(texture->format, 4);
+  const size_t sw = level_size(src, 0), sh = level_size(src, 1), sd = level_size(src, 2);
+  *dst = (struct texture_level){0};
+  for(unsigned i=0; i<texture->dimension_count; i++)
+    dst->size[i] = src->size[i] > 1 ? src->size[i] / 2 : 1;
+  if(texture->layered) // Every layer gets its own mip levels
+    dst->size[texture->dimension_count-1] = src->size[texture->dimension_count-1];
+  const size_t w = level_size(dst, 0), h = level_size(dst, 1), d = level_size(dst, 2);
+  uint8_t* img = malloc(w * h * d * bpp);
+  if(!img)
+    return 0;
+  const uint8_t* s = src->img;
+  uint8_t* it = img;
+  for(size_t z=0; z<d; z++)
+  for(size_t y=0; y<h; y++)
+  for(size_t x=0; x<w; x++){
+    for(size_t c=0; c<bpp; c++){
+      unsigned sum = 0, count = 0;
+      const size_t zs = d == sd ? 1 : 2;
+      for(size_t k=z*zs; k<z*zs+zs && k<sd; k++)
+      for(size_t j=y*2; j<y*2+2 && j<sh; j++)
+      for(size_t i=x*2; i<x*2+2 && i<sw; i++){
+        sum += s[((k*sh + j)*sw + i)*bpp + c];
+        count++;
+      }
+      *it++ = (sum + count/2) / count;
+    }
+  }
+  dst->img = img;
+  return img;
+}
+
+// Block compresses a tightly packed level. Partial blocks at the edges repeat the last texel.
+static void* compress(const struct texture* texture, enum texture_compression compression, struct texture_level* level){
+  const size_t bpp = strnlen(texture->format, 4);
+  const size_t w = level_size(level, 0), h = level_size(level, 1), d = level_size(level, 2);
+  const size_t bw = (w+3) / 4, bh = (h+3) / 4;
+  const size_t block_size = texture_block_size(compression);
+  uint8_t* img = malloc(bw * bh * d * block_size);
+  if(!img)
+    return 0;
+  const uint8_t* s = level->img;
+  uint8_t* it = img;
+  for(size_t z=0; z<d; z++)
+  for(size_t by=0; by<bh; by++)
+  for(size_t bx=0; bx<bw; bx++){
+    uint8_t texel[16][4];
+    for(size_t i=0; i<16; i++){
+      const size_t x = bx*4 + i%4 < w ? bx*4 + i%4 : w-1;
+      const size_t y = by*4 + i/4 < h ? by*4 + i/4 : h-1;
+      const uint8_t* t = s + ((z*h + y)*w + x)*bpp;
+      memcpy(texel[i], (uint8_t[]){0,0,0,0xFF}, 4);
+      for(size_t c=0; c<bpp; c++)
+      switch(texture->format[c]){
+        case 'R': texel[i][0] = t[c]; break;
+        case 'G': texel[i][1] = t[c]; break;
+        case 'B': texel[i][2] = t[c]; break;
+        case 'A': texel[i][3] = t[c]; break;
+      }
+    }
+    texture_block_encode(compression, (const uint8_t(*)[4])texel, it);
+    it += block_size;
+  }
+  free((void*)level->img);
+  level->img = img;
+  return img;
+}
+
+int main(int argc, char* argv[]){
+  const struct params p = parse_args(argc, argv);
+  int ret = 1;
+
+  struct texture* texture = texture_load(p.input);
+  if(!texture){
+    fprintf(stderr, "failed to load %s\n", p.input);
+    goto error;
+  }
+  if(texture->compression){
+    fprintf(stderr, "%s is already compressed\n", p.input);
+    goto error_after_load;
+  }
+
+  struct texture_level level[MAX_LEVELS];
+  unsigned count = 0;
+  if(!unflip(texture, &level[count++]))
+    goto error_after_load;
+  while(count < p.levels){
+    const struct texture_level* last = &level[count-1];
+    bool smallest = true;
+    for(unsigned i=0; i<texture->dimension_count - (unsigned)texture->layered; i++)
+      smallest &= level_size(last, i) == 1;
+    if(smallest)
+      break;
+    if(!downsample(texture, last, &level[count]))
+      goto error_after_levels;
+    count++;
+  }
+  if(p.compression)
+    for(unsigned i=0; i<count; i++)
+      if(!compress(texture, p.compression, &level[i]))
+        goto error_after_levels;
+
+  struct texture baked = {
+    .dimension_count = texture->dimension_count,
+    .compression = p.compression,
+    .layered = texture->layered,
+    .img = level[0].img,
+    .level_count = count - 1,
+    .level = level + 1,
+  };
+  memcpy(baked.format, p.compression ? "RGBA" : texture->format, sizeof(baked.format));
+  memcpy(baked.size, level[0].size, sizeof(baked.size));
+  if(!dptx_save(p.output, &baked)){
+    perror("failed to write texture");
+    goto error_after_levels;
+  }
+  ret = 0;
+
+error_after_levels:
+  while(count--)
+    free((void*)level[count].img);
+error_after_load:
+  texture_free(texture);
+error:
+  return ret;
+}
@@ -0,0 +1,124 @@
+#include <dparaster/geometry.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline unsigned vertex_id(const Attribute*restrict position, unsigned triangle, unsigned k){
+  if(!position->index)
+    return triangle*3 + k;
+  if(position->index_type == IT_U16)
+    return position->index16[triangle][k];
+  return position->index[triangle][k];
+}
+
+static void meshlet_bounds(const Geometry*restrict geometry, struct meshlet*restrict m){
+  const Attribute*restrict position = &geometry->attribute[AIN_POSITION];
+  Vector min = {{ INFINITY, INFINITY, INFINITY, 1 }};
+  Vector max = {{ -INFINITY, -INFINITY, -INFINITY, 1 }};
+  Vector sum = {{0,0,0,0}};
+  for(unsigned t=m->first; t<m->first+m->count; t++){
+    Vector v[3];
+    attribute_fetch(position, t, v);
+    for(unsigned k=0; k<3; k++){
+      for(unsigned i=0; i<3; i++){
+        if(v[k].data[i] < min.data[i]) min.data[i] = v[k].data[i];
+        if(v[k].data[i] > max.data[i]) max.data[i] = v[k].data[i];
+      }
+    }
+    Vector n = vcross(vsub(v[1], v[0]), vsub(v[2], v[0]));
+    n.data[3] = 0;
+    const double length = sqrt(vdot(n, n));
+    if(length > 0)
+      sum = vadd(sum, vdivf(n, length));
+  }
+  m->center = vmulf(vadd(min, max), 0.5);
+  m->center.data[3] = 1;
+  double radius = 0;
+  for(unsigned t=m->first; t<m->first+m->count; t++){
+    Vector v[3];
+    attribute_fetch(position, t, v);
+    for(unsigned k=0; k<3; k++){
+      Vector d = vsub(v[k], m->center);
+      d.data[3] = 0;
+      radius = fmax(radius, sqrt(vdot(d, d)));
+    }
+  }
+  m->radius = radius * (1 + 1e-6); // Rounded up
+
+  // The cone only helps if all normals are less than 90° from its axis
+  m->cone_cutoff = 2;
+  const double length = sqrt(vdot(sum, sum));
+  if(!(length > 0))
+    return;
+  m->cone_axis = vdivf(sum, length);
+  double min_dot = 1;
+  for(unsigned t=m->first; t<m->first+m->count; t++){
+    Vector v[3];
+    attribute_fetch(position, t, v);
+    Vector n = vcross(vsub(v[1], v[0]), vsub(v[2], v[0]));
+    n.data[3] = 0;
+    const double l = sqrt(vdot(n, n));
+    if(l > 0)
+      min_dot = fmin(min_dot, vdot(n, m->cone_axis) / l);
+  }
+  if(min_dot > 1e-3)
+    m->cone_cutoff = sqrt(1 - min_dot * min_dot) + 1e-3; // Rounded up
+}
+
+struct meshlet* geometry_build_meshlets(const Geometry*restrict geometry, unsigned*restrict count){
+  const Attribute*restrict position = &geometry->attribute[AIN_POSITION];
+  unsigned vertex_count = 1;
+  for(unsigned t=0; t<geometry->triangle_count; t++)
+    for(unsigned k=0; k<3; k++)
+      if(vertex_id(position, t, k) >= vertex_count)
+        vertex_count = vertex_id(position, t, k) + 1;
+  // The number of the last meshlet a vertex was added to, plus one
+  unsigned* seen = dparaster_calloc(vertex_count, sizeof(*seen), DPM_SCRATCH);
+  if(!seen)
+    return 0;
+  unsigned capacity = geometry->triangle_count / MESHLET_MAX_TRIANGLES + 1;
+  struct meshlet* meshlet = dparaster_alloc(sizeof(*meshlet) * capacity, DPM_GEOMETRY);
+  if(!meshlet)
+    goto error;
+
+  // Triangles are added until a meshlet is full, in triangles or in vertices
+  unsigned n = 0, vertices = 0;
+  for(unsigned t=0; t<geometry->triangle_count; t++){
+    unsigned id[3], added = 0;
+    for(unsigned k=0; k<3; k++){
+      id[k] = vertex_id(position, t, k);
+      if(seen[id[k]] != n && (!k || id[k] != id[0]) && (k < 2 || id[k] != id[1]))
+        added++;
+    }
+    if(!n || meshlet[n-1].count == MESHLET_MAX_TRIANGLES || vertices + added > MESHLET_MAX_VERTICES){
+      if(n == capacity){
+        capacity *= 2;
+        struct meshlet* tmp = dparaster_realloc(meshlet, sizeof(*meshlet) * capacity, DPM_GEOMETRY);
+        if(!tmp)
+          goto error_after_meshlet;
+        meshlet = tmp;
+      }
+      meshlet[n++] = (struct meshlet){ .first = t };
+      vertices = 0;
+    }
+    for(unsigned k=0; k<3; k++){
+      if(seen[id[k]] != n){
+        seen[id[k]] = n;
+        vertices++;
+      }
+    }
+    meshlet[n-1].count++;
+  }
+  dparaster_free(seen);
+
+  for(unsigned i=0; i<n; i++)
+    meshlet_bounds(geometry, &meshlet[i]);
+  *count = n;
+  return meshlet;
+
+error_after_meshlet:
+  dparaster_free(meshlet);
+error:
+  dparaster_free(seen);
+  return 0;
+}
@@ -0,0 +1,403 @@
+#include <dparaster/meshopt.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define CACHE_SIZE 32 // Of the cache modelled by the vertex cache optimization
+#define CLUSTER_CACHE_SIZE 16 // Of the FIFO cache used to find where clusters start
+
+static uint64_t vector_hash(uint64_t h, const Vector* v){
+  uint32_t w[4];
+  memcpy(w, v->data, sizeof(w));
+  for(unsigned i=0; i<4; i++)
+    h = (h ^ w[i]) * 0x100000001B3;
+  return h;
+}
+
+bool mesh_weld(Mesh*restrict mesh, const Geometry*restrict geometry){
+  *mesh = (Mesh){ .triangle_count = geometry->triangle_count };
+  const size_t corner_count = (size_t)geometry->triangle_count * 3;
+  enum e_attribute_in present[AIN_COUNT];
+  unsigned present_count = 0;
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
+    if(geometry->attribute[j].data){
+      present[present_count++] = j;
+    }else{
+      mesh->vertex_default[j] = geometry->attribute[j].vertex_default;
+    }
+  }
+
+  size_t table_size = 16;
+  while(table_size < corner_count * 2)
+    table_size *= 2;
+  unsigned* table = dparaster_alloc(sizeof(*table) * table_size, DPM_SCRATCH);
+  if(!table)
+    return false;
+  memset(table, 0xFF, sizeof(*table) * table_size);
+  mesh->index = dparaster_alloc(sizeof(*mesh->index) * geometry->triangle_count, DPM_GEOMETRY);
+  if(!mesh->index)
+    goto error;
+  for(unsigned i=0; i<present_count; i++){
+    mesh->vertex[present[i]] = dparaster_alloc(sizeof(Vector) * corner_count, DPM_GEOMETRY);
+    if(!mesh->vertex[present[i]])
+      goto error;
+  }
+
+  for(unsigned t=0; t<geometry->triangle_count; t++){
+    Vector corner[AIN_COUNT][3];
+    for(unsigned i=0; i<present_count; i++)
+      attribute_fetch(&geometry->attribute[present[i]], t, corner[i]);
+    for(unsigned k=0; k<3; k++){
+      uint64_t h = 0xCBF29CE484222325;
+      for(unsigned i=0; i<present_count; i++)
+        h = vector_hash(h, &corner[i][k]);
+      size_t slot = (h ^ h >> 32) & (table_size - 1);
+      for(; table[slot] != ~0u; slot = (slot + 1) & (table_size - 1)){
+        const unsigned v = table[slot];
+        unsigned i = 0;
+        while(i < present_count && !memcmp(&mesh->vertex[present[i]][v], &corner[i][k], sizeof(Vector)))
+          i++;
+        if(i == present_count)
+          break;
+      }
+      if(table[slot] == ~0u){
+        const unsigned v = mesh->vertex_count++;
+        for(unsigned i=0; i<present_count; i++)
+          mesh->vertex[present[i]][v] = corner[i][k];
+        table[slot] = v;
+      }
+      mesh->index[t][k] = table[slot];
+    }
+  }
+  dparaster_free(table);
+
+  for(unsigned i=0; i<present_count; i++){
+    Vector* vertex = dparaster_realloc(mesh->vertex[present[i]], sizeof(Vector) * (mesh->vertex_count ? mesh->vertex_count : 1), DPM_GEOMETRY);
+    if(vertex)
+      mesh->vertex[present[i]] = vertex;
+  }
+  return true;
+
+error:
+  dparaster_free(table);
+  mesh_free(mesh);
+  return false;
+}
+
+void mesh_free(Mesh* mesh){
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+    dparaster_free(mesh->vertex[j]);
+  dparaster_free(mesh->index);
+  *mesh = (Mesh){0};
+}
+
+Geometry mesh_geometry(const Mesh* mesh){
+  Geometry g = { .triangle_count = mesh->triangle_count };
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
+    if(mesh->vertex[j]){
+      g.attribute[j] = (Attribute){ .vertex = mesh->vertex[j], .index = (const unsigned(*)[3])mesh->index };
+    }else{
+      g.attribute[j] = (Attribute){ .vertex_default = mesh->vertex_default[j] };
+    }
+  }
+  return g;
+}
+
+double mesh_acmr(const Mesh* mesh, unsigned cache_size){
+  if(!mesh->triangle_count)
+    return 0;
+  // A vertex is in the cache if it was one of the last cache_size ones to be added
+  unsigned* added = dparaster_calloc(mesh->vertex_count, sizeof(*added), DPM_SCRATCH);
+  if(!added)
+    return -1;
+  unsigned misses = 0;
+  for(unsigned t=0; t<mesh->triangle_count; t++){
+    for(unsigned k=0; k<3; k++){
+      const unsigned v = mesh->index[t][k];
+      if(!added[v] || misses - added[v] >= cache_size)
+        added[v] = ++misses;
+    }
+  }
+  dparaster_free(added);
+  return (double)misses / mesh->triangle_count;
+}
+
+bool mesh_optimize_vertex_cache(Mesh* mesh){
+  const unsigned vertex_count = mesh->vertex_count;
+  const unsigned triangle_count = mesh->triangle_count;
+  if(!triangle_count)
+    return true;
+  bool ret = false;
+
+  // Scores for a vertex in the cache, or with some triangles left to be drawn
+  float cache_score[CACHE_SIZE];
+  float valence_score[64];
+  for(unsigned i=0; i<CACHE_SIZE; i++)
+    cache_score[i] = i < 3 ? 0.75f : powf(1 - (i - 3) * (1.f / (CACHE_SIZE - 3)), 1.5f);
+  for(unsigned i=1; i<64; i++)
+    valence_score[i] = 2 / sqrtf(i);
+  valence_score[0] = 0;
+
+  // The triangles of every vertex. The ones not drawn yet are at the start of its list.
+  unsigned* remaining = dparaster_calloc(vertex_count, sizeof(*remaining), DPM_SCRATCH);
+  unsigned* offset = dparaster_alloc(sizeof(*offset) * (vertex_count + 1), DPM_SCRATCH);
+  unsigned* adjacency = dparaster_alloc(sizeof(*adjacency) * triangle_count * 3, DPM_SCRATCH);
+  int* position = dparaster_alloc(sizeof(*position) * vertex_count, DPM_SCRATCH);
+  float* score = dparaster_alloc(sizeof(*score) * vertex_count, DPM_SCRATCH);
+  float* triangle_score = dparaster_alloc(sizeof(*triangle_score) * triangle_count, DPM_SCRATCH);
+  unsigned (*out)[3] = dparaster_alloc(sizeof(*out) * triangle_count, DPM_SCRATCH);
+  if(!remaining || !offset || !adjacency || !position || !score || !triangle_score || !out)
+    goto error;
+
+  for(unsigned t=0; t<triangle_count; t++)
+    for(unsigned k=0; k<3; k++)
+      remaining[mesh->index[t][k]]++;
+  offset[0] = 0;
+  for(unsigned v=0; v<vertex_count; v++)
+    offset[v+1] = offset[v] + remaining[v];
+  memset(remaining, 0, sizeof(*remaining) * vertex_count);
+  for(unsigned t=0; t<triangle_count; t++){
+    for(unsigned k=0; k<3; k++){
+      const unsigned v = mesh->index[t][k];
+      adjacency[offset[v] + remaining[v]++] = t;
+    }
+  }
+
+  #define VERTEX_SCORE(V) ( \
+      !remaining[V] ? -1.f : \
+      (position[V] >= 0 ? cache_score[position[V]] : 0) \
+    + (remaining[V] < 64 ? valence_score[remaining[V]] : 2 / sqrtf(remaining[V])) \
+  )
+  #define TRIANGLE_SCORE(T) (score[mesh->index[T][0]] + score[mesh->index[T][1]] + score[mesh->index[T][2]])
+
+  for(unsigned v=0; v<vertex_count; v++){
+    position[v] = -1;
+    score[v] = VERTEX_SCORE(v);
+  }
+  unsigned best = 0;
+  for(unsigned t=0; t<triangle_count; t++){
+    triangle_score[t] = TRIANGLE_SCORE(t);
+    if(triangle_score[t] > triangle_score[best])
+      best = t;
+  }
+
+  unsigned cache[CACHE_SIZE+3];
+  unsigned cache_count = 0;
+  unsigned next = 0; // Where to look for a triangle, when none around the cache is left
+  for(unsigned n=0; n<triangle_count; n++){
+    if(best == ~0u){
+      while(triangle_score[next] < 0)
+        next++;
+      best = next;
+    }
+    const unsigned t = best;
+    memcpy(out[n], mesh->index[t], sizeof(*out));
+    triangle_score[t] = -1; // Drawn
+
+    // The vertices of the triangle go to the front of the cache
+    unsigned new_cache[CACHE_SIZE+3];
+    unsigned new_count = 0;
+    for(unsigned k=0; k<3; k++){
+      const unsigned v = mesh->index[t][k];
+      unsigned*restrict list = adjacency + offset[v];
+      unsigned i = 0;
+      while(list[i] != t)
+        i++;
+      list[i] = list[--remaining[v]];
+      list[remaining[v]] = t;
+      unsigned j = 0;
+      while(j < new_count && new_cache[j] != v)
+        j++;
+      if(j == new_count) // Degenerate triangles repeat vertices
+        new_cache[new_count++] = v;
+    }
+    const unsigned front = new_count;
+    for(unsigned i=0; i<cache_count; i++){
+      const unsigned v = cache[i];
+      unsigned j = 0;
+      while(j < front && new_cache[j] != v)
+        j++;
+      if(j == front)
+        new_cache[new_count++] = v;
+    }
+
+    // Update the scores of everything the cache change affected, and find the best next triangle
+    for(unsigned i=0; i<new_count; i++){
+      const unsigned v = new_cache[i];
+      position[v] = i < CACHE_SIZE ? (int)i : -1;
+      score[v] = VERTEX_SCORE(v);
+    }
+    best = ~0u;
+    float best_score = -1;
+    for(unsigned i=0; i<new_count; i++){
+      const unsigned v = new_cache[i];
+      for(unsigned j=0; j<remaining[v]; j++){
+        const unsigned u = adjacency[offset[v] + j];
+        triangle_score[u] = TRIANGLE_SCORE(u);
+        if(triangle_score[u] > best_score){
+          best_score = triangle_score[u];
+          best = u;
+        }
+      }
+    }
+    cache_count = new_count < CACHE_SIZE ? new_count : CACHE_SIZE;
+    memcpy(cache, new_cache, sizeof(*cache) * cache_count);
+  }
+  #undef TRIANGLE_SCORE
+  #undef VERTEX_SCORE
+
+  memcpy(mesh->index, out, sizeof(*out) * triangle_count);
+  ret = true;
+error:
+  dparaster_free(out);
+  dparaster_free(triangle_score);
+  dparaster_free(score);
+  dparaster_free(position);
+  dparaster_free(adjacency);
+  dparaster_free(offset);
+  dparaster_free(remaining);
+  return ret;
+}
+
+struct cluster {
+  unsigned start, count;
+  double key;
+};
+
+static int by_key(const void* a, const void* b){
+  const struct cluster*restrict x = a;
+  const struct cluster*restrict y = b;
+  if(x->key != y->key)
+    return x->key < y->key ? 1 : -1;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+unsigned mesh_optimize_overdraw(Mesh* mesh, double threshold){
+  const Vector*restrict position = mesh->vertex[AIN_POSITION];
+  if(!mesh->triangle_count || !position)
+    return 1;
+  unsigned ret = 0;
+  unsigned* added = dparaster_calloc(mesh->vertex_count, sizeof(*added), DPM_SCRATCH);
+  struct cluster* cluster = dparaster_alloc(sizeof(*cluster) * mesh->triangle_count, DPM_SCRATCH);
+  Vector* centroid = dparaster_alloc(sizeof(*centroid) * mesh->triangle_count, DPM_SCRATCH);
+  Vector* normal = dparaster_alloc(sizeof(*normal) * mesh->triangle_count, DPM_SCRATCH);
+  unsigned (*out)[3] = dparaster_alloc(sizeof(*out) * mesh->triangle_count, DPM_SCRATCH);
+  if(!added || !cluster || !centroid || !normal || !out)
+    goto error;
+
+  // A cluster starts where a triangle has none of its vertices in the cache. It may also start where
+  // only one is, if the cluster so far reuses vertices well enough to not need the ones after it.
+  const double acmr = mesh_acmr(mesh, CLUSTER_CACHE_SIZE) * threshold;
+  unsigned cluster_count = 0;
+  unsigned misses = 0, cluster_misses = 0;
+  for(unsigned t=0; t<mesh->triangle_count; t++){
+    const unsigned before = misses;
+    for(unsigned k=0; k<3; k++){
+      const unsigned v = mesh->index[t][k];
+      if(!added[v] || misses - added[v] >= CLUSTER_CACHE_SIZE)
+        added[v] = ++misses;
+    }
+    const unsigned miss = misses - before;
+    if(!cluster_count || miss == 3 || (miss == 2 && cluster_misses <= acmr * cluster[cluster_count-1].count)){
+      cluster[cluster_count++] = (struct cluster){ .start = t };
+      cluster_misses = 0;
+    }
+    cluster[cluster_count-1].count++;
+    cluster_misses += miss;
+  }
+
+  // The area weighted centroid and the normal of every cluster, and the centroid of the mesh
+  Vector center = {{0,0,0,0}};
+  for(unsigned c=0; c<cluster_count; c++){
+    Vector sum = {{0,0,0,0}};
+    Vector n = {{0,0,0,0}};
+    for(unsigned t=cluster[c].start; t<cluster[c].start+cluster[c].count; t++){
+      const Vector a = position[mesh->index[t][0]];
+      const Vector b = position[mesh->index[t][1]];
+      const Vector d = position[mesh->index[t][2]];
+      Vector cross = vcross(vsub(b, a), vsub(d, a));
+      cross.data[3] = 0;
+      const double area = sqrt(vdot(cross, cross));
+      Vector mid = vdivf(vadd(vadd(a, b), d), 3);
+      mid.data[3] = 1;
+      sum = vadd(sum, vmulf(mid, area));
+      n = vadd(n, cross);
+    }
+    centroid[c] = sum;
+    normal[c] = n;
+    center = vadd(center, sum);
+  }
+  if(center.data[3] > 0)
+    center = vdivf(center, center.data[3]);
+  for(unsigned c=0; c<cluster_count; c++){
+    const Vector sum = centroid[c];
+    const Vector n = normal[c];
+    const double length = sqrt(vdot(n, n));
+    if(sum.data[3] > 0 && length > 0){
+      Vector d = vsub(vdivf(sum, sum.data[3]), center);
+      d.data[3] = 0;
+      cluster[c].key = vdot(d, n) / length;
+    }else{
+      cluster[c].key = 0;
+    }
+  }
+
+  // Outward facing clusters far from the center are likely in front of the others
+  qsort(cluster, cluster_count, sizeof(*cluster), by_key);
+  unsigned n = 0;
+  for(unsigned c=0; c<cluster_count; c++){
+    memcpy(out[n], mesh->index[cluster[c].start], sizeof(*out) * cluster[c].count);
+    n += cluster[c].count;
+  }
+  memcpy(mesh->index, out, sizeof(*out) * mesh->triangle_count);
+  ret = cluster_count;
+error:
+  dparaster_free(out);
+  dparaster_free(normal);
+  dparaster_free(centroid);
+  dparaster_free(cluster);
+  dparaster_free(added);
+  return ret;
+}
+
+bool mesh_optimize_vertex_fetch(Mesh* mesh){
+  const size_t count = mesh->vertex_count ? mesh->vertex_count : 1;
+  bool ret = false;
+  Vector* vertex[AIN_COUNT] = {0};
+  unsigned* remap = dparaster_alloc(sizeof(*remap) * count, DPM_SCRATCH);
+  if(!remap)
+    goto error;
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+    if(mesh->vertex[j] && !(vertex[j] = dparaster_alloc(sizeof(Vector) * count, DPM_GEOMETRY)))
+      goto error;
+
+  memset(remap, 0xFF, sizeof(*remap) * mesh->vertex_count);
+  unsigned used = 0;
+  for(unsigned t=0; t<mesh->triangle_count; t++){
+    for(unsigned k=0; k<3; k++){
+      unsigned*restrict v = &mesh->index[t][k];
+      if(remap[*v] == ~0u)
+        remap[*v] = used++;
+      *v = remap[*v];
+    }
+  }
+  // Unused vertices are dropped
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
+    if(!vertex[j])
+      continue;
+    for(unsigned v=0; v<mesh->vertex_count; v++)
+      if(remap[v] != ~0u)
+        vertex[j][remap[v]] = mesh->vertex[j][v];
+    dparaster_free(mesh->vertex[j]);
+    mesh->vertex[j] = vertex[j];
+    vertex[j] = 0;
+  }
+  mesh->vertex_count = used;
+  ret = true;
+error:
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+    dparaster_free(vertex[j]);
+  dparaster_free(remap);
+  return ret;
+}
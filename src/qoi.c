@@ -0,0 +1,192 @@
+#include <dparaster/qoi.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+#define QOI_MASK     0xC0
+
+static const uint8_t qoi_end[8] = {0,0,0,0,0,0,0,1};
+
+static inline unsigned qoi_hash(const uint8_t px[4]){
+  return (px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64;
+}
+
+static inline uint32_t u32be(const uint8_t x[4]){
+  return (uint32_t)x[0]<<24 | x[1]<<16 | x[2]<<8 | x[3];
+}
+
+bool qoi_write(
+  FILE*restrict of,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+){
+  // A pixel takes at most 5 bytes, with a pending run. The buffer is flushed before it may not fit one.
+  uint8_t buf[1<<16];
+  size_t n = 0;
+  memcpy(buf, (const uint8_t[QOI_HEADER_SIZE]){
+    'q','o','i','f', w>>24,w>>16,w>>8,w, h>>24,h>>16,h>>8,h, 3, 0
+  }, QOI_HEADER_SIZE);
+  n = QOI_HEADER_SIZE;
+
+  uint8_t index[64][4] = {0};
+  uint8_t prev[4] = {0,0,0,255};
+  unsigned run = 0;
+  for(uint32_t y=h; y--; ){ // The image is bottom up, QOI is top down
+    for(uint32_t x=0; x<w; x++){
+      if(n > sizeof(buf) - 8){
+        if(fwrite(buf, 1, n, of) != n)
+          return false;
+        n = 0;
+      }
+      const uint8_t px[4] = { image[y][x][2], image[y][x][1], image[y][x][0], 255 };
+      if(!memcmp(px, prev, 4)){
+        if(++run == 62){
+          buf[n++] = QOI_OP_RUN | (run-1);
+          run = 0;
+        }
+        continue;
+      }
+      if(run){
+        buf[n++] = QOI_OP_RUN | (run-1);
+        run = 0;
+      }
+      const unsigned hash = qoi_hash(px);
+      if(!memcmp(index[hash], px, 4)){
+        buf[n++] = QOI_OP_INDEX | hash;
+      }else{
+        memcpy(index[hash], px, 4);
+        const int8_t dr = px[0] - prev[0];
+        const int8_t dg = px[1] - prev[1];
+        const int8_t db = px[2] - prev[2];
+        const int8_t dr_dg = dr - dg;
+        const int8_t db_dg = db - dg;
+        if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+          buf[n++] = QOI_OP_DIFF | (dr+2)<<4 | (dg+2)<<2 | (db+2);
+        }else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7){
+          buf[n++] = QOI_OP_LUMA | (dg+32);
+          buf[n++] = (dr_dg+8)<<4 | (db_dg+8);
+        }else{
+          buf[n++] = QOI_OP_RGB;
+          buf[n++] = px[0];
+          buf[n++] = px[1];
+          buf[n++] = px[2];
+        }
+      }
+      memcpy(prev, px, 4);
+    }
+  }
+  if(run)
+    buf[n++] = QOI_OP_RUN | (run-1);
+  if(n > sizeof(buf) - sizeof(qoi_end)){
+    if(fwrite(buf, 1, n, of) != n)
+      return false;
+    n = 0;
+  }
+  memcpy(buf+n, qoi_end, sizeof(qoi_end));
+  n += sizeof(qoi_end);
+  return fwrite(buf, 1, n, of) == n;
+}
+
+bool qoi_save(
+  const char*restrict file,
+  const uint32_t w,
+  const uint32_t h,
+  uint8_t image[h][w][4]
+){
+  FILE* nf = 0;
+  FILE* of = 0;
+  if(!strcmp(file, "-")){
+    of = stdout;
+  }else{
+    of = nf = fopen(file, "wb");
+    if(!nf) return false;
+  }
+
+  bool ret = qoi_write(of, w, h, image);
+
+  if(nf && fclose(nf))
+    ret = false;
+  return ret;
+}
+
+bool qoi_can_handle(const struct texture* texture){
+  return texture->file_length >= QOI_HEADER_SIZE + sizeof(qoi_end)
+      && !memcmp(texture->file_content, "qoif", 4);
+}
+
+bool qoi_load(struct texture* texture){
+  const uint8_t* file = texture->file_content;
+  const uint8_t* end = file + texture->file_length - sizeof(qoi_end);
+  const uint32_t w = u32be(file+4);
+  const uint32_t h = u32be(file+8);
+  if(!w || !h || (file[12] != 3 && file[12] != 4))
+    return false;
+  // A pixel takes at least 1/62 of a byte
+  if((uint64_t)w * h > (uint64_t)texture->file_length * 62)
+    return false;
+  uint8_t (*img)[4] = dparaster_alloc(sizeof(*img) * w * h, DPM_TEXTURE);
+  if(!img)
+    return false;
+
+  uint8_t index[64][4] = {0};
+  uint8_t px[4] = {0,0,0,255};
+  const uint8_t* it = file + QOI_HEADER_SIZE;
+  unsigned run = 0;
+  for(size_t i=0, n=(size_t)w*h; i<n; i++){
+    if(run){
+      run--;
+    }else if(it < end){
+      const uint8_t op = *it++;
+      if(op == QOI_OP_RGB){
+        if(end - it < 3)
+          goto error;
+        memcpy(px, it, 3);
+        it += 3;
+      }else if(op == QOI_OP_RGBA){
+        if(end - it < 4)
+          goto error;
+        memcpy(px, it, 4);
+        it += 4;
+      }else switch(op & QOI_MASK){
+        case QOI_OP_INDEX: memcpy(px, index[op], 4); break;
+        case QOI_OP_DIFF: {
+          px[0] += (op >> 4 & 3) - 2;
+          px[1] += (op >> 2 & 3) - 2;
+          px[2] += (op      & 3) - 2;
+        } break;
+        case QOI_OP_LUMA: {
+          if(it >= end)
+            goto error;
+          const int dg = (op & 0x3F) - 32;
+          px[0] += dg - 8 + (*it >> 4);
+          px[1] += dg;
+          px[2] += dg - 8 + (*it & 0xF);
+          it++;
+        } break;
+        case QOI_OP_RUN: run = op & 0x3F; break;
+      }
+      memcpy(index[qoi_hash(px)], px, 4);
+    }else goto error;
+    memcpy(img[i], px, 4);
+  }
+
+  strcpy(texture->format, "RGBA");
+  texture->dimension_count = 2;
+  texture->img = img;
+  texture->size[0] = w;
+  texture->size[1] = h;
+  return true;
+error:
+  dparaster_free(img);
+  return false;
+}
+
+IMPLEMENT_TEXTURE_LOADER_NAMED(qoi)
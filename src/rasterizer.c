@@ -1,135 +1,334 @@
 #include <dparaster/rasterizer.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+// Depth is interpolated differently for single pixels than for the ends of a span, this covers the difference
+#define HIZ_EPSILON 1e-9
+
+// Triangles reaching further out of the view than this are clipped to it, the others are only
+// scissored while drawing. It keeps pixel coordinates small enough for exact span arithmetic.
+#define GUARD_BAND 64.
+// At most one more vertex for each plane
+#define CLIP_MAX_VERTICES 8
+
+// A horizontal edge of a trapezoid, from x[0] to x[1] at y, and the barycentric coordinates at its ends
 typedef struct PolySlice {
   double y, x[2];
   Vector baryzentric[2];
 } PolySlice;
 
-static int PolySlice_cut(               // Returns the number of PolySlice sections that need to be drawn.
-  PolySlice out[restrict 4],            // Saves the poly slices here
-  PolySlice*const restrict a,           // Top slice to be further split & fit to the boundaries
-  const PolySlice*restrict const b,     // Bottom slice to be further split & fit to the boundaries
-  const double boundary[restrict 2][2], // Boundary to fit the poly slices to
-  double last,                          // This was the previous slice y coordinate. We can omit slices equal (or smaller) than it, as it should have the same properties
-  const double epsilon[2]               // There are calculation errors with double values. This is for compensating for that. If it's too small, sections will be missing. Too big, and ther'll be artefacts at the left / right edges. Just set it to 1/w, which is half a pixel in world coordinates.
+// The planes a triangle is clipped against. There is no far plane, things with z>1 are drawn.
+enum clip_plane {
+  CP_NEAR,
+  CP_LEFT,
+  CP_RIGHT,
+  CP_BOTTOM,
+  CP_TOP,
+  CP_COUNT
+};
+#define CLIP_MASK ((1u << CP_COUNT) - 1)
+// Out of the view on that side, these don't need clipping, but all vertices out on one side means nothing gets drawn
+#define OUT_LEFT   (1u << CP_COUNT)
+#define OUT_RIGHT  (2u << CP_COUNT)
+#define OUT_BOTTOM (4u << CP_COUNT)
+#define OUT_TOP    (8u << CP_COUNT)
+
+// Positions have no w, so this is homogeneous clipping with w=1
+static inline double plane_distance(enum clip_plane plane, const Vector*restrict p){
+  switch(plane){
+    case CP_NEAR  : return p->data[2] + 1;
+    case CP_LEFT  : return GUARD_BAND + p->data[0];
+    case CP_RIGHT : return GUARD_BAND - p->data[0];
+    case CP_BOTTOM: return GUARD_BAND + p->data[1];
+    case CP_TOP   : return GUARD_BAND - p->data[1];
+    case CP_COUNT : break;
+  }
+  return 0;
+}
+
+// Things less than 1/w right of the view still end up in the last column, see draw_slices
+static inline unsigned outcode(const Vector*restrict p, uint32_t w){
+  unsigned code = 0;
+  for(enum clip_plane plane=0; plane<CP_COUNT; plane++)
+    if(!(plane_distance(plane, p) >= 0))
+      code |= 1u << plane;
+  if(p->data[0] < -1) code |= OUT_LEFT;
+  if(p->data[0] > 1 + 1. / w) code |= OUT_RIGHT;
+  if(p->data[1] < -1) code |= OUT_BOTTOM;
+  if(p->data[1] > 1) code |= OUT_TOP;
+  return code;
+}
+
+// The pixel a coordinate is in, pixel centers are at whole numbers
+static inline int64_t pixel(double c, uint32_t size){
+  return floor((c+1.)/2. * (size-1));
+}
+
+static inline int64_t floor_div(int64_t a, int64_t b){
+  return a / b - (a % b != 0 && a < 0);
+}
+
+// The standard sample positions of Direct3D, in 1/16 pixels from the center, for 1, 2, 4 and 8 samples
+static const int8_t sample_position[4][8][2] = {
+  {{0,0}},
+  {{4,4}, {-4,-4}},
+  {{-2,-6}, {6,-2}, {-6,2}, {2,6}},
+  {{1,-3}, {-1,3}, {5,1}, {-3,-5}, {-5,5}, {-7,-1}, {3,7}, {7,-7}},
+};
+
+// Written as one 32 bit store. The clamps are written so they become min and max.
+static inline void color_to_bgrx(uint8_t out[4], Vector color){
+  color = vmulf(color, 0x100);
+  uint8_t texel[4] = { [3] = 0xFF };
+  for(unsigned i=0; i<3; i++){
+    float c = color.data[i];
+    c = c > 0x00 ? c : 0x00;
+    c = c < 0xFF ? c : 0xFF;
+    texel[2-i] = (int)c;
+  }
+  memcpy(out, texel, sizeof(texel));
+}
+
+// The coarser of two shading rates in each direction, blocks are at most 4 pixels wide and high
+static inline unsigned coarser_rate(unsigned a, unsigned b){
+  unsigned bw = (a & 3) > (b & 3) ? a & 3 : b & 3;
+  unsigned bh = (a >> 2 & 3) > (b >> 2 & 3) ? a >> 2 & 3 : b >> 2 & 3;
+  if(bw > 2) bw = 2;
+  if(bh > 2) bh = 2;
+  return bw | bh << 2;
+}
+
+// The shading rate in a tile, SR_1X1 if the pixels get shaded one by one
+static inline unsigned tile_rate(const Framebuffer*restrict fb, const ShaderProgram*restrict shader, uint32_t tx, uint32_t ty){
+  if(!fb->coarse || shader->writes_depth)
+    return SR_1X1;
+  if(!fb->shading_rate_image)
+    return fb->shading_rate;
+  return coarser_rate(fb->shading_rate, fb->shading_rate_image[ty * ((fb->w + FB_TILE - 1) / FB_TILE) + tx]);
+}
+
+// Every triangle has its own coarse fragments, the ones of the triangles before don't match anymore
+static inline void coarse_begin(Framebuffer*restrict fb){
+  if(fb->coarse && !++fb->coarse_triangle){
+    memset(fb->coarse, 0, sizeof(*fb->coarse) * fb->w);
+    fb->coarse_triangle = 1;
+  }
+}
+
+// Whether the block of the pixel was shaded for this triangle already. If not, it's claimed,
+// and the caller has to put the color into it. Blocks never straddle tiles, so the first column
+// of a block is enough to tell them apart in a row, even if the tiles have different rates.
+static inline bool coarse_lookup(Framebuffer*restrict fb, unsigned rate, uint32_t x, uint32_t iy, struct coarse_fragment**restrict fragment){
+  const unsigned bw = rate & 3, bh = rate >> 2;
+  struct coarse_fragment*restrict f = &fb->coarse[x >> bw << bw];
+  const uint32_t block = iy >> bh << 4 | rate;
+  *fragment = f;
+  if(f->triangle == fb->coarse_triangle && f->block == block)
+    return true;
+  f->triangle = fb->coarse_triangle;
+  f->block = block;
+  return false;
+}
+
+// Into the format of the target, framebuffer_resolve does the rest once per pixel. Each format
+// gets written with one store of its size.
+static inline void color_to_texel(void*restrict out, enum framebuffer_format format, Vector color){
+  switch(format){
+    case FBF_FORMAT_BGRX8: color_to_bgrx(out, color); break;
+    case FBF_FORMAT_RGB10A2: {
+      uint32_t texel = 0;
+      for(unsigned i=0; i<4; i++){
+        const float max = i < 3 ? 1023 : 3;
+        const float c = !(color.data[i] > 0) ? 0 : color.data[i] >= 1 ? max : color.data[i] * max + 0.5f;
+        texel |= (uint32_t)c << 10*i;
+      }
+      memcpy(out, &texel, sizeof(texel));
+    } break;
+    case FBF_FORMAT_FLOAT16: {
+      uint16_t texel[4];
+      attribute_pack(AF_FLOAT16X4, texel, color);
+      memcpy(out, texel, sizeof(texel));
+    } break;
+    case FBF_FORMAT_FLOAT32: memcpy(out, &color, sizeof(color)); break;
+  }
+}
+
+// A texel of 4, 8 or 16 bytes, with a copy of a fixed size for each
+static inline void copy_texel(void*restrict out, const void*restrict in, size_t size){
+  switch(size){
+    case 4: memcpy(out, in, 4); break;
+    case 8: memcpy(out, in, 8); break;
+    case 16: memcpy(out, in, 16); break;
+  }
+}
+
+// Multisampling uses edge functions instead of slices. Pixel centers are at the same places as in
+// draw_triangle, which is at whole numbers after mapping -1..1 to 0..w-1. Samples inside the
+// triangle and in front of what's there get its depth, and the color the fragment shader returns for
+// the pixel center. Samples exactly on an edge go to just one of the triangles sharing it.
+static void draw_triangle_msaa(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  Triangle triangle[]
 ){
-  const double dy = b->y - a->y;
-  const double dx[2] = { b->x[0] - a->x[0], b->x[1] - a->x[1] };
-  const double sx[4] = {
-    boundary[0][0]-a->x[0], boundary[0][0]-a->x[1],
-    boundary[1][0]-a->x[0], boundary[1][0]-a->x[1],
-  };
-  // It will work even without the check for sx[] == 0. on most/all architectures,
-  // but it'd be ub to rely on a division by zero, so let's be explicit about it.
-  double ty[4] = {
-    dx[0] ? sx[0]/dx[0] : 0., dx[1] ? sx[1]/dx[1] : 0.,
-    dx[0] ? sx[2]/dx[0] : 1., dx[1] ? sx[3]/dx[1] : 1.,
-  };
-  // sorting network
-#define SWAP(a,b) {double tmp=b; b=a; a=tmp;}
-  if(ty[0]>ty[2]) SWAP(ty[0],ty[2]);
-  if(ty[1]>ty[3]) SWAP(ty[1],ty[3]);
-  if(ty[0]>ty[1]) SWAP(ty[0],ty[1]);
-  if(ty[2]>ty[3]) SWAP(ty[2],ty[3]);
-  if(ty[1]>ty[2]) SWAP(ty[1],ty[2]);
-#undef SWAP
+  const uint32_t w = fb->w;
+  const uint32_t h = fb->h;
+  const unsigned samples = fb->samples;
+  const unsigned attribute_count = shader->attribute_count;
+  const Vector*restrict p = triangle->vertex;
+  double px[3], py[3];
+  for(unsigned k=0; k<3; k++){
+    px[k] = (p[k].data[0]+1.)/2. * (w-1);
+    py[k] = (p[k].data[1]+1.)/2. * (h-1);
+  }
+  // Edge k is the one across from vertex k, its function is area there and 0 on the edge
+  double area = (px[1]-px[0])*(py[2]-py[0]) - (px[2]-px[0])*(py[1]-py[0]);
+  if(!(area != 0) || area != area)
+    return;
+  const double sign = area < 0 ? -1 : 1;
+  area *= sign;
+  double a[3], b[3], c[3];
+  bool owns[3];
+  for(unsigned k=0; k<3; k++){
+    const unsigned i = (k+1) % 3, j = (k+2) % 3;
+    a[k] = sign * (py[i] - py[j]);
+    b[k] = sign * (px[j] - px[i]);
+    c[k] = sign * (py[j]*px[i] - px[j]*py[i]);
+    owns[k] = a[k] > 0 || (a[k] == 0 && b[k] > 0);
+  }
 
-  int si = 0;
-  for(int i=0; i<4; i++){
-    double tY = ty[i];
-    if(tY <= 0.) tY = 0.;
-    if(tY >= 1.) tY = 1.;
-    double y = a->y*(1.-tY) + b->y*tY;
-    if(y < boundary[0][1])
-      y = boundary[0][1];
-    if(y > boundary[1][1])
-      y = boundary[1][1];
-    if(y < a->y || y > b->y || y <= last)
-      continue;
-    PolySlice result = { .y=y };
-    if(dy){
-      double t = (y-a->y)/dy;
-      if(t <= 0.) t=0.;
-      if(t >= 1.) t=1.;
-      result.x[0] = a->x[0]*(1.-t) + b->x[0]*t;
-      result.x[1] = a->x[1]*(1.-t) + b->x[1]*t;
-      result.baryzentric[0] = vinterpolate(a->baryzentric[0], b->baryzentric[0], t);
-      result.baryzentric[1] = vinterpolate(a->baryzentric[1], b->baryzentric[1], t);
-    }else{
-      if(a->x[0] < b->x[0]){
-        result.x[0] = a->x[0];
-        result.baryzentric[0] = a->baryzentric[0];
-      }else{
-        result.x[0] = b->x[0];
-        result.baryzentric[0] = b->baryzentric[0];
+  // The rows held by the framebuffer, y is flipped like in draw_triangle
+  const uint32_t band_sy = h - fb->y - fb->rows;
+  const uint32_t band_ey = h - fb->y - 1;
+  const double minx = fmin(fmin(px[0], px[1]), px[2]), maxx = fmax(fmax(px[0], px[1]), px[2]);
+  const double miny = fmin(fmin(py[0], py[1]), py[2]), maxy = fmax(fmax(py[0], py[1]), py[2]);
+  if(maxx < -1 || minx > w || maxy < (double)band_sy - 1 || miny > (double)band_ey + 1)
+    return;
+  const uint32_t x0 = minx < 1 ? 0 : (uint32_t)(minx - 1);
+  const uint32_t x1 = maxx + 1 >= w - 1 ? w - 1 : (uint32_t)(maxx + 1);
+  const uint32_t y0 = miny < band_sy + 1 ? band_sy : (uint32_t)(miny - 1);
+  const uint32_t y1 = maxy + 1 >= band_ey ? band_ey : (uint32_t)(maxy + 1);
+
+  const unsigned pattern = samples == 8 ? 3 : samples == 4 ? 2 : samples == 2 ? 1 : 0;
+  double offset[3][8];
+  for(unsigned k=0; k<3; k++)
+    for(unsigned s=0; s<samples; s++)
+      offset[k][s] = (a[k] * sample_position[pattern][s][0] + b[k] * sample_position[pattern][s][1]) / 16;
+  const bool shade = !fb->query_only || shader->writes_depth;
+  const uint32_t scissor_w = (w + FB_TILE - 1) / FB_TILE;
+  const size_t texel_size = framebuffer_texel_size(fb->format);
+
+  for(uint32_t y=y0; y<=y1; y++){
+    const uint32_t iy = h-y-1 - fb->y;
+    const size_t row = framebuffer_row_offset(fb, iy);
+    for(uint32_t x=x0; x<=x1; x++){
+      if(fb->scissor && !fb->scissor[iy / FB_TILE * scissor_w + x / FB_TILE])
+        continue;
+      const double e[3] = { a[0]*x + b[0]*y + c[0], a[1]*x + b[1]*y + c[1], a[2]*x + b[2]*y + c[2] };
+      unsigned covered = 0;
+      double z[8];
+      for(unsigned s=0; s<samples; s++){
+        bool inside = true;
+        double sz = 0;
+        for(unsigned k=0; k<3; k++){
+          const double es = e[k] + offset[k][s];
+          inside = inside && (es > 0 || (es == 0 && owns[k]));
+          sz += es * p[k].data[2];
+        }
+        if(!inside)
+          continue;
+        covered |= 1u << s;
+        z[s] = sz / area;
+      }
+      if(!covered)
+        continue;
+      const size_t at = row + framebuffer_column_offset(fb, x);
+      double*restrict depth = fb->depth + at * samples;
+      unsigned pass = 0;
+      if(!shader->writes_depth){
+        for(unsigned s=0; s<samples; s++)
+          if(covered >> s & 1 && !(z[s] != z[s] || z[s] > depth[s] || z[s] < -1))
+            pass |= 1u << s;
+        if(!pass)
+          continue;
       }
-      if(a->x[1] > b->x[1]){
-        result.x[1] = a->x[1];
-        result.baryzentric[1] = a->baryzentric[1];
+      Vector color = {0};
+      double fragment_depth = 0;
+      const unsigned rate = shade ? tile_rate(fb, shader, x / FB_TILE, iy / FB_TILE) : SR_1X1;
+      struct coarse_fragment* coarse = 0;
+      if(rate && coarse_lookup(fb, rate, x, iy, &coarse)){
+        memcpy(&color, coarse->color, sizeof(color));
       }else{
-        result.x[1] = b->x[1];
-        result.baryzentric[1] = b->baryzentric[1];
+        // The varyings at the center of the pixel, even if it's outside
+        const Vector bcoord = {{ e[0] / area, e[1] / area, e[2] / area, 0 }};
+        Vector varying[SHADER_MAX_ATTRIBUTES];
+        for(unsigned i=0; i<attribute_count; i++)
+          varying[i] = bcoords_interpolate((Vector[]){
+            triangle[i].vertex[0],
+            triangle[i].vertex[1],
+            triangle[i].vertex[2],
+          }, bcoord);
+        fragment_depth = varying->data[2];
+        if(shade)
+          color = shader->fragment(uniform, &fragment_depth, varying);
+        if(coarse)
+          memcpy(coarse->color, &color, sizeof(coarse->color));
+      }
+      if(shader->writes_depth){
+        for(unsigned s=0; s<samples; s++){
+          z[s] = fragment_depth;
+          if(covered >> s & 1 && !(z[s] != z[s] || z[s] > depth[s] || z[s] < -1))
+            pass |= 1u << s;
+        }
+        if(!pass)
+          continue;
+      }
+      for(unsigned s=0; s<samples; s++)
+        fb->samples_passed += pass >> s & 1;
+      if(fb->query_only)
+        continue;
+      uint8_t texel[16] = {0};
+      color_to_texel(texel, fb->format, color);
+      for(unsigned s=0; s<samples; s++){
+        if(!(pass >> s & 1))
+          continue;
+        depth[s] = z[s];
+        copy_texel((uint8_t*)fb->target + (at * samples + s) * texel_size, texel, texel_size);
       }
     }
-
-    if(result.x[0] > boundary[1][0] && result.x[0]-epsilon[0] < boundary[1][0])
-      result.x[0] = boundary[1][0];
-    if(result.x[1] < boundary[0][0] && result.x[1]+epsilon[0] > boundary[0][0])
-      result.x[1] = boundary[0][0];
-    if(result.x[0] > result.x[1]) result.x[0] = result.x[1];
-    if(result.x[1] < result.x[0]) result.x[1] = result.x[0];
-
-    const double sx=result.x[0], ex=result.x[1];
-    const double dx = ex - sx;
-    const Vector sb = result.baryzentric[0];
-    const Vector eb = result.baryzentric[1];
-    if(sx < boundary[0][0]){
-      result.x[0] = boundary[0][0];
-      const double t = dx ? (boundary[0][0]-sx)/dx : 0.;
-      result.baryzentric[0] = vinterpolate(sb, eb, t);
-    }
-    if(ex > boundary[1][0]){
-      result.x[1] = boundary[1][0];
-      const double t = dx ? (boundary[1][0]-sx)/dx : 1.;
-      result.baryzentric[1] = vinterpolate(sb, eb, t);
-    }
-    if(result.x[0] > boundary[1][0] || result.x[1] < boundary[0][0])
-      continue;
-    last = y;
-    out[si++] = result;
   }
-  return si;
 }
 
-// Note: We don't draw things with z<-1, but whings with z>1 are drawn.
-void draw_triangle(
-  const uint32_t w,
-  const uint32_t h,
-  uint8_t image[restrict h][w][4],
-  double depth_plane[restrict h][w],
+// The triangle is split into trapezoids with horizontal top and bottom edges, which are drawn row
+// by row. Only the pixels in the view and in the rows held by the framebuffer are drawn.
+static void draw_slices(
+  Framebuffer*const restrict fb,
   const ShaderProgram*const restrict shader,
   const Uniform*const restrict uniform,
   Triangle triangle[]
 ){
+  const uint32_t w = fb->w;
+  const uint32_t h = fb->h;
+  uint8_t (*const restrict image)[4] = fb->image;
+  uint8_t*const restrict target = fb->target;
+  const size_t texel_size = framebuffer_texel_size(fb->format);
+  double*const restrict depth_plane = fb->depth;
   int si = 0;
-  PolySlice slice[8] = {0}; // TODO: I don't think it really ever needs all 8
+  PolySlice slice[3];
   const unsigned attribute_count = shader->attribute_count;
 
-  if( triangle->vertex[0].data[2] < -1
-   && triangle->vertex[1].data[2] < -1
-   && triangle->vertex[2].data[2] < -1
-  ) return;
-
   int a=0, b=1, c=2;
-  { // Split triangle into vertical trapezoid slices, so we can just render what's inside the view port, and don't have to deal with coords outside -1..1 later.
+  {
     if(triangle->vertex[a].data[1] > triangle->vertex[b].data[1]){ a=1, b=0; }
     if(triangle->vertex[a].data[1] > triangle->vertex[c].data[1]){ c=a, a=2; }
     if(triangle->vertex[b].data[1] > triangle->vertex[c].data[1]){ int t=c; c=b, b=t; }
-    if(triangle->vertex[a].data[1] >  1) return;
-    if(triangle->vertex[c].data[1] < -1) return;
     const double dcy = triangle->vertex[c].data[1] - triangle->vertex[a].data[1];
 
     PolySlice aslice = {
@@ -168,104 +367,496 @@ void draw_triangle(
       },
     };
 
-    const double epsilon[2] = {1./w, 1./h};
+    // With a flat top or bottom, the slice through b already is that edge
+    if(bslice.y > aslice.y)
+      slice[si++] = aslice;
+    slice[si++] = bslice;
+    if(cslice.y > bslice.y)
+      slice[si++] = cslice;
+  }
+
+  // The rows held by the framebuffer. y is flipped, see iy below.
+  const uint32_t band_sy = h - fb->y - fb->rows;
+  const uint32_t band_ey = h - fb->y - 1;
 
-    // Split the poly sections to the boundary
-    si += PolySlice_cut(&slice[si], &aslice, &bslice, (const double[2][2]){{-1,-1},{1,1}}, si ? slice[si-1].y : -2, epsilon);
-    si += PolySlice_cut(&slice[si], &bslice, &cslice, (const double[2][2]){{-1,-1},{1,1}}, si ? slice[si-1].y : -2, epsilon);
+  // Depth is interpolated linearly, so no pixel of the triangle is nearer than its nearest vertex.
+  // If all depth tiles it touches are already nearer than that, it's hidden.
+  const bool hiz = fb->hiz && !shader->writes_depth;
+  if(hiz && si > 1){
+    const Vector*restrict p = triangle->vertex;
+    const double zmin = fmin(fmin(p[0].data[2], p[1].data[2]), p[2].data[2]) - HIZ_EPSILON;
+    double minx = INFINITY, maxx = -INFINITY;
+    for(int i=0; i<si; i++){
+      minx = fmin(minx, slice[i].x[0]);
+      maxx = fmax(maxx, slice[i].x[1]);
+    }
+    const int64_t sy = pixel(slice[0].y, h);
+    const int64_t ey = pixel(slice[si-1].y, h);
+    const int64_t x0 = pixel(minx, w);
+    const int64_t x1 = pixel(maxx, w);
+    if(x1 < 0 || x0 > (int64_t)w-1)
+      return;
+    if(sy > band_ey || ey < band_sy)
+      return;
+    const uint32_t ry = ey<band_ey?ey:band_ey;
+    const uint32_t y0 = sy>band_sy?sy:band_sy;
+    const uint32_t tx0 = (x0 < 0 ? 0 : x0) / HIZ_TILE;
+    const uint32_t tx1 = (x1 > (int64_t)w-1 ? w-1 : x1) / HIZ_TILE;
+    const uint32_t ty0 = (h-ry-1 - fb->y) / HIZ_TILE;
+    const uint32_t ty1 = (h-y0-1 - fb->y) / HIZ_TILE;
+    bool hidden = true;
+    for(uint32_t ty=ty0; hidden && ty<=ty1; ty++)
+      for(uint32_t tx=tx0; hidden && tx<=tx1; tx++)
+        hidden = zmin > framebuffer_hiz_max(fb, tx, ty);
+    if(hidden)
+      return;
   }
+  // In a query, the fragment shader only needs to run if it changes the depth
+  const bool shade = !fb->query_only || shader->writes_depth;
+  const uint32_t scissor_w = (w + FB_TILE - 1) / FB_TILE;
 
   // Breseham would probably be faster, but this was simpler to figure out & I'm lazy
   for(int i=0; i<si-1; i++){
     const PolySlice*const restrict s = &slice[i];
     const PolySlice*const restrict e = &slice[i+1];
-    const uint32_t sy = (s->y+1.)/2. * (h-1);
-    const uint32_t ey = (e->y+1.)/2. * (h-1);
-    const uint32_t sxa[2] = { (s->x[0]+1.)/2.*(w-1), (s->x[1]+1.)/2.*(w-1) };
-    const uint32_t exa[2] = { (e->x[0]+1.)/2.*(w-1), (e->x[1]+1.)/2.*(w-1) };
-    const uint32_t ly = (ey - sy) ?  (ey - sy) : 1;
-    for(uint32_t y=sy; y<=ey; y++){
-      const uint32_t iy = h-y-1;
-      // FIXME: In theory, I'd need 65bit in the absolute worst case
-      // And don't use double here, integer arithmetic is used to avoid blank pixels due to non-linear precision errors
-      const uint32_t sx = ( (uint64_t)sxa[0]*(ly-(y-sy)) + (uint64_t)exa[0]*(y-sy) )/ly;
-      const uint32_t ex = ( (uint64_t)sxa[1]*(ly-(y-sy)) + (uint64_t)exa[1]*(y-sy) )/ly;
-      const uint32_t lx = (ex - sx) ? (ex - sx) : 1;
+    const int64_t sy = pixel(s->y, h);
+    const int64_t ey = pixel(e->y, h);
+    const int64_t sxa[2] = { pixel(s->x[0], w), pixel(s->x[1], w) };
+    const int64_t exa[2] = { pixel(e->x[0], w), pixel(e->x[1], w) };
+    const int64_t ly = (ey - sy) ?  (ey - sy) : 1;
+    const int64_t ry = ey<band_ey?ey:band_ey;
+    for(int64_t y=sy>band_sy?sy:band_sy; y<=ry; y++){
+      const uint32_t iy = h-y-1 - fb->y;
+      const size_t row = framebuffer_row_offset(fb, iy);
+      // Don't use double here, integer arithmetic is used to avoid blank pixels due to non-linear precision errors.
+      // The guard band keeps the products far from overflowing.
+      const int64_t sx = floor_div(sxa[0]*(ly-(y-sy)) + exa[0]*(y-sy), ly);
+      const int64_t ex = floor_div(sxa[1]*(ly-(y-sy)) + exa[1]*(y-sy), ly);
+      if(ex < 0 || sx > (int64_t)w-1 || sx > ex)
+        continue;
+      const int64_t lx = (ex - sx) ? (ex - sx) : 1;
+      const uint32_t x0 = sx < 0 ? 0 : sx;
+      const uint32_t x1 = ex > (int64_t)w-1 ? w-1 : ex;
       const double ty = ((double)y-sy)/ly;
       const Vector sb = vinterpolate(s->baryzentric[0], e->baryzentric[0], ty);
       const Vector eb = vinterpolate(s->baryzentric[1], e->baryzentric[1], ty);
-      for(uint32_t x=sx; x<=ex; x++){
-        const double tx = ((double)x-sx)/lx;
-        const Vector bcoord = vinterpolate(sb, eb, tx);
-        Vector varying[attribute_count];
-        for(unsigned i=0; i<attribute_count; i++)
-          varying[i] = bcoords_interpolate((Vector[]){
-            triangle[i].vertex[a],
-            triangle[i].vertex[b],
-            triangle[i].vertex[c],
-          }, bcoord);
-        Vector color = {0};
-        double depth = varying->data[2];
-        color = shader->fragment(uniform, &depth, varying);
-        if(depth != depth || depth > depth_plane[y][x] || depth < -1)
-          continue;
-        depth_plane[y][x] = depth;
-        color = vmulf(color, 0x100);
-        if(color.data[0] <= 0x00) color.data[0] = 0x00;
-        if(color.data[1] <= 0x00) color.data[1] = 0x00;
-        if(color.data[2] <= 0x00) color.data[2] = 0x00;
-        if(color.data[0] >= 0xFF) color.data[0] = 0xFF;
-        if(color.data[1] >= 0xFF) color.data[1] = 0xFF;
-        if(color.data[2] >= 0xFF) color.data[2] = 0xFF;
-        // iy is a flipped versions of y.
-        image[iy][x][2] = color.data[0];
-        image[iy][x][1] = color.data[1];
-        image[iy][x][0] = color.data[2];
-        image[iy][x][3] = 0xFF;
+      const Vector zabc = {{ triangle->vertex[a].data[2], triangle->vertex[b].data[2], triangle->vertex[c].data[2] }};
+      // The span is walked one depth tile at a time, parts behind everything in their tile are skipped
+      for(uint32_t x=x0, end=x1; x<=x1; x=end+1){
+        struct hiz_tile*restrict tile = 0;
+        if(fb->hiz || fb->scissor || fb->shading_rate_image){
+          const uint32_t tx = x / HIZ_TILE;
+          end = (tx+1) * HIZ_TILE - 1;
+          if(end > x1)
+            end = x1;
+          if(fb->scissor && !fb->scissor[iy / FB_TILE * scissor_w + tx])
+            continue;
+          if(fb->hiz)
+            tile = &fb->hiz[iy / HIZ_TILE * fb->hiz_w + tx];
+        }
+        if(hiz){
+          const double z0 = vdot(vinterpolate(sb, eb, ((double)x-sx)/lx), zabc);
+          const double z1 = vdot(vinterpolate(sb, eb, ((double)end-sx)/lx), zabc);
+          if(fmin(z0, z1) - HIZ_EPSILON > framebuffer_hiz_max(fb, x / HIZ_TILE, iy / HIZ_TILE))
+            continue;
+          // All of it in front of everything in the tile
+          if(!shade && fmin(z0, z1) - HIZ_EPSILON >= -1 && fmax(z0, z1) + HIZ_EPSILON < tile->min){
+            fb->samples_passed += end - x + 1;
+            continue;
+          }
+        }
+        // With coarse shading, only the position is needed for the depth test. The other varyings
+        // are only interpolated for the pixels which shade their block.
+        const unsigned rate = shade ? tile_rate(fb, shader, x / FB_TILE, iy / FB_TILE) : SR_1X1;
+        const unsigned interpolated = rate ? 1 : attribute_count;
+        double written = INFINITY;
+        for(; x<=end; x++){
+          const double tx = ((double)x-sx)/lx;
+          const Vector bcoord = vinterpolate(sb, eb, tx);
+          Vector varying[SHADER_MAX_ATTRIBUTES];
+          for(unsigned i=0; i<interpolated; i++)
+            varying[i] = bcoords_interpolate((Vector[]){
+              triangle[i].vertex[a],
+              triangle[i].vertex[b],
+              triangle[i].vertex[c],
+            }, bcoord);
+          Vector color = {0};
+          double depth = varying->data[2];
+          if(shade && !rate)
+            color = shader->fragment(uniform, &depth, varying);
+          const size_t at = row + framebuffer_column_offset(fb, x);
+          if(depth != depth || depth > depth_plane[at] || depth < -1)
+            continue;
+          fb->samples_passed++;
+          if(fb->query_only)
+            continue;
+          if(rate){
+            struct coarse_fragment* coarse;
+            if(!coarse_lookup(fb, rate, x, iy, &coarse)){
+              for(unsigned i=1; i<attribute_count; i++)
+                varying[i] = bcoords_interpolate((Vector[]){
+                  triangle[i].vertex[a],
+                  triangle[i].vertex[b],
+                  triangle[i].vertex[c],
+                }, bcoord);
+              double fragment_depth = depth;
+              color = shader->fragment(uniform, &fragment_depth, varying);
+              memcpy(coarse->color, &color, sizeof(coarse->color));
+            }
+            memcpy(&color, coarse->color, sizeof(color));
+          }
+          depth_plane[at] = depth;
+          if(depth < written)
+            written = depth;
+          // iy is a flipped versions of y.
+          if(target){
+            color_to_texel(target + at * texel_size, fb->format, color);
+          }else{
+            color_to_bgrx(image[at], color);
+          }
+        }
+        if(tile && written != INFINITY){
+          if(written < tile->min)
+            tile->min = written;
+          tile->dirty = true;
+        }
       }
     }
   }
 }
 
 
-// Draw the geometry
-void draw(
-  const uint32_t w,
-  const uint32_t h,
-  uint8_t image[h][w][4],
-  double depth[h][w],
+static inline void rasterize(
+  Framebuffer*const restrict fb,
   const ShaderProgram*const restrict shader,
   const Uniform*const restrict uniform,
-  const Geometry*const restrict geometry
+  Triangle triangle[]
+){
+  coarse_begin(fb);
+  if(fb->samples > 1){
+    draw_triangle_msaa(fb, shader, uniform, triangle);
+  }else{
+    draw_slices(fb, shader, uniform, triangle);
+  }
+}
+
+// Sutherland-Hodgman, against the planes in clip one after another. Points on an edge are always
+// interpolated from its inside end, so triangles sharing the edge get the same ones. The polygon
+// left over is drawn as a fan of triangles.
+static void draw_clipped(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  Triangle triangle[],
+  unsigned clip
 ){
   const unsigned attribute_count = shader->attribute_count;
-  for(unsigned i=0; i<geometry->triangle_count; i++){
-    Triangle triangle_in[AIN_COUNT] = {0};
-    for(enum e_attribute_in j=0; j<AIN_COUNT; j++){
-      const Attribute attribute = geometry->attribute[j];
-      if(attribute.vertex){
-        const unsigned*restrict indeces = attribute.index ? attribute.index[i] : (unsigned[]){i*3+0,i*3+1,i*3+2};
-        for(unsigned k=0; k<3; k++)
-          triangle_in[j].vertex[k] = attribute.vertex ? attribute.vertex[indeces[k]] : (Vector){{0,0,0,1}};
-      }else{
-        for(unsigned k=0; k<3; k++)
-          triangle_in[j].vertex[k] = attribute.vertex_default;
+  Vector polygon[2][CLIP_MAX_VERTICES][SHADER_MAX_ATTRIBUTES];
+  unsigned n = 3, in = 0;
+  for(unsigned k=0; k<3; k++)
+    for(unsigned i=0; i<attribute_count; i++)
+      polygon[0][k][i] = triangle[i].vertex[k];
+  for(enum clip_plane plane=0; plane<CP_COUNT; plane++){
+    if(!(clip >> plane & 1))
+      continue;
+    Vector (*const src)[SHADER_MAX_ATTRIBUTES] = polygon[in];
+    Vector (*const dst)[SHADER_MAX_ATTRIBUTES] = polygon[!in];
+    unsigned m = 0;
+    for(unsigned k=0; k<n; k++){
+      const unsigned l = (k+1) % n;
+      const double dk = plane_distance(plane, &src[k][0]);
+      const double dl = plane_distance(plane, &src[l][0]);
+      if(dk >= 0)
+        memcpy(dst[m++], src[k], sizeof(*src[k]) * attribute_count);
+      if((dk >= 0) == (dl >= 0))
+        continue;
+      const unsigned from = dk >= 0 ? k : l, to = dk >= 0 ? l : k;
+      const double df = dk >= 0 ? dk : dl, dt = dk >= 0 ? dl : dk;
+      const double t = df / (df - dt);
+      for(unsigned i=0; i<attribute_count; i++)
+        dst[m][i] = vinterpolate(src[from][i], src[to][i], t);
+      // Exactly on the plane
+      switch(plane){
+        case CP_NEAR  : dst[m][0].data[2] = -1; break;
+        case CP_LEFT  : dst[m][0].data[0] = -GUARD_BAND; break;
+        case CP_RIGHT : dst[m][0].data[0] =  GUARD_BAND; break;
+        case CP_BOTTOM: dst[m][0].data[1] = -GUARD_BAND; break;
+        case CP_TOP   : dst[m][0].data[1] =  GUARD_BAND; break;
+        case CP_COUNT : break;
       }
+      m++;
+    }
+    n = m;
+    in = !in;
+    if(n < 3)
+      return;
+  }
+  Triangle fan[SHADER_MAX_ATTRIBUTES];
+  for(unsigned k=1; k+1<n; k++){
+    for(unsigned i=0; i<attribute_count; i++){
+      fan[i].vertex[0] = polygon[in][0][i];
+      fan[i].vertex[1] = polygon[in][k][i];
+      fan[i].vertex[2] = polygon[in][k+1][i];
+    }
+    rasterize(fb, shader, uniform, fan);
+  }
+}
+
+// Triangles are only clipped if they cross the near plane or the guard band. The rest are drawn as
+// they are, the parts outside the view are skipped while drawing them.
+void draw_triangle(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  Triangle triangle[]
+){
+  assert(shader->attribute_count <= SHADER_MAX_ATTRIBUTES);
+  const Vector*restrict p = triangle->vertex;
+  unsigned all = ~0u, any = 0;
+  for(unsigned k=0; k<3; k++){
+    if(p[k].data[0] != p[k].data[0] || p[k].data[1] != p[k].data[1] || p[k].data[2] != p[k].data[2])
+      return;
+    const unsigned code = outcode(&p[k], fb->w);
+    all &= code;
+    any |= code;
+  }
+  if(all)
+    return;
+  if(any & CLIP_MASK){
+    draw_clipped(fb, shader, uniform, triangle, any & CLIP_MASK);
+  }else{
+    rasterize(fb, shader, uniform, triangle);
+  }
+}
+
+void process_triangle(
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  unsigned i,
+  Triangle triangle_out[restrict]
+){
+  const unsigned attribute_count = shader->attribute_count;
+  assert(attribute_count <= SHADER_MAX_ATTRIBUTES);
+  Triangle triangle_in[AIN_COUNT] = {0};
+  for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+    attribute_fetch(&geometry->attribute[j], i, triangle_in[j].vertex);
+  memset(triangle_out, 0, sizeof(*triangle_out) * attribute_count);
+  shader->triangle(uniform, triangle_out, triangle_in);
+  for(unsigned k=0; k<3; k++){
+    Vector input[AIN_COUNT];
+    for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
+      input[j] = triangle_in[j].vertex[k];
+    Vector output[SHADER_MAX_ATTRIBUTES];
+    for(unsigned j=0; j<attribute_count; j++)
+      output[j] = triangle_out[j].vertex[k];
+    shader->vertex(uniform, output, input);
+    for(unsigned j=0; j<attribute_count; j++)
+      triangle_out[j].vertex[k] = output[j];
+  }
+}
+
+bool meshlet_visible(const struct meshlet*restrict meshlet, const Matrix*restrict modelview, float margin, bool cull_back_faces){
+  const Matrix*restrict m = modelview;
+  // Against the view volume, see draw_triangle
+  const Vector c = mmulv(*m, meshlet->center);
+  // The sphere reaches r times the length of the row of the matrix in each view direction,
+  // however the linear part skews it
+  double r[3];
+  for(unsigned j=0; j<3; j++){
+    const Vector row = {{ m->axis[0].data[j], m->axis[1].data[j], m->axis[2].data[j], 0 }};
+    r[j] = meshlet->radius * sqrt(vdot(row, row));
+  }
+  if(c.data[0] - r[0] > 1 + margin || c.data[0] + r[0] < -1 - margin
+  || c.data[1] - r[1] > 1 || c.data[1] + r[1] < -1
+  || c.data[2] + r[2] < -1)
+    return false;
+  if(!cull_back_faces || meshlet->cone_cutoff > 1)
+    return true;
+  // A triangle faces away if its normal has a positive z in the view. Without a projection,
+  // that's the case if the dot product of its normal with the cross product of the x and y rows
+  // of the matrix is positive, and then it is for all normals in the cone, if the axis is in it.
+  const Vector x = {{ m->axis[0].data[0], m->axis[1].data[0], m->axis[2].data[0], 0 }};
+  const Vector y = {{ m->axis[0].data[1], m->axis[1].data[1], m->axis[2].data[1], 0 }};
+  Vector d = vcross(x, y);
+  d.data[3] = 0;
+  const double length = sqrt(vdot(d, d));
+  Vector axis = meshlet->cone_axis;
+  axis.data[3] = 0;
+  return !(length > 0 && vdot(axis, d) / length > meshlet->cone_cutoff);
+}
+
+bool triangle_facing_away(const Triangle*restrict position){
+  const Vector*restrict v = position->vertex;
+  const double area = (v[1].data[0] - v[0].data[0]) * (v[2].data[1] - v[0].data[1])
+                    - (v[1].data[1] - v[0].data[1]) * (v[2].data[0] - v[0].data[0]);
+  return !(area < 0);
+}
+
+// Vertices are processed in units, a meshlet, or a run of triangles if there are none
+#define UNIT_TRIANGLES 256
+
+struct process_job {
+  const ShaderProgram* shader;
+  const Uniform* uniform;
+  const Geometry* geometry;
+  float margin;
+  Triangle* triangle; // attribute_count for every triangle
+  bool* skip;         // For the triangles which can't be seen
+  unsigned unit_count;
+  atomic_uint next;
+};
+
+static void process_unit(struct process_job*restrict job, unsigned unit){
+  const Geometry*restrict geometry = job->geometry;
+  const unsigned attribute_count = job->shader->attribute_count;
+  unsigned first = unit * UNIT_TRIANGLES;
+  unsigned count = geometry->triangle_count - first < UNIT_TRIANGLES ? geometry->triangle_count - first : UNIT_TRIANGLES;
+  if(geometry->meshlet){
+    const struct meshlet*restrict meshlet = &geometry->meshlet[unit];
+    first = meshlet->first;
+    count = meshlet->count;
+    if(!meshlet_visible(meshlet, &job->uniform->modelview, job->margin, geometry->cull_back_faces)){
+      memset(job->skip + first, true, count);
+      return;
     }
-    Triangle triangle_out[attribute_count];
-    memset(triangle_out, 0, sizeof(triangle_out));
-    shader->triangle(uniform, triangle_out, triangle_in);
-    for(unsigned k=0; k<3; k++){
-      Vector input[AIN_COUNT];
-      for(enum e_attribute_in j=0; j<AIN_COUNT; j++)
-        input[j] = triangle_in[j].vertex[k];
-      Vector output[attribute_count];
-      for(unsigned j=0; j<attribute_count; j++)
-        output[j] = triangle_out[j].vertex[k];
-      shader->vertex(uniform, output, input);
-      for(unsigned j=0; j<attribute_count; j++)
-        triangle_out[j].vertex[k] = output[j];
+  }
+  for(unsigned i=first; i<first+count; i++){
+    Triangle*restrict triangle = job->triangle + (size_t)i*attribute_count;
+    process_triangle(job->shader, job->uniform, geometry, i, triangle);
+    job->skip[i] = geometry->cull_back_faces && triangle_facing_away(triangle);
+  }
+}
+
+static void* process_worker(void* param){
+  struct process_job*restrict job = param;
+  for(unsigned unit; (unit = atomic_fetch_add(&job->next, 1)) < job->unit_count; )
+    process_unit(job, unit);
+  return 0;
+}
+
+// All vertices are processed first, by threads if there are more than one, then the triangles are
+// drawn in order. In the meantime, the texture can finish loading. Returns false if there wasn't
+// enough memory to keep all processed triangles.
+static bool draw_processed(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  unsigned threads
+){
+  const unsigned attribute_count = shader->attribute_count;
+  struct process_job job = {
+    .shader = shader,
+    .uniform = uniform,
+    .geometry = geometry,
+    .margin = 1.f / fb->w,
+    .triangle = dparaster_alloc(sizeof(Triangle) * attribute_count * geometry->triangle_count + 1, DPM_SCRATCH),
+    .skip = dparaster_alloc(geometry->triangle_count + 1, DPM_SCRATCH),
+    .unit_count = geometry->meshlet ? geometry->meshlet_count : (geometry->triangle_count + UNIT_TRIANGLES - 1) / UNIT_TRIANGLES,
+  };
+  if(!job.triangle || !job.skip){
+    dparaster_free(job.triangle);
+    dparaster_free(job.skip);
+    return false;
+  }
+  atomic_init(&job.next, 0);
+  if(threads > job.unit_count)
+    threads = job.unit_count ? job.unit_count : 1;
+  // Without memory for the handles, this thread does it alone
+  pthread_t* thread = threads > 1 ? dparaster_alloc(sizeof(*thread) * (threads-1), DPM_SCRATCH) : 0;
+  unsigned started = 0;
+  for(; thread && started<threads-1; started++)
+    if(pthread_create(&thread[started], 0, process_worker, &job))
+      break;
+  process_worker(&job);
+  while(started--)
+    pthread_join(thread[started], 0);
+  dparaster_free(thread);
+
+  Uniform resolved = *uniform;
+  if(!resolved.tex && resolved.tex_future)
+    resolved.tex = texture_future_wait(resolved.tex_future);
+  for(unsigned i=0; i<geometry->triangle_count; i++)
+    if(!job.skip[i])
+      draw_triangle(fb, shader, &resolved, job.triangle + (size_t)i*attribute_count);
+  dparaster_free(job.skip);
+  dparaster_free(job.triangle);
+  return true;
+}
+
+void draw(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry
+){
+  if(!uniform->tex && uniform->tex_future){
+    if(draw_processed(fb, shader, uniform, geometry, 1))
+      return;
+    // Without the memory for that, it has to wait now
+    Uniform resolved = *uniform;
+    resolved.tex = texture_future_wait(uniform->tex_future);
+    draw(fb, shader, &resolved, geometry);
+    return;
+  }
+  const float margin = 1.f / fb->w;
+  for(unsigned m=0, n=geometry->meshlet ? geometry->meshlet_count : 1; m<n; m++){
+    unsigned first = 0, count = geometry->triangle_count;
+    if(geometry->meshlet){
+      const struct meshlet*restrict meshlet = &geometry->meshlet[m];
+      if(!meshlet_visible(meshlet, &uniform->modelview, margin, geometry->cull_back_faces))
+        continue;
+      first = meshlet->first;
+      count = meshlet->count;
+    }
+    for(unsigned i=first; i<first+count; i++){
+      Triangle triangle_out[SHADER_MAX_ATTRIBUTES];
+      process_triangle(shader, uniform, geometry, i, triangle_out);
+      if(geometry->cull_back_faces && triangle_facing_away(triangle_out))
+        continue;
+      draw_triangle(fb, shader, uniform, triangle_out);
     }
-    draw_triangle(w,h,image,depth, shader, uniform, triangle_out);
   }
 }
+
+void draw_threaded(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  unsigned threads
+){
+  if(threads < 2 || !draw_processed(fb, shader, uniform, geometry, threads))
+    draw(fb, shader, uniform, geometry);
+}
+
+void begin_query(Framebuffer* fb){
+  fb->samples_passed = 0;
+}
+
+uint64_t end_query(Framebuffer* fb){
+  return fb->samples_passed;
+}
+
+bool draw_conditional(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  const Geometry*const restrict geometry,
+  const Geometry*const restrict proxy
+){
+  const bool query_only = fb->query_only;
+  const uint64_t samples_passed = fb->samples_passed;
+  fb->query_only = true;
+  // The texture isn't needed for the test
+  Uniform test = *uniform;
+  test.tex_future = 0;
+  draw(fb, shader, &test, proxy);
+  const bool visible = fb->samples_passed != samples_passed;
+  fb->query_only = query_only;
+  fb->samples_passed = samples_passed;
+  if(visible)
+    draw(fb, shader, uniform, geometry);
+  return visible;
+}
@@ -0,0 +1,274 @@
+#include <dparaster/render_queue.h>
+#include <dparaster/allocator.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+enum render_slot_state {
+  RS_FREE,
+  RS_RENDERING,
+  RS_READY,
+};
+
+struct render_job {
+  render_queue__render* render;
+  render_queue__done* done;
+  void* param;
+};
+
+struct render_slot {
+  Framebuffer* fb;
+  enum render_slot_state state;
+  render_fence frame;
+  struct render_job job;
+};
+
+// Each worker has its own deque of jobs, in submission order. Workers take the oldest job from their
+// own deque first, and steal from the other ones once theirs is empty. Frames are only ever started
+// if they are less than config.buffers frames ahead of the next frame to be written. Together with
+// the writer waiting for frames in order, this forms a reorder buffer, which can't grow beyond the
+// framebuffer pool, and there is always a framebuffer free for the next frame to be written.
+struct render_deque {
+  unsigned head, length;
+  render_fence* frame; // Ring buffer with job_count entries
+};
+
+struct render_queue {
+  struct render_queue_config config;
+  pthread_mutex_t lock;
+  pthread_cond_t work;     // Signaled when there is a new job or a frame got written
+  pthread_cond_t ready;    // Signaled when a frame finished rendering
+  pthread_cond_t progress; // Signaled when a frame has been written
+  bool stop;
+  bool failed;
+  render_fence submitted, written;
+  unsigned pending; // Jobs which haven't been started yet
+  unsigned job_count;
+  struct render_job* job; // Ring buffer with job_count entries, indexed by frame
+  struct render_slot* slot;
+  pthread_t writer;
+  unsigned worker_count;
+  struct render_worker {
+    struct render_queue* queue;
+    struct render_deque deque;
+    pthread_t thread;
+  } worker[];
+};
+
+static struct render_slot* get_slot(struct render_queue* queue, enum render_slot_state state, render_fence frame){
+  for(unsigned i=0; i<queue->config.buffers; i++){
+    struct render_slot* slot = &queue->slot[i];
+    if(slot->state == state && (state == RS_FREE || slot->frame == frame))
+      return slot;
+  }
+  return 0;
+}
+
+static bool deque_front(struct render_queue* queue, const struct render_deque* deque, render_fence* frame){
+  if(!deque->length)
+    return false;
+  *frame = deque->frame[deque->head];
+  return *frame - queue->written < queue->config.buffers;
+}
+
+static void deque_pop_front(struct render_queue* queue, struct render_deque* deque){
+  deque->head = (deque->head + 1) % queue->job_count;
+  deque->length--;
+}
+
+static void deque_push_back(struct render_queue* queue, struct render_deque* deque, render_fence frame){
+  deque->frame[(deque->head + deque->length++) % queue->job_count] = frame;
+}
+
+static bool take_job(struct render_worker* worker, render_fence* frame){
+  struct render_queue* queue = worker->queue;
+  struct render_deque* deque = &worker->deque;
+  if(!deque_front(queue, deque, frame)){
+    deque = 0;
+    // Steal the oldest job we are allowed to start
+    for(unsigned i=0; i<queue->worker_count; i++){
+      struct render_deque* victim = &queue->worker[i].deque;
+      render_fence f = 0;
+      if(victim == &worker->deque || !deque_front(queue, victim, &f))
+        continue;
+      if(!deque || f < *frame){
+        deque = victim;
+        *frame = f;
+      }
+    }
+    if(!deque)
+      return false;
+  }
+  deque_pop_front(queue, deque);
+  queue->pending--;
+  return true;
+}
+
+static void* worker_main(void* param){
+  struct render_worker* worker = param;
+  struct render_queue* queue = worker->queue;
+  pthread_mutex_lock(&queue->lock);
+  while(true){
+    render_fence frame = 0;
+    bool found = false;
+    while( !(queue->stop && !queue->pending)
+        && !(found=take_job(worker, &frame))
+    ) pthread_cond_wait(&queue->work, &queue->lock);
+    if(!found)
+      break;
+    struct render_slot* slot = get_slot(queue, RS_FREE, 0);
+    slot->state = RS_RENDERING;
+    slot->frame = frame;
+    slot->job = queue->job[frame % queue->job_count];
+    pthread_mutex_unlock(&queue->lock);
+    framebuffer_clear(slot->fb);
+    slot->job.render(slot->job.param, slot->fb, frame);
+    pthread_mutex_lock(&queue->lock);
+    slot->state = RS_READY;
+    pthread_cond_signal(&queue->ready);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+static void* writer_main(void* param){
+  struct render_queue* queue = param;
+  pthread_mutex_lock(&queue->lock);
+  while(true){
+    struct render_slot* slot = 0;
+    while( !(queue->stop && queue->written == queue->submitted)
+        && !(slot=get_slot(queue, RS_READY, queue->written))
+    ) pthread_cond_wait(&queue->ready, &queue->lock);
+    if(!slot)
+      break;
+    const render_fence frame = queue->written;
+    const struct render_job job = slot->job;
+    bool ok = !queue->failed;
+    pthread_mutex_unlock(&queue->lock);
+    if(ok)
+      ok = queue->config.output(queue->config.output_param, slot->fb, frame);
+    if(job.done)
+      job.done(job.param, frame, ok);
+    pthread_mutex_lock(&queue->lock);
+    if(!ok)
+      queue->failed = true;
+    slot->state = RS_FREE;
+    queue->written++;
+    pthread_cond_broadcast(&queue->work);
+    pthread_cond_broadcast(&queue->progress);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+struct render_queue* render_queue_create(const struct render_queue_config* config){
+  if(!config->workers || !config->buffers || !config->output)
+    goto error;
+  struct render_queue* queue = dparaster_calloc(1, sizeof(*queue) + sizeof(*queue->worker) * config->workers, DPM_FRAMEBUFFER);
+  if(!queue)
+    goto error;
+  queue->config = *config;
+  queue->job_count = config->buffers * 2;
+  queue->job = dparaster_calloc(queue->job_count, sizeof(*queue->job), DPM_FRAMEBUFFER);
+  if(!queue->job)
+    goto error_after_alloc;
+  unsigned j = 0;
+  for(; j<config->workers; j++){
+    queue->worker[j].queue = queue;
+    queue->worker[j].deque.frame = dparaster_calloc(queue->job_count, sizeof(render_fence), DPM_FRAMEBUFFER);
+    if(!queue->worker[j].deque.frame)
+      goto error_after_deque;
+  }
+  queue->slot = dparaster_calloc(config->buffers, sizeof(*queue->slot), DPM_FRAMEBUFFER);
+  if(!queue->slot)
+    goto error_after_deque;
+  unsigned i = 0;
+  for(; i<config->buffers; i++)
+    if(!(queue->slot[i].fb = framebuffer_create_with_flags(config->w, config->h, config->framebuffer_flags)))
+      goto error_after_fb;
+  pthread_mutex_init(&queue->lock, 0);
+  pthread_cond_init(&queue->work, 0);
+  pthread_cond_init(&queue->ready, 0);
+  pthread_cond_init(&queue->progress, 0);
+  if(pthread_create(&queue->writer, 0, writer_main, queue))
+    goto error_after_sync;
+  for(; queue->worker_count<config->workers; queue->worker_count++)
+    if(pthread_create(&queue->worker[queue->worker_count].thread, 0, worker_main, &queue->worker[queue->worker_count]))
+      break;
+  if(!queue->worker_count){
+    render_queue_destroy(queue);
+    goto error;
+  }
+  return queue;
+error_after_sync:
+  pthread_cond_destroy(&queue->progress);
+  pthread_cond_destroy(&queue->ready);
+  pthread_cond_destroy(&queue->work);
+  pthread_mutex_destroy(&queue->lock);
+error_after_fb:
+  while(i--)
+    framebuffer_free(queue->slot[i].fb);
+  dparaster_free(queue->slot);
+error_after_deque:
+  while(j--)
+    dparaster_free(queue->worker[j].deque.frame);
+  dparaster_free(queue->job);
+error_after_alloc:
+  dparaster_free(queue);
+error:
+  return 0;
+}
+
+render_fence render_queue_submit(struct render_queue* queue, render_queue__render* render, render_queue__done* done, void* param){
+  pthread_mutex_lock(&queue->lock);
+  while(queue->submitted - queue->written >= queue->job_count)
+    pthread_cond_wait(&queue->progress, &queue->lock);
+  const render_fence frame = queue->submitted++;
+  queue->job[frame % queue->job_count] = (struct render_job){
+    .render = render,
+    .done = done,
+    .param = param,
+  };
+  deque_push_back(queue, &queue->worker[frame % queue->worker_count].deque, frame);
+  queue->pending++;
+  pthread_cond_broadcast(&queue->work);
+  pthread_mutex_unlock(&queue->lock);
+  return frame;
+}
+
+bool render_queue_wait(struct render_queue* queue, render_fence fence){
+  pthread_mutex_lock(&queue->lock);
+  while(queue->written <= fence && fence < queue->submitted)
+    pthread_cond_wait(&queue->progress, &queue->lock);
+  const bool ok = !queue->failed;
+  pthread_mutex_unlock(&queue->lock);
+  return ok;
+}
+
+bool render_queue_finish(struct render_queue* queue){
+  pthread_mutex_lock(&queue->lock);
+  const render_fence last = queue->submitted;
+  pthread_mutex_unlock(&queue->lock);
+  return render_queue_wait(queue, last ? last-1 : 0);
+}
+
+void render_queue_destroy(struct render_queue* queue){
+  pthread_mutex_lock(&queue->lock);
+  queue->stop = true;
+  pthread_cond_broadcast(&queue->work);
+  pthread_cond_broadcast(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+  for(unsigned i=0; i<queue->worker_count; i++)
+    pthread_join(queue->worker[i].thread, 0);
+  pthread_join(queue->writer, 0);
+  pthread_cond_destroy(&queue->progress);
+  pthread_cond_destroy(&queue->ready);
+  pthread_cond_destroy(&queue->work);
+  pthread_mutex_destroy(&queue->lock);
+  for(unsigned i=0; i<queue->config.buffers; i++)
+    framebuffer_free(queue->slot[i].fb);
+  dparaster_free(queue->slot);
+  for(unsigned i=0; i<queue->config.workers; i++)
+    dparaster_free(queue->worker[i].deque.frame);
+  dparaster_free(queue->job);
+  dparaster_free(queue);
+}
@@ -0,0 +1,358 @@
+#include <dparaster/scene.h>
+#include <dparaster/rasterizer.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define LEAF_SIZE 4
+
+struct bounds {
+  float min[3], max[3];
+};
+
+struct scene_object {
+  const Geometry* geometry;
+  Matrix transform;
+  struct bounds local; // Of the geometry
+  struct bounds world;
+};
+
+// Inner nodes have a count of 0, and their children at first and first+1.
+// Leaves have count objects, listed in the order array from first on.
+struct scene_node {
+  struct bounds bounds;
+  unsigned first, count;
+};
+
+struct scene {
+  struct scene_object* object;
+  unsigned object_count, object_capacity;
+  int* order;
+  struct scene_node* node;
+  unsigned node_count;
+  bool need_build, need_refit;
+};
+
+static const struct bounds empty_bounds = {
+  { INFINITY,  INFINITY,  INFINITY},
+  {-INFINITY, -INFINITY, -INFINITY},
+};
+
+static inline void bounds_add(struct bounds*restrict a, const struct bounds*restrict b){
+  for(unsigned i=0; i<3; i++){
+    if(b->min[i] < a->min[i]) a->min[i] = b->min[i];
+    if(b->max[i] > a->max[i]) a->max[i] = b->max[i];
+  }
+}
+
+// The box around the transformed box, see Arvo, "Transforming Axis-Aligned Bounding Boxes"
+static struct bounds bounds_transform(const Matrix*restrict m, const struct bounds*restrict b){
+  struct bounds r;
+  for(unsigned i=0; i<3; i++){
+    r.min[i] = r.max[i] = m->axis[3].data[i];
+    for(unsigned j=0; j<3; j++){
+      const float e = m->axis[j].data[i] * b->min[j];
+      const float f = m->axis[j].data[i] * b->max[j];
+      r.min[i] += e < f ? e : f;
+      r.max[i] += e < f ? f : e;
+    }
+  }
+  return r;
+}
+
+struct scene* scene_create(void){
+  return dparaster_calloc(1, sizeof(struct scene), DPM_GEOMETRY);
+}
+
+void scene_free(struct scene* scene){
+  dparaster_free(scene->object);
+  dparaster_free(scene->order);
+  dparaster_free(scene->node);
+  dparaster_free(scene);
+}
+
+int scene_add(struct scene*restrict scene, const Geometry*restrict geometry, Matrix transform){
+  if(scene->object_count >= (unsigned)INT_MAX)
+    return -1;
+  if(scene->object_count == scene->object_capacity){
+    const unsigned capacity = scene->object_capacity ? scene->object_capacity * 2 : 64;
+    struct scene_object* object = dparaster_realloc(scene->object, sizeof(*object) * capacity, DPM_GEOMETRY);
+    if(!object)
+      return -1;
+    scene->object = object;
+    scene->object_capacity = capacity;
+  }
+  Vector bounds[2];
+  geometry_bounds(geometry, bounds);
+  struct scene_object*restrict it = &scene->object[scene->object_count];
+  *it = (struct scene_object){
+    .geometry = geometry,
+    .transform = transform,
+  };
+  for(unsigned i=0; i<3; i++){
+    it->local.min[i] = bounds[0].data[i];
+    it->local.max[i] = bounds[1].data[i];
+  }
+  it->world = bounds_transform(&transform, &it->local);
+  scene->need_build = true;
+  return scene->object_count++;
+}
+
+void scene_set_transform(struct scene* scene, int object, Matrix transform){
+  struct scene_object*restrict it = &scene->object[object];
+  it->transform = transform;
+  it->world = bounds_transform(&transform, &it->local);
+  scene->need_refit = true;
+}
+
+const Geometry* scene_get_geometry(const struct scene* scene, int object){
+  return scene->object[object].geometry;
+}
+
+Matrix scene_get_transform(const struct scene* scene, int object){
+  return scene->object[object].transform;
+}
+
+// Twice the center, which sorts the same
+static inline float centroid(const struct scene_object* object, unsigned axis){
+  return object->world.min[axis] + object->world.max[axis];
+}
+
+// Moves the objects so the first half has the smaller centers, by quickselect
+static void median_split(struct scene*restrict scene, unsigned axis, unsigned first, unsigned count){
+  int*restrict order = scene->order;
+  long lo = first, hi = (long)first + count - 1;
+  const long nth = first + count / 2;
+  while(lo < hi){
+    const float pivot = centroid(&scene->object[order[lo + (hi - lo) / 2]], axis);
+    long i = lo, j = hi;
+    while(i <= j){
+      while(centroid(&scene->object[order[i]], axis) < pivot) i++;
+      while(centroid(&scene->object[order[j]], axis) > pivot) j--;
+      if(i <= j){
+        const int tmp = order[i];
+        order[i++] = order[j];
+        order[j--] = tmp;
+      }
+    }
+    if(nth <= j){
+      hi = j;
+    }else if(nth >= i){
+      lo = i;
+    }else{
+      break;
+    }
+  }
+}
+
+// Splits the objects at the middle of the longest side of the box around their centers. If that
+// leaves no more than an eighth on one side, they're split in half by count instead, which keeps the
+// depth of the tree logarithmic, and the recursion off the end of the stack, however they're spread.
+static void build_node(struct scene*restrict scene, unsigned index, unsigned first, unsigned count){
+  struct scene_node*restrict node = &scene->node[index];
+  struct bounds center = empty_bounds;
+  node->bounds = empty_bounds;
+  for(unsigned i=first; i<first+count; i++){
+    const struct scene_object* object = &scene->object[scene->order[i]];
+    bounds_add(&node->bounds, &object->world);
+    for(unsigned a=0; a<3; a++){
+      const float c = centroid(object, a);
+      if(c < center.min[a]) center.min[a] = c;
+      if(c > center.max[a]) center.max[a] = c;
+    }
+  }
+  if(count <= LEAF_SIZE){
+    node->first = first;
+    node->count = count;
+    return;
+  }
+  unsigned axis = 0;
+  for(unsigned a=1; a<3; a++)
+    if(center.max[a] - center.min[a] > center.max[axis] - center.min[axis])
+      axis = a;
+  const float middle = (center.min[axis] + center.max[axis]) / 2;
+  unsigned split = first;
+  for(unsigned i=first; i<first+count; i++){
+    if(centroid(&scene->object[scene->order[i]], axis) < middle){
+      const int tmp = scene->order[i];
+      scene->order[i] = scene->order[split];
+      scene->order[split++] = tmp;
+    }
+  }
+  split -= first;
+  if(split <= count / 8 || count - split <= count / 8){
+    median_split(scene, axis, first, count);
+    split = count / 2;
+  }
+  const unsigned children = scene->node_count;
+  scene->node_count += 2;
+  node->first = children;
+  node->count = 0;
+  build_node(scene, children, first, split);
+  build_node(scene, children+1, first+split, count-split);
+}
+
+bool scene_build(struct scene* scene){
+  const unsigned n = scene->object_count;
+  scene->node_count = 0;
+  if(!n){
+    scene->need_build = scene->need_refit = false;
+    return true;
+  }
+  int* order = dparaster_realloc(scene->order, sizeof(*order) * n, DPM_GEOMETRY);
+  if(!order)
+    return false;
+  scene->order = order;
+  struct scene_node* node = dparaster_realloc(scene->node, sizeof(*node) * (2*n - 1), DPM_GEOMETRY);
+  if(!node)
+    return false;
+  scene->node = node;
+  for(unsigned i=0; i<n; i++)
+    order[i] = i;
+  scene->node_count = 1;
+  build_node(scene, 0, 0, n);
+  scene->need_build = scene->need_refit = false;
+  return true;
+}
+
+void scene_refit(struct scene* scene){
+  // Children always come after their parent
+  for(unsigned i=scene->node_count; i--; ){
+    struct scene_node*restrict node = &scene->node[i];
+    node->bounds = empty_bounds;
+    if(node->count){
+      for(unsigned j=node->first; j<node->first+node->count; j++)
+        bounds_add(&node->bounds, &scene->object[scene->order[j]].world);
+    }else{
+      bounds_add(&node->bounds, &scene->node[node->first].bounds);
+      bounds_add(&node->bounds, &scene->node[node->first+1].bounds);
+    }
+  }
+  scene->need_refit = false;
+}
+
+// Planes with n·p + d >= 0 for points inside
+struct view_volume {
+  float plane[5][4];
+};
+
+static struct view_volume view_volume(const Matrix*restrict view, float margin){
+  struct view_volume v;
+  const unsigned row[5] = {0, 0, 1, 1, 2};
+  const float sign[5] = {1, -1, 1, -1, 1}; // x>=-1, x<=1, y>=-1, y<=1, z>=-1
+  for(unsigned p=0; p<5; p++){
+    for(unsigned j=0; j<4; j++)
+      v.plane[p][j] = sign[p] * view->axis[j].data[row[p]];
+    v.plane[p][3] += p < 2 ? 1 + margin : 1;
+  }
+  return v;
+}
+
+// -1 if the box is outside, 1 if it's inside, 0 if it's on the border
+static int classify(const struct view_volume*restrict v, const struct bounds*restrict b){
+  int result = 1;
+  for(unsigned p=0; p<5; p++){
+    const float*restrict plane = v->plane[p];
+    float d = plane[3], r = 0;
+    for(unsigned i=0; i<3; i++){
+      d += plane[i] * (b->min[i] + b->max[i]) / 2;
+      r += fabsf(plane[i]) * (b->max[i] - b->min[i]) / 2;
+    }
+    if(d + r < 0)
+      return -1;
+    if(d - r < 0)
+      result = 0;
+  }
+  return result;
+}
+
+struct cull {
+  const struct scene* scene;
+  struct view_volume volume;
+  int* visible;
+  int count;
+  unsigned nodes_visited;
+};
+
+static void cull_node(struct cull*restrict c, unsigned index, bool inside){
+  const struct scene* scene = c->scene;
+  const struct scene_node*restrict node = &scene->node[index];
+  c->nodes_visited++;
+  if(!inside){
+    const int r = classify(&c->volume, &node->bounds);
+    if(r < 0)
+      return;
+    inside = r > 0;
+  }
+  if(!node->count){
+    cull_node(c, node->first, inside);
+    cull_node(c, node->first+1, inside);
+    return;
+  }
+  for(unsigned i=node->first; i<node->first+node->count; i++){
+    const int object = scene->order[i];
+    if(inside || classify(&c->volume, &scene->object[object].world) >= 0)
+      c->visible[c->count++] = object;
+  }
+}
+
+int scene_cull(struct scene*restrict scene, Matrix view, float margin, int visible[restrict], struct scene_stats*restrict stats){
+  if(scene->need_build){
+    if(!scene_build(scene))
+      return -1;
+  }else if(scene->need_refit){
+    scene_refit(scene);
+  }
+  struct cull c = {
+    .scene = scene,
+    .volume = view_volume(&view, margin),
+    .visible = visible,
+  };
+  if(scene->node_count)
+    cull_node(&c, 0, false);
+  if(stats){
+    *stats = (struct scene_stats){
+      .objects = scene->object_count,
+      .visible = c.count,
+      .culled = scene->object_count - c.count,
+      .nodes_visited = c.nodes_visited,
+    };
+    for(int i=0; i<c.count; i++)
+      stats->triangles += scene->object[visible[i]].geometry->triangle_count;
+  }
+  return c.count;
+}
+
+static int by_index(const void* a, const void* b){
+  const int x = *(const int*)a, y = *(const int*)b;
+  return x < y ? -1 : x > y;
+}
+
+bool scene_draw(
+  Framebuffer*const restrict fb,
+  const ShaderProgram*const restrict shader,
+  const Uniform*const restrict uniform,
+  struct scene*const restrict scene,
+  struct scene_stats*restrict stats
+){
+  int* visible = dparaster_alloc(sizeof(*visible) * (scene->object_count ? scene->object_count : 1), DPM_SCRATCH);
+  if(!visible)
+    return false;
+  const int count = scene_cull(scene, uniform->modelview, 1.f / fb->w, visible, stats);
+  // Where objects are at the same depth, the one drawn last wins. In the order they were added,
+  // that's the same one as without culling.
+  if(count > 1)
+    qsort(visible, count, sizeof(*visible), by_index);
+  Uniform u = *uniform;
+  if(count > 0 && !u.tex && u.tex_future)
+    u.tex = texture_future_wait(u.tex_future);
+  for(int i=0; i<count; i++){
+    const struct scene_object*restrict object = &scene->object[visible[i]];
+    u.modelview = mmulm(uniform->modelview, object->transform);
+    draw(fb, shader, &u, object->geometry);
+  }
+  dparaster_free(visible);
+  return count >= 0;
+}
@@ -6,20 +6,58 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+
+#define HUGEPAGE_SIZE ((size_t)2<<20)
 
 static const struct texture_loader* loader_list;
 
+// Copies the file into anonymous memory aligned to huge pages. It can still be freed with munmap.
+static void* copy_to_hugepages(void* memory, size_t size){
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t length = (size + page - 1) / page * page;
+  uint8_t* area = mmap(0, length + HUGEPAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(area == MAP_FAILED)
+    return memory;
+  uint8_t* copy = (uint8_t*)(((uintptr_t)area + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+  if(copy > area)
+    munmap(area, copy - area);
+  if(area + HUGEPAGE_SIZE > copy)
+    munmap(copy + length, area + HUGEPAGE_SIZE - copy);
+#ifdef MADV_HUGEPAGE
+  madvise(copy, length, MADV_HUGEPAGE);
+#endif
+  memcpy(copy, memory, size);
+  mprotect(copy, length, PROT_READ);
+  munmap(memory, size);
+  return copy;
+}
+
 struct texture* texture_load(const char* file){
-  int fd = open(file, O_RDONLY);
-  if(!fd)
-    goto error;
+  return texture_load_with_flags(file, 0);
+}
+
+struct texture* texture_load_with_flags(const char* file, enum texture_load_flags flags){
+  int fd = open(file, O_RDONLY|O_CLOEXEC);
+  if(fd == -1)
+    return 0;
+  struct texture* texture = texture_load_fd(fd, flags);
+  close(fd); // The mapping stays valid
+  return texture;
+}
+
+struct texture* texture_load_fd(int fd, enum texture_load_flags flags){
   struct stat sb;
-  fstat(fd, &sb);
-  void* memory = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(fstat(fd, &sb) == -1)
+    goto error;
+  void* memory = mmap(0, sb.st_size, PROT_READ, MAP_SHARED | (flags & TLF_POPULATE ? MAP_POPULATE : 0), fd, 0);
   if(memory == MAP_FAILED)
-    goto error_after_open;
-  struct texture* texture = malloc(sizeof(struct texture));
+    goto error;
+  // Otherwise, the pages get faulted in one by one while drawing
+  madvise(memory, sb.st_size, MADV_WILLNEED);
+  struct texture* texture = dparaster_alloc(sizeof(struct texture), DPM_TEXTURE);
   if(!texture)
     goto error_after_mmap;
   const struct texture_loader* loader;
@@ -39,14 +77,18 @@ struct texture* texture_load(const char* file){
     munmap((void*)texture->file_content, texture->file_length);
     texture->file_content = 0;
     texture->file_length = 0;
+  }else if(flags & TLF_HUGEPAGES && (size_t)sb.st_size >= HUGEPAGE_SIZE){
+    uint8_t* copy = copy_to_hugepages(memory, sb.st_size);
+    texture->file_content = copy;
+    texture->img = copy + ((const uint8_t*)texture->img - (uint8_t*)memory);
+    for(unsigned i=0; i<texture->level_count; i++)
+      ((struct texture_level*)texture->level)[i].img = copy + ((const uint8_t*)texture->level[i].img - (uint8_t*)memory);
   }
   return texture;
 error_after_alloc:
-  free(texture);
+  dparaster_free(texture);
 error_after_mmap:
   munmap(memory, sb.st_size);
-error_after_open:
-  close(fd);
 error:
   return 0;
 }
@@ -55,23 +97,76 @@ void texture_free(struct texture* texture){
   if(texture->impl->free){
     texture->impl->free(texture);
   }else if(texture->file_content > texture->img || (uint8_t*)(texture->file_content)+texture->file_length <= (uint8_t*)texture->img){
-    free((void*)texture->img);
+    dparaster_free((void*)texture->img);
   }
   if(texture->file_content){
     munmap((void*)texture->file_content, texture->file_length);
     texture->file_content = 0;
     texture->file_length = 0;
   }
-  free(texture);
+  dparaster_free(texture);
+}
+
+struct texture_level texture_get_level(const struct texture* texture, unsigned level){
+  if(level)
+    return texture->level[level-1];
+  struct texture_level result = { .img = texture->img };
+  memcpy(result.size, texture->size, sizeof(result.size));
+  memcpy(result.stride, texture->stride, sizeof(result.stride));
+  return result;
+}
+
+size_t texture_level_data_size(const struct texture* texture, unsigned level){
+  const struct texture_level l = texture_get_level(texture, level);
+  if(texture->compression){
+    size_t size = texture_block_size(texture->compression);
+    for(unsigned i=0; i<texture->dimension_count; i++)
+      size *= i < 2 ? (l.size[i]+3) / 4 : l.size[i];
+    return size;
+  }
+  size_t last_stride = strnlen(texture->format, 4);
+  for(unsigned i=0; i<texture->dimension_count; i++){
+    size_t stride = l.stride[i];
+    if(!stride)
+      stride = last_stride * l.size[i];
+    last_stride = stride;
+  }
+  return last_stride;
+}
+
+// Neighbouring texels are usually in the same block, so the last few decoded blocks are kept around.
+// Entries are matched by content, so it doesn't matter if a texture at the same address got replaced.
+#define BLOCK_CACHE_SIZE 16
+static _Thread_local struct block_cache_entry {
+  enum texture_compression compression;
+  uint8_t block[16];
+  uint8_t texel[16][4];
+} block_cache[BLOCK_CACHE_SIZE];
+
+static const uint8_t* block_texel(const struct texture* texture, size_t c[3]){
+  const size_t block_size = texture_block_size(texture->compression);
+  const size_t bw = (texture->size[0]+3) / 4;
+  const size_t bh = texture->dimension_count > 1 ? (texture->size[1]+3) / 4 : 1;
+  const size_t index = (c[2] * bh + c[1]/4) * bw + c[0]/4;
+  const uint8_t* block = (const uint8_t*)texture->img + index * block_size;
+  struct block_cache_entry* entry = &block_cache[index % BLOCK_CACHE_SIZE];
+  if(entry->compression != texture->compression || memcmp(entry->block, block, block_size)){
+    entry->compression = texture->compression;
+    memcpy(entry->block, block, block_size);
+    texture_block_decode(texture->compression, block, entry->texel);
+  }
+  return entry->texel[c[1]%4*4 + c[0]%4];
 }
 
 void texture_texel_get_raw(const struct texture* texture, uint16_t result[], long long coord[], enum texture_lookup_mode tlm[]){
   size_t offset = 0;
+  size_t wrapped[3] = {0};
   {
     size_t last_stride = strnlen(texture->format, 4);
     for(unsigned i=0; i<texture->dimension_count; i++){
       long long c = coord[i];
-      switch(tlm[i]){
+      const bool layer = texture->layered && i == texture->dimension_count-1u;
+      switch(layer ? TL_CLAMP : tlm[i]){
         case TL_REPEAT: {
           c = c % texture->size[i];
           if(c < 0)
@@ -85,6 +180,7 @@ void texture_texel_get_raw(const struct texture* texture, uint16_t result[], lon
       }
       if(texture->flip[i])
         c = texture->size[i]-1 - c;
+      wrapped[i] = c;
       offset += last_stride * c;
       size_t stride = texture->stride[i];
       if(!stride)
@@ -92,10 +188,13 @@ void texture_texel_get_raw(const struct texture* texture, uint16_t result[], lon
       last_stride = stride;
     }
   }
+  const uint8_t* texel = texture->compression
+                      ? block_texel(texture, wrapped)
+                      : (const uint8_t*)texture->img + offset;
   for(unsigned i=0,j=0,n=4; i<n && texture->format[i]; i++,j++){
     if(texture->format[i] == 'X')
       continue;
-    result[j] = ((uint8_t*)texture->img)[offset+i] * 0x101;
+    result[j] = texel[i] * 0x101;
   }
 }
 
@@ -117,8 +216,13 @@ Vector texture_texel_get(const struct texture* texture, long long coord[], enum
 
 Vector texture_lookup(const struct texture* texture, float coord[], enum texture_lookup_mode tlm[]){
   long long texcoord[texture->dimension_count];
-  for(size_t i=0,n=texture->dimension_count; i<n; i++)
-    texcoord[i] = texture->size[i] * coord[i]; // Note: Discarding fraction, nearest approach
+  for(size_t i=0,n=texture->dimension_count; i<n; i++){
+    if(texture->layered && i == n-1){
+      texcoord[i] = lroundf(coord[i]); // Interpolation may leave it slightly off
+    }else{
+      texcoord[i] = texture->size[i] * coord[i]; // Note: Discarding fraction, nearest approach
+    }
+  }
   return texture_texel_get(texture, texcoord, tlm);
 }
 
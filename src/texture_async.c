@@ -0,0 +1,99 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+
+// One loader thread, it's started when the first texture is requested, and then stays around.
+// Textures are loaded in the order they were requested.
+
+struct texture_future {
+  struct texture_future* next;
+  enum texture_load_flags flags;
+  bool done;
+  struct texture* texture;
+  char file[];
+};
+
+static pthread_once_t loader_once = PTHREAD_ONCE_INIT;
+static bool loader_started;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t requested = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER;
+static struct texture_future *queue_first, *queue_last;
+
+static void* loader(void* param){
+  (void)param;
+  pthread_mutex_lock(&lock);
+  while(true){
+    while(!queue_first)
+      pthread_cond_wait(&requested, &lock);
+    struct texture_future* future = queue_first;
+    queue_first = future->next;
+    if(!queue_first)
+      queue_last = 0;
+    pthread_mutex_unlock(&lock);
+    struct texture* texture = texture_load_with_flags(future->file, future->flags);
+    pthread_mutex_lock(&lock);
+    future->texture = texture;
+    future->done = true;
+    pthread_cond_broadcast(&loaded);
+  }
+  return 0;
+}
+
+static void loader_start(void){
+  pthread_t thread;
+  if(pthread_create(&thread, 0, loader, 0))
+    return;
+  pthread_detach(thread);
+  loader_started = true;
+}
+
+struct texture_future* texture_load_async(const char* file, enum texture_load_flags flags){
+  const size_t length = strlen(file);
+  struct texture_future* future = dparaster_calloc(1, sizeof(*future) + length + 1, DPM_TEXTURE);
+  if(!future)
+    return 0;
+  memcpy(future->file, file, length + 1);
+  future->flags = flags;
+  pthread_once(&loader_once, loader_start);
+  if(!loader_started){ // Load it right away then
+    future->texture = texture_load_with_flags(file, flags);
+    future->done = true;
+    return future;
+  }
+  pthread_mutex_lock(&lock);
+  if(queue_last){
+    queue_last->next = future;
+  }else{
+    queue_first = future;
+  }
+  queue_last = future;
+  pthread_cond_signal(&requested);
+  pthread_mutex_unlock(&lock);
+  return future;
+}
+
+bool texture_future_ready(struct texture_future* future){
+  pthread_mutex_lock(&lock);
+  const bool done = future->done;
+  pthread_mutex_unlock(&lock);
+  return done;
+}
+
+struct texture* texture_future_wait(struct texture_future* future){
+  pthread_mutex_lock(&lock);
+  while(!future->done)
+    pthread_cond_wait(&loaded, &lock);
+  struct texture* texture = future->texture;
+  pthread_mutex_unlock(&lock);
+  return texture;
+}
+
+void texture_future_free(struct texture_future* future){
+  struct texture* texture = texture_future_wait(future);
+  if(texture)
+    texture_free(texture);
+  dparaster_free(future);
+}
@@ -0,0 +1,183 @@
+#include <dparaster/texture.h>
+#include <dparaster/utils.h>
+#include <string.h>
+
+size_t texture_block_size(enum texture_compression compression){
+  switch(compression){
+    case TC_NONE: break;
+    case TC_BC1: return 8;
+    case TC_BC3: return 16;
+  }
+  return 0;
+}
+
+static void rgb565_decode(uint16_t c, uint8_t out[4]){
+  const unsigned r = c >> 11, g = c >> 5 & 0x3F, b = c & 0x1F;
+  out[0] = r << 3 | r >> 2;
+  out[1] = g << 2 | g >> 4;
+  out[2] = b << 3 | b >> 2;
+  out[3] = 0xFF;
+}
+
+static uint16_t rgb565_encode(const uint8_t c[4]){
+  return (c[0] * 31 + 127) / 255 << 11
+       | (c[1] * 63 + 127) / 255 << 5
+       | (c[2] * 31 + 127) / 255;
+}
+
+// In a BC3 block, the colors are always interpolated, even if c0 <= c1
+static void color_palette(const uint8_t* block, bool opaque, uint8_t palette[4][4]){
+  const uint16_t c0 = u16le(block), c1 = u16le(block+2);
+  rgb565_decode(c0, palette[0]);
+  rgb565_decode(c1, palette[1]);
+  if(opaque || c0 > c1){
+    for(unsigned i=0; i<3; i++){
+      palette[2][i] = (2 * palette[0][i] + palette[1][i] + 1) / 3;
+      palette[3][i] = (palette[0][i] + 2 * palette[1][i] + 1) / 3;
+    }
+    palette[2][3] = palette[3][3] = 0xFF;
+  }else{
+    for(unsigned i=0; i<3; i++)
+      palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+    palette[2][3] = 0xFF;
+    memset(palette[3], 0, 4);
+  }
+}
+
+static void alpha_palette(uint8_t a0, uint8_t a1, uint8_t palette[8]){
+  palette[0] = a0;
+  palette[1] = a1;
+  if(a0 > a1){
+    for(unsigned i=1; i<7; i++)
+      palette[i+1] = ((7-i) * a0 + i * a1 + 3) / 7;
+  }else{
+    for(unsigned i=1; i<5; i++)
+      palette[i+1] = ((5-i) * a0 + i * a1 + 2) / 5;
+    palette[6] = 0;
+    palette[7] = 0xFF;
+  }
+}
+
+void texture_block_decode(enum texture_compression compression, const uint8_t* block, uint8_t texel[16][4]){
+  const uint8_t* color = compression == TC_BC3 ? block + 8 : block;
+  uint8_t palette[4][4];
+  color_palette(color, compression == TC_BC3, palette);
+  const uint32_t index = u32le(color+4);
+  for(unsigned i=0; i<16; i++)
+    memcpy(texel[i], palette[index >> i*2 & 3], 4);
+  if(compression == TC_BC3){
+    uint8_t alpha[8];
+    alpha_palette(block[0], block[1], alpha);
+    const uint64_t index = u32le(block+2) | (uint64_t)u16le(block+6) << 32;
+    for(unsigned i=0; i<16; i++)
+      texel[i][3] = alpha[index >> i*3 & 7];
+  }
+}
+
+static unsigned distance(const uint8_t a[4], const uint8_t b[4]){
+  unsigned d = 0;
+  for(unsigned i=0; i<3; i++)
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  return d;
+}
+
+// Uses the two texels furthest apart along the axis of the bounding box as the end points.
+// Texels with an alpha below 128 are left out if transparent is set, and get index 3.
+static void color_encode(const uint8_t texel[16][4], bool transparent, uint8_t* block){
+  uint8_t min[3] = {0xFF,0xFF,0xFF}, max[3] = {0};
+  bool any = false;
+  for(unsigned i=0; i<16; i++){
+    if(transparent && texel[i][3] < 128)
+      continue;
+    any = true;
+    for(unsigned j=0; j<3; j++){
+      if(texel[i][j] < min[j]) min[j] = texel[i][j];
+      if(texel[i][j] > max[j]) max[j] = texel[i][j];
+    }
+  }
+  int axis[3];
+  for(unsigned j=0; j<3; j++)
+    axis[j] = max[j] - min[j];
+  int lo = 0, hi = 0;
+  const uint8_t *e0 = min, *e1 = max;
+  bool first = true;
+  for(unsigned i=0; i<16; i++){
+    if(transparent && texel[i][3] < 128)
+      continue;
+    const int p = texel[i][0] * axis[0] + texel[i][1] * axis[1] + texel[i][2] * axis[2];
+    if(first || p < lo){ lo = p; e0 = texel[i]; }
+    if(first || p > hi){ hi = p; e1 = texel[i]; }
+    first = false;
+  }
+  uint16_t c0 = any ? rgb565_encode(e1) : 0;
+  uint16_t c1 = any ? rgb565_encode(e0) : 0;
+  // c0 > c1 selects 4 colors, c0 <= c1 selects 3 colors and transparent black
+  if(transparent ? c0 > c1 : c0 < c1){
+    const uint16_t t = c0;
+    c0 = c1;
+    c1 = t;
+  }
+  block[0] = c0; block[1] = c0 >> 8;
+  block[2] = c1; block[3] = c1 >> 8;
+  uint8_t palette[4][4];
+  color_palette(block, !transparent, palette);
+  const unsigned colors = transparent || c0 == c1 ? 3 : 4;
+  uint32_t index = 0;
+  for(unsigned i=0; i<16; i++){
+    unsigned best = 3;
+    if(!transparent || texel[i][3] >= 128){
+      unsigned best_distance = -1;
+      for(unsigned j=0; j<colors; j++){
+        const unsigned d = distance(texel[i], palette[j]);
+        if(d < best_distance){
+          best_distance = d;
+          best = j;
+        }
+      }
+    }
+    index |= (uint32_t)best << i*2;
+  }
+  block[4] = index; block[5] = index >> 8; block[6] = index >> 16; block[7] = index >> 24;
+}
+
+static void alpha_encode(const uint8_t texel[16][4], uint8_t* block){
+  uint8_t min = 0xFF, max = 0;
+  for(unsigned i=0; i<16; i++){
+    if(texel[i][3] < min) min = texel[i][3];
+    if(texel[i][3] > max) max = texel[i][3];
+  }
+  uint8_t palette[8];
+  alpha_palette(max, min, palette);
+  block[0] = max;
+  block[1] = min;
+  uint64_t index = 0;
+  for(unsigned i=0; i<16; i++){
+    unsigned best = 0, best_distance = -1;
+    for(unsigned j=0; j<8; j++){
+      const unsigned d = (texel[i][3] - palette[j]) * (texel[i][3] - palette[j]);
+      if(d < best_distance){
+        best_distance = d;
+        best = j;
+      }
+    }
+    index |= (uint64_t)best << i*3;
+  }
+  for(unsigned i=0; i<6; i++)
+    block[2+i] = index >> i*8;
+}
+
+void texture_block_encode(enum texture_compression compression, const uint8_t texel[16][4], uint8_t* block){
+  switch(compression){
+    case TC_NONE: break;
+    case TC_BC1: {
+      bool transparent = false;
+      for(unsigned i=0; i<16; i++)
+        transparent |= texel[i][3] < 128;
+      color_encode(texel, transparent, block);
+    } break;
+    case TC_BC3: {
+      alpha_encode(texel, block);
+      color_encode(texel, false, block+8);
+    } break;
+  }
+}
@@ -0,0 +1,212 @@
+#define _DEFAULT_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dparaster/texture.h>
+#include <dparaster/allocator.h>
+
+#define BUCKET_COUNT 64
+
+struct texture_cache_entry {
+  struct texture_cache_entry* next; // In the bucket
+  struct texture_cache_entry *lru_prev, *lru_next; // Only unused entries are in the LRU list
+  struct texture* texture;
+  char* file;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  size_t memory;
+  unsigned refcount;
+  bool stale; // The file changed, it's not in the buckets anymore
+  bool loading; // Its texture isn't there yet, the one loading it holds a reference
+};
+
+struct texture_cache {
+  pthread_mutex_t lock;
+  pthread_cond_t loaded; // Signalled whenever a texture finished loading, or failed to
+  size_t budget;
+  size_t unused_memory;
+  struct texture_cache_entry *lru_first, *lru_last; // first is the most recently used one
+  struct texture_cache_entry* bucket[BUCKET_COUNT];
+};
+
+static size_t texture_memory(const struct texture* texture){
+  if(texture->file_content)
+    return texture->file_length;
+  size_t memory = 0;
+  for(unsigned i=0; i<=texture->level_count; i++)
+    memory += texture_level_data_size(texture, i);
+  return memory;
+}
+
+static unsigned hash(const char* file){
+  uint32_t h = 2166136261u; // FNV-1a
+  while(*file)
+    h = (h ^ (uint8_t)*file++) * 16777619u;
+  return h % BUCKET_COUNT;
+}
+
+static void lru_unlink(struct texture_cache* cache, struct texture_cache_entry* entry){
+  if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+  else cache->lru_first = entry->lru_next;
+  if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+  else cache->lru_last = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = 0;
+  cache->unused_memory -= entry->memory;
+}
+
+static void lru_push(struct texture_cache* cache, struct texture_cache_entry* entry){
+  entry->lru_prev = 0;
+  entry->lru_next = cache->lru_first;
+  if(cache->lru_first) cache->lru_first->lru_prev = entry;
+  else cache->lru_last = entry;
+  cache->lru_first = entry;
+  cache->unused_memory += entry->memory;
+}
+
+static void bucket_unlink(struct texture_cache* cache, struct texture_cache_entry* entry){
+  for(struct texture_cache_entry** it=&cache->bucket[hash(entry->file)]; *it; it=&(*it)->next){
+    if(*it == entry){
+      *it = entry->next;
+      break;
+    }
+  }
+  entry->next = 0;
+}
+
+static void entry_free(struct texture_cache_entry* entry){
+  texture_free(entry->texture);
+  dparaster_free(entry->file);
+  dparaster_free(entry);
+}
+
+static void evict(struct texture_cache* cache){
+  while(cache->lru_last && cache->unused_memory > cache->budget){
+    struct texture_cache_entry* entry = cache->lru_last;
+    lru_unlink(cache, entry);
+    bucket_unlink(cache, entry);
+    entry_free(entry);
+  }
+}
+
+struct texture_cache* texture_cache_create(size_t budget){
+  struct texture_cache* cache = dparaster_calloc(1, sizeof(*cache), DPM_TEXTURE);
+  if(!cache)
+    return 0;
+  cache->budget = budget;
+  pthread_mutex_init(&cache->lock, 0);
+  pthread_cond_init(&cache->loaded, 0);
+  return cache;
+}
+
+// The file is identified by what was opened, and loaded from that, so it can't be replaced in between.
+// It's loaded without holding the lock, an entry marked as loading makes others acquiring the same
+// file wait for it instead of loading it again.
+const struct texture* texture_cache_acquire(struct texture_cache* cache, const char* file){
+  int fd = open(file, O_RDONLY|O_CLOEXEC);
+  if(fd == -1)
+    return 0;
+  struct stat sb;
+  if(fstat(fd, &sb) == -1){
+    close(fd);
+    return 0;
+  }
+  pthread_mutex_lock(&cache->lock);
+  struct texture_cache_entry** bucket = &cache->bucket[hash(file)];
+lookup:
+  for(struct texture_cache_entry* entry=*bucket; entry; entry=entry->next){
+    if(strcmp(entry->file, file))
+      continue;
+    if( entry->dev == sb.st_dev && entry->ino == sb.st_ino
+     && entry->mtime.tv_sec == sb.st_mtim.tv_sec && entry->mtime.tv_nsec == sb.st_mtim.tv_nsec
+    ){
+      if(entry->loading){
+        // If loading fails, the entry is gone afterwards, and this one tries it again
+        pthread_cond_wait(&cache->loaded, &cache->lock);
+        goto lookup;
+      }
+      if(!entry->refcount++)
+        lru_unlink(cache, entry);
+      pthread_mutex_unlock(&cache->lock);
+      close(fd);
+      return entry->texture;
+    }
+    // The file changed. Users of the old texture can keep it until they release it.
+    bucket_unlink(cache, entry);
+    if(entry->refcount){
+      entry->stale = true;
+    }else{
+      lru_unlink(cache, entry);
+      entry_free(entry);
+    }
+    break;
+  }
+  struct texture_cache_entry* entry = dparaster_calloc(1, sizeof(*entry), DPM_TEXTURE);
+  if(!entry)
+    goto error;
+  entry->file = dparaster_strdup(file, DPM_TEXTURE);
+  if(!entry->file)
+    goto error_after_alloc;
+  entry->dev = sb.st_dev;
+  entry->ino = sb.st_ino;
+  entry->mtime = sb.st_mtim;
+  entry->refcount = 1;
+  entry->loading = true;
+  entry->next = *bucket;
+  *bucket = entry;
+  pthread_mutex_unlock(&cache->lock);
+  struct texture* texture = texture_load_fd(fd, 0);
+  close(fd);
+  pthread_mutex_lock(&cache->lock);
+  entry->loading = false;
+  pthread_cond_broadcast(&cache->loaded);
+  if(!texture)
+    goto error_after_insert;
+  texture->cache_entry = entry;
+  entry->texture = texture;
+  entry->memory = texture_memory(texture);
+  pthread_mutex_unlock(&cache->lock);
+  return texture;
+error_after_insert:
+  if(!entry->stale)
+    bucket_unlink(cache, entry);
+  dparaster_free(entry->file);
+  dparaster_free(entry);
+  pthread_mutex_unlock(&cache->lock);
+  return 0;
+error_after_alloc:
+  dparaster_free(entry);
+error:
+  pthread_mutex_unlock(&cache->lock);
+  close(fd);
+  return 0;
+}
+
+void texture_cache_release(struct texture_cache* cache, const struct texture* texture){
+  struct texture_cache_entry* entry = texture->cache_entry;
+  pthread_mutex_lock(&cache->lock);
+  if(!--entry->refcount){
+    if(entry->stale){
+      entry_free(entry);
+    }else{
+      lru_push(cache, entry);
+      evict(cache);
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void texture_cache_free(struct texture_cache* cache){
+  while(cache->lru_last){
+    struct texture_cache_entry* entry = cache->lru_last;
+    lru_unlink(cache, entry);
+    entry_free(entry);
+  }
+  pthread_cond_destroy(&cache->loaded);
+  pthread_mutex_destroy(&cache->lock);
+  dparaster_free(cache);
+}